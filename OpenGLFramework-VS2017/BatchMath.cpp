@@ -0,0 +1,266 @@
+///////////////////////////////////////////////////////////////////////////////
+// BatchMath.cpp
+// =============
+// Vector math over whole arrays in structure-of-arrays form
+//
+// Every kernel is written once against a small set of lane operations and
+// instantiated for each register width; run() walks the arrays from the
+// widest width down to single floats.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cmath>
+#include "BatchMath.h"
+
+struct ScalarLanes
+{
+  typedef float Type;
+  enum { width = 1 };
+  static Type load(const float* p)      { return *p; }
+  static void store(float* p, Type v)   { *p = v; }
+  static Type set1(float s)             { return s; }
+  static Type add(Type a, Type b)       { return a + b; }
+  static Type sub(Type a, Type b)       { return a - b; }
+  static Type mul(Type a, Type b)       { return a * b; }
+  // 1 / sqrt(s), 0 for s == 0
+  static Type invSqrtOrZero(Type s)     { return s > 0.f ? 1.f / sqrtf(s) : 0.f; }
+  static Type invSqrtFastOrZero(Type s) { return s > 0.f ? invSqrtFast(s) : 0.f; }
+};
+
+#if defined(MATH_USE_SSE)
+struct SseLanes
+{
+  typedef __m128 Type;
+  enum { width = 4 };
+  static Type load(const float* p)      { return _mm_loadu_ps(p); }
+  static void store(float* p, Type v)   { _mm_storeu_ps(p, v); }
+  static Type set1(float s)             { return _mm_set1_ps(s); }
+  static Type add(Type a, Type b)       { return _mm_add_ps(a, b); }
+  static Type sub(Type a, Type b)       { return _mm_sub_ps(a, b); }
+  static Type mul(Type a, Type b)       { return _mm_mul_ps(a, b); }
+  static Type invSqrtOrZero(Type s)
+  {
+    // 1 / sqrt(0) is infinite; the mask clears it
+    Type r = _mm_div_ps(_mm_set1_ps(1.f), _mm_sqrt_ps(s));
+    return _mm_and_ps(_mm_cmpgt_ps(s, _mm_setzero_ps()), r);
+  }
+  static Type invSqrtFastOrZero(Type s)
+  {
+    Type r = _mm_rsqrt_ps(s);
+    r = _mm_mul_ps(r, _mm_sub_ps(_mm_set1_ps(1.5f), _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), s), _mm_mul_ps(r, r))));
+    return _mm_and_ps(_mm_cmpgt_ps(s, _mm_setzero_ps()), r);
+  }
+};
+#endif
+
+#if defined(MATH_USE_AVX)
+struct AvxLanes
+{
+  typedef __m256 Type;
+  enum { width = 8 };
+  static Type load(const float* p)      { return _mm256_loadu_ps(p); }
+  static void store(float* p, Type v)   { _mm256_storeu_ps(p, v); }
+  static Type set1(float s)             { return _mm256_set1_ps(s); }
+  static Type add(Type a, Type b)       { return _mm256_add_ps(a, b); }
+  static Type sub(Type a, Type b)       { return _mm256_sub_ps(a, b); }
+  static Type mul(Type a, Type b)       { return _mm256_mul_ps(a, b); }
+  static Type invSqrtOrZero(Type s)
+  {
+    Type r = _mm256_div_ps(_mm256_set1_ps(1.f), _mm256_sqrt_ps(s));
+    return _mm256_and_ps(_mm256_cmp_ps(s, _mm256_setzero_ps(), _CMP_GT_OQ), r);
+  }
+  static Type invSqrtFastOrZero(Type s)
+  {
+    Type r = _mm256_rsqrt_ps(s);
+    r = _mm256_mul_ps(r, _mm256_sub_ps(_mm256_set1_ps(1.5f), _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(0.5f), s), _mm256_mul_ps(r, r))));
+    return _mm256_and_ps(_mm256_cmp_ps(s, _mm256_setzero_ps(), _CMP_GT_OQ), r);
+  }
+};
+#endif
+
+#if defined(BATCH_MATH_USE_AVX512)
+struct Avx512Lanes
+{
+  typedef __m512 Type;
+  enum { width = 16 };
+  static Type load(const float* p)      { return _mm512_loadu_ps(p); }
+  static void store(float* p, Type v)   { _mm512_storeu_ps(p, v); }
+  static Type set1(float s)             { return _mm512_set1_ps(s); }
+  static Type add(Type a, Type b)       { return _mm512_add_ps(a, b); }
+  static Type sub(Type a, Type b)       { return _mm512_sub_ps(a, b); }
+  static Type mul(Type a, Type b)       { return _mm512_mul_ps(a, b); }
+  static Type invSqrtOrZero(Type s)
+  {
+    __mmask16 positive = _mm512_cmp_ps_mask(s, _mm512_setzero_ps(), _CMP_GT_OQ);
+    return _mm512_maskz_div_ps(positive, _mm512_set1_ps(1.f), _mm512_sqrt_ps(s));
+  }
+  static Type invSqrtFastOrZero(Type s)
+  {
+    __mmask16 positive = _mm512_cmp_ps_mask(s, _mm512_setzero_ps(), _CMP_GT_OQ);
+    Type r = _mm512_rsqrt14_ps(s);
+    r = _mm512_mul_ps(r, _mm512_sub_ps(_mm512_set1_ps(1.5f), _mm512_mul_ps(_mm512_mul_ps(_mm512_set1_ps(0.5f), s), _mm512_mul_ps(r, r))));
+    return _mm512_maskz_mov_ps(positive, r);
+  }
+};
+#endif
+
+// Kernel<Lanes>::run(i, count, args...) processes whole groups of
+// Lanes::width elements from i on and returns where it stopped
+template <template <class> class Kernel, class... Args>
+static void run(int count, Args... args)
+{
+  int i = 0;
+#if defined(BATCH_MATH_USE_AVX512)
+  i = Kernel<Avx512Lanes>::run(i, count, args...);
+#endif
+#if defined(MATH_USE_AVX)
+  i = Kernel<AvxLanes>::run(i, count, args...);
+#endif
+#if defined(MATH_USE_SSE)
+  i = Kernel<SseLanes>::run(i, count, args...);
+#endif
+  Kernel<ScalarLanes>::run(i, count, args...);
+}
+
+// upper 3x4 of m, row by row
+struct AffineRows
+{
+  float a[12];
+
+  AffineRows(const Matrix4& m, bool isAbsolute, bool hasTranslation)
+  {
+    for (int row = 0; row < 3; row++) {
+      Vector4 r = m.getRow(row);
+      a[row * 4 + 0] = isAbsolute ? fabsf(r.x) : r.x;
+      a[row * 4 + 1] = isAbsolute ? fabsf(r.y) : r.y;
+      a[row * 4 + 2] = isAbsolute ? fabsf(r.z) : r.z;
+      a[row * 4 + 3] = hasTranslation ? r.w : 0.f;
+    }
+  }
+};
+
+template <class L>
+struct TransformKernel
+{
+  static int run(int i, int count, const AffineRows* rows, const float* x, const float* y, const float* z,
+                 float* outX, float* outY, float* outZ)
+  {
+    typedef typename L::Type T;
+    const float* a = rows->a;
+    T m00 = L::set1(a[0]), m01 = L::set1(a[1]), m02 = L::set1(a[2]),  m03 = L::set1(a[3]);
+    T m10 = L::set1(a[4]), m11 = L::set1(a[5]), m12 = L::set1(a[6]),  m13 = L::set1(a[7]);
+    T m20 = L::set1(a[8]), m21 = L::set1(a[9]), m22 = L::set1(a[10]), m23 = L::set1(a[11]);
+    for (; i + L::width <= count; i += L::width) {
+      T px = L::load(x + i), py = L::load(y + i), pz = L::load(z + i);
+      T rx = L::add(L::add(L::mul(m00, px), L::mul(m01, py)), L::add(L::mul(m02, pz), m03));
+      T ry = L::add(L::add(L::mul(m10, px), L::mul(m11, py)), L::add(L::mul(m12, pz), m13));
+      T rz = L::add(L::add(L::mul(m20, px), L::mul(m21, py)), L::add(L::mul(m22, pz), m23));
+      L::store(outX + i, rx); L::store(outY + i, ry); L::store(outZ + i, rz);
+    }
+    return i;
+  }
+};
+
+template <class L>
+struct NormalizeKernel
+{
+  static int run(int i, int count, bool isFast, float* x, float* y, float* z)
+  {
+    typedef typename L::Type T;
+    for (; i + L::width <= count; i += L::width) {
+      T vx = L::load(x + i), vy = L::load(y + i), vz = L::load(z + i);
+      T lengthSquare = L::add(L::add(L::mul(vx, vx), L::mul(vy, vy)), L::mul(vz, vz));
+      T invLength = isFast ? L::invSqrtFastOrZero(lengthSquare) : L::invSqrtOrZero(lengthSquare);
+      L::store(x + i, L::mul(vx, invLength)); L::store(y + i, L::mul(vy, invLength)); L::store(z + i, L::mul(vz, invLength));
+    }
+    return i;
+  }
+};
+
+template <class L>
+struct DotKernel
+{
+  static int run(int i, int count, const float* ax, const float* ay, const float* az,
+                 const float* bx, const float* by, const float* bz, float* out)
+  {
+    for (; i + L::width <= count; i += L::width) {
+      L::store(out + i, L::add(L::add(L::mul(L::load(ax + i), L::load(bx + i)),
+                                      L::mul(L::load(ay + i), L::load(by + i))),
+                               L::mul(L::load(az + i), L::load(bz + i))));
+    }
+    return i;
+  }
+};
+
+template <class L>
+struct CrossKernel
+{
+  static int run(int i, int count, const float* ax, const float* ay, const float* az,
+                 const float* bx, const float* by, const float* bz, float* outX, float* outY, float* outZ)
+  {
+    typedef typename L::Type T;
+    for (; i + L::width <= count; i += L::width) {
+      T x1 = L::load(ax + i), y1 = L::load(ay + i), z1 = L::load(az + i);
+      T x2 = L::load(bx + i), y2 = L::load(by + i), z2 = L::load(bz + i);
+      L::store(outX + i, L::sub(L::mul(y1, z2), L::mul(z1, y2)));
+      L::store(outY + i, L::sub(L::mul(z1, x2), L::mul(x1, z2)));
+      L::store(outZ + i, L::sub(L::mul(x1, y2), L::mul(y1, x2)));
+    }
+    return i;
+  }
+};
+
+const char* batchMathPath()
+{
+#if defined(BATCH_MATH_USE_AVX512)
+  return "AVX-512";
+#else
+  return mathSimdPath();
+#endif
+}
+
+void transformPoints(const Matrix4& m, const float* x, const float* y, const float* z, int count,
+                     float* outX, float* outY, float* outZ)
+{
+  AffineRows rows(m, false, true);
+  run<TransformKernel>(count, (const AffineRows*)&rows, x, y, z, outX, outY, outZ);
+}
+
+void transformDirections(const Matrix4& m, const float* x, const float* y, const float* z, int count,
+                         float* outX, float* outY, float* outZ)
+{
+  AffineRows rows(m, false, false);
+  run<TransformKernel>(count, (const AffineRows*)&rows, x, y, z, outX, outY, outZ);
+}
+
+void transformBoxes(const Matrix4& m, const float* cx, const float* cy, const float* cz,
+                    const float* ex, const float* ey, const float* ez, int count,
+                    float* outCX, float* outCY, float* outCZ, float* outEX, float* outEY, float* outEZ)
+{
+  AffineRows centerRows(m, false, true);
+  AffineRows extentRows(m, true, false);
+  run<TransformKernel>(count, (const AffineRows*)&centerRows, cx, cy, cz, outCX, outCY, outCZ);
+  run<TransformKernel>(count, (const AffineRows*)&extentRows, ex, ey, ez, outEX, outEY, outEZ);
+}
+
+void normalizeVectors(float* x, float* y, float* z, int count)
+{
+  run<NormalizeKernel>(count, false, x, y, z);
+}
+
+void normalizeVectorsFast(float* x, float* y, float* z, int count)
+{
+  run<NormalizeKernel>(count, true, x, y, z);
+}
+
+void dotVectors(const float* ax, const float* ay, const float* az,
+                const float* bx, const float* by, const float* bz, int count, float* out)
+{
+  run<DotKernel>(count, ax, ay, az, bx, by, bz, out);
+}
+
+void crossVectors(const float* ax, const float* ay, const float* az,
+                  const float* bx, const float* by, const float* bz, int count,
+                  float* outX, float* outY, float* outZ)
+{
+  run<CrossKernel>(count, ax, ay, az, bx, by, bz, outX, outY, outZ);
+}
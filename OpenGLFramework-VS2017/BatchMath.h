@@ -0,0 +1,73 @@
+///////////////////////////////////////////////////////////////////////////////
+// BatchMath.h
+// ===========
+// Vector math over whole arrays in structure-of-arrays form
+//
+// Each kernel takes x, y and z in separate float arrays, so one instruction
+// works on as many elements as the widest registers hold: 16 with AVX-512
+// (__AVX512F__), 8 with AVX, 4 with SSE. What is left over runs on the next
+// narrower width and finally one element at a time, so any count works and
+// the arrays need no padding or alignment.
+//
+// Outputs may be the inputs themselves; every element is read before it is
+// written.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef BATCH_MATH_H_DEF
+#define BATCH_MATH_H_DEF
+
+#include <vector>
+#include "Vectors.h"
+#include "Matrices.h"
+
+#if defined(MATH_USE_AVX) && defined(__AVX512F__)
+#define BATCH_MATH_USE_AVX512
+#endif
+
+// structure-of-arrays storage for many Vector3
+struct Vector3Batch
+{
+  std::vector<float> x, y, z;
+
+  void    resize(int count) { x.resize(count); y.resize(count); z.resize(count); }
+  int     size() const { return (int)x.size(); }
+  void    set(int i, const Vector3& v) { x[i] = v.x; y[i] = v.y; z[i] = v.z; }
+  Vector3 get(int i) const { return Vector3(x[i], y[i], z[i]); }
+};
+
+// widest path compiled in, for benchmark reports
+const char* batchMathPath();
+
+// m * (x, y, z, 1). The last row of m is taken as (0, 0, 0, 1), as for any
+// model or viewing matrix.
+void transformPoints(const Matrix4& m, const float* x, const float* y, const float* z, int count,
+                     float* outX, float* outY, float* outZ);
+
+// m * (x, y, z, 0)
+void transformDirections(const Matrix4& m, const float* x, const float* y, const float* z, int count,
+                         float* outX, float* outY, float* outZ);
+
+// axis aligned boxes in center / half extent form, as in BoundsBatch: the
+// smallest axis aligned box around each box transformed by the affine m.
+// The center goes through m, the extent through m with absolute values.
+void transformBoxes(const Matrix4& m, const float* cx, const float* cy, const float* cz,
+                    const float* ex, const float* ey, const float* ez, int count,
+                    float* outCX, float* outCY, float* outCZ, float* outEX, float* outEY, float* outEZ);
+
+// in place; zero vectors stay zero. normalizeVectors() divides by sqrt like
+// Vector3::normalize(), normalizeVectorsFast() multiplies by the rsqrt
+// estimate after one Newton step like Vector3::normalizeFast() (AVX-512
+// starts from a 14 bit estimate, the others from 12 bits)
+void normalizeVectors(float* x, float* y, float* z, int count);
+void normalizeVectorsFast(float* x, float* y, float* z, int count);
+
+// out[i] = a[i] . b[i]
+void dotVectors(const float* ax, const float* ay, const float* az,
+                const float* bx, const float* by, const float* bz, int count, float* out);
+
+// out[i] = a[i] x b[i]
+void crossVectors(const float* ax, const float* ay, const float* az,
+                  const float* bx, const float* by, const float* bz, int count,
+                  float* outX, float* outY, float* outZ);
+
+#endif
@@ -0,0 +1,94 @@
+///////////////////////////////////////////////////////////////////////////////
+// BenchmarkScript.cpp
+// ===================
+// Camera, model and light keyframes for the --benchmark mode
+///////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include "BenchmarkScript.h"
+
+static const float DEG2RAD = 3.14159265f / 180.f;
+
+bool BenchmarkScript::load(const char* path)
+{
+  std::ifstream file(path);
+  if (!file) {
+    std::cout << "Cannot read " << path << std::endl;
+    return false;
+  }
+  std::string line;
+  for (int number = 1; std::getline(file, line); number++) {
+    line = line.substr(0, line.find('#'));
+    std::istringstream in(line);
+    std::string command, rest;
+    if (!(in >> command)) continue;
+    auto fail = [&]() {
+      std::cout << path << ":" << number << ": cannot parse \"" << line << "\"" << std::endl;
+      return false;
+    };
+
+    if (command == "frames" || command == "warmup") {
+      int value;
+      if (!(in >> value) || value < (command == "frames" ? 1 : 0) || in >> rest) return fail();
+      (command == "frames" ? frames : warmup) = value;
+      continue;
+    }
+    std::vector<Key>* keys;
+    int count;
+    if (command == "camera")     { keys = &cameraKeys; count = 6; }
+    else if (command == "model") { keys = &modelKeys;  count = 9; }
+    else if (command == "light") { keys = &lightKeys;  count = 3; }
+    else return fail();
+
+    Key key;
+    bool isValid = (bool)(in >> key.t);
+    for (int i = 0; isValid && i < count; i++) isValid = (bool)(in >> key.values[i]);
+    if (!isValid || in >> rest) return fail();
+    keys->push_back(key);
+  }
+  // keyframes may be written in any order
+  auto byTime = [](const Key& a, const Key& b) { return a.t < b.t; };
+  std::stable_sort(cameraKeys.begin(), cameraKeys.end(), byTime);
+  std::stable_sort(modelKeys.begin(), modelKeys.end(), byTime);
+  std::stable_sort(lightKeys.begin(), lightKeys.end(), byTime);
+  return true;
+}
+
+void BenchmarkScript::sample(const std::vector<Key>& keys, float t, float* values, int count)
+{
+  size_t next = 0;
+  while (next < keys.size() && keys[next].t <= t) next++;
+  const Key& a = keys[next == 0 ? 0 : next - 1];
+  const Key& b = keys[next == keys.size() ? next - 1 : next];
+  float s = b.t > a.t ? (t - a.t) / (b.t - a.t) : 0.f;
+  for (int i = 0; i < count; i++) values[i] = a.values[i] + (b.values[i] - a.values[i]) * s;
+}
+
+void BenchmarkScript::cameraAt(float t, Vector3& eye, Vector3& center) const
+{
+  float v[6];
+  sample(cameraKeys, t, v, 6);
+  eye.set(v[0], v[1], v[2]);
+  center.set(v[3], v[4], v[5]);
+}
+
+Transform BenchmarkScript::modelAt(float t) const
+{
+  float v[9];
+  sample(modelKeys, t, v, 9);
+  Quaternion rx(Vector3(1.f, 0.f, 0.f), v[3] * DEG2RAD);
+  Quaternion ry(Vector3(0.f, 1.f, 0.f), v[4] * DEG2RAD);
+  Quaternion rz(Vector3(0.f, 0.f, 1.f), v[5] * DEG2RAD);
+  return Transform(Vector3(v[0], v[1], v[2]), rz * ry * rx, Vector3(v[6], v[7], v[8]));
+}
+
+Vector3 BenchmarkScript::lightAt(float t) const
+{
+  float v[3];
+  sample(lightKeys, t, v, 3);
+  return Vector3(v[0], v[1], v[2]);
+}
@@ -0,0 +1,56 @@
+///////////////////////////////////////////////////////////////////////////////
+// BenchmarkScript.h
+// =================
+// Camera, model and light keyframes for the --benchmark mode
+//
+// One command per line, # starts a comment:
+//   frames N          measured frames per model (default 300)
+//   warmup N          frames rendered first and not measured (default 30)
+//   camera t  eye.x eye.y eye.z  center.x center.y center.z
+//   model  t  tx ty tz  rx ry rz  sx sy sz
+//   light  t  x y z
+// t runs from 0 at the first measured frame to 1 at the last, so a script
+// plays the same path whatever its frame count. Values between keyframes
+// are interpolated linearly and hold before the first and after the last.
+// Model rotations are Euler angles in degrees, applied x, then y, then z;
+// they are interpolated as angles, so one segment may turn by more than
+// 180 degrees. A part without keyframes is left as it is.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef BENCHMARK_SCRIPT_H_DEF
+#define BENCHMARK_SCRIPT_H_DEF
+
+#include <vector>
+#include "Vectors.h"
+#include "Transform.h"
+
+class BenchmarkScript
+{
+public:
+  int frames = 300;
+  int warmup = 30;
+
+  // false, after printing the line, on the first line that does not parse
+  bool load(const char* path);
+
+  bool hasCamera() const { return !cameraKeys.empty(); }
+  bool hasModel() const { return !modelKeys.empty(); }
+  bool hasLight() const { return !lightKeys.empty(); }
+  void      cameraAt(float t, Vector3& eye, Vector3& center) const;
+  Transform modelAt(float t) const;
+  Vector3   lightAt(float t) const;
+
+private:
+  // values of one keyframe, as many as the command has
+  struct Key
+  {
+    float t;
+    float values[9];
+  };
+
+  static void sample(const std::vector<Key>& keys, float t, float* values, int count);
+
+  std::vector<Key> cameraKeys, modelKeys, lightKeys;
+};
+
+#endif
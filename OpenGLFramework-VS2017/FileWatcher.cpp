@@ -0,0 +1,107 @@
+///////////////////////////////////////////////////////////////////////////////
+// FileWatcher.cpp
+// ===============
+// Reports edits to a set of files without blocking
+///////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef __linux__
+# include <sys/inotify.h>
+# include <unistd.h>
+#endif
+#include "FileWatcher.h"
+
+const int POLL_INTERVAL_MS = 500;
+
+static time_t modificationTime(const std::string& path)
+{
+  struct stat info;
+  if (stat(path.c_str(), &info) != 0) return 0;
+  return info.st_mtime;
+}
+
+FileWatcher::~FileWatcher()
+{
+#ifdef __linux__
+  if (inotifyFd >= 0) close(inotifyFd);
+#endif
+}
+
+void FileWatcher::watch(const std::string& path)
+{
+  for (auto& file : files) {
+    if (file.path == path) return;
+  }
+  WatchedFile file;
+  file.path = path;
+  size_t slash = path.find_last_of("/\\");
+  file.directory = slash == std::string::npos ? "." : path.substr(0, slash);
+  file.name = slash == std::string::npos ? path : path.substr(slash + 1);
+  file.modified = modificationTime(path);
+  files.push_back(file);
+
+#ifdef __linux__
+  if (isInotifyFailed) return;
+  if (inotifyFd < 0) inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotifyFd < 0) {
+    isInotifyFailed = true;
+    return;
+  }
+  for (auto& directory : directories) {
+    if (directory.second == file.directory) return;
+  }
+  int wd = inotify_add_watch(inotifyFd, file.directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+  if (wd < 0) {
+    isInotifyFailed = true;
+    return;
+  }
+  directories.push_back(std::make_pair(wd, file.directory));
+#endif
+}
+
+std::vector<std::string> FileWatcher::poll()
+{
+#ifdef __linux__
+  if (inotifyFd >= 0 && !isInotifyFailed) {
+    std::vector<std::string> changed;
+    alignas(inotify_event) char buffer[4096];
+    while (true) {
+      ssize_t length = read(inotifyFd, buffer, sizeof(buffer));
+      if (length <= 0) break; // EAGAIN, nothing more queued
+      for (char* p = buffer; p < buffer + length; p += sizeof(inotify_event) + ((inotify_event*)p)->len) {
+        const inotify_event* event = (const inotify_event*)p;
+        if (!event->len) continue;
+        for (auto& directory : directories) {
+          if (directory.first != event->wd) continue;
+          for (auto& file : files) {
+            if (file.directory == directory.second && file.name == event->name &&
+                std::find(changed.begin(), changed.end(), file.path) == changed.end()) {
+              changed.push_back(file.path);
+            }
+          }
+        }
+      }
+    }
+    return changed;
+  }
+#endif
+  return pollTimes();
+}
+
+std::vector<std::string> FileWatcher::pollTimes()
+{
+  std::vector<std::string> changed;
+  auto now = std::chrono::steady_clock::now();
+  if (now - lastPoll < std::chrono::milliseconds(POLL_INTERVAL_MS)) return changed;
+  lastPoll = now;
+  for (auto& file : files) {
+    time_t modified = modificationTime(file.path);
+    if (modified != file.modified) {
+      file.modified = modified;
+      changed.push_back(file.path);
+    }
+  }
+  return changed;
+}
@@ -0,0 +1,47 @@
+///////////////////////////////////////////////////////////////////////////////
+// FileWatcher.h
+// =============
+// Reports edits to a set of files without blocking
+//
+// On Linux the directories of the watched files are registered with
+// inotify, and editors that save by writing a new file and renaming it over
+// the old one are covered by watching for IN_MOVED_TO as well as
+// IN_CLOSE_WRITE. Elsewhere, or when inotify is unavailable, the
+// modification times are compared at most every POLL_INTERVAL_MS.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef FILE_WATCHER_H_DEF
+#define FILE_WATCHER_H_DEF
+
+#include <chrono>
+#include <ctime>
+#include <string>
+#include <vector>
+
+class FileWatcher
+{
+public:
+  ~FileWatcher();
+
+  void watch(const std::string& file);
+  // watched files that changed since the last call, each at most once
+  std::vector<std::string> poll();
+
+private:
+  std::vector<std::string> pollTimes();
+
+  struct WatchedFile
+  {
+    std::string path;
+    std::string directory;
+    std::string name;
+    time_t modified;
+  };
+  std::vector<WatchedFile> files;
+  std::vector<std::pair<int, std::string>> directories; // inotify watch -> directory
+  int inotifyFd = -1;
+  bool isInotifyFailed = false;
+  std::chrono::steady_clock::time_point lastPoll;
+};
+
+#endif
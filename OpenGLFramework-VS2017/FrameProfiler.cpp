@@ -0,0 +1,193 @@
+///////////////////////////////////////////////////////////////////////////////
+// FrameProfiler.cpp
+// =================
+// CPU and GPU time of each phase of a frame
+///////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include "FrameProfiler.h"
+
+// 60 Hz
+const float FRAME_BUDGET_MS = 1000.f / 60.f;
+
+void FrameProfiler::Samples::add(float ms)
+{
+  if ((int)values.size() < HISTORY) {
+    values.push_back(ms);
+    return;
+  }
+  values[next] = ms;
+  next = (next + 1) % HISTORY;
+}
+
+ProfileSummary FrameProfiler::Samples::summary() const
+{
+  ProfileSummary result;
+  result.samples = (int)values.size();
+  if (values.empty()) return result;
+  std::vector<float> sorted(values);
+  std::sort(sorted.begin(), sorted.end());
+  float sum = 0.f;
+  for (float ms : sorted) sum += ms;
+  result.average = sum / sorted.size();
+  // nearest rank
+  auto percentile = [&](float p) { return sorted[std::min((size_t)(p * sorted.size()), sorted.size() - 1)]; };
+  result.p50 = percentile(0.50f);
+  result.p95 = percentile(0.95f);
+  result.p99 = percentile(0.99f);
+  return result;
+}
+
+const char* FrameProfiler::phaseName(ProfilePhase phase)
+{
+  const char* names[ProfilePhaseCount] = { "transforms", "gouraud", "phong", "swap", "poll" };
+  return names[phase];
+}
+
+void FrameProfiler::beginFrame()
+{
+  if (activeQueryPhase >= 0) end((ProfilePhase)activeQueryPhase);
+  auto now = std::chrono::steady_clock::now();
+  if (slots[current].number >= 0) {
+    slots[current].frameMs = std::chrono::duration<float, std::milli>(now - frameBegin).count();
+  }
+  current ^= 1;
+  FrameSlot& slot = slots[current];
+  collect(slot);
+  slot.queryCount = 0;
+  std::fill(slot.cpuMs, slot.cpuMs + ProfilePhaseCount, 0.f);
+  std::fill(slot.isEntered, slot.isEntered + ProfilePhaseCount, false);
+  slot.frameMs = 0.f;
+  slot.number = frameCount++;
+  frameBegin = now;
+}
+
+void FrameProfiler::finish()
+{
+  if (activeQueryPhase >= 0) end((ProfilePhase)activeQueryPhase);
+  if (slots[current].number >= 0) {
+    slots[current].frameMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - frameBegin).count();
+  }
+  // the older frame first
+  collect(slots[current ^ 1]);
+  collect(slots[current]);
+  slots[0].number = slots[1].number = -1;
+  if (csv.is_open()) csv.flush();
+}
+
+void FrameProfiler::begin(ProfilePhase phase)
+{
+  FrameSlot& slot = slots[current];
+  slot.isEntered[phase] = true;
+  phaseBegin[phase] = std::chrono::steady_clock::now();
+  if (activeQueryPhase >= 0) return;
+  if (slot.queryCount == (int)slot.queries.size()) {
+    GLuint query;
+    glGenQueries(1, &query);
+    slot.queries.push_back(query);
+    slot.queryPhases.push_back(0);
+  }
+  slot.queryPhases[slot.queryCount] = phase;
+  glBeginQuery(GL_TIME_ELAPSED, slot.queries[slot.queryCount++]);
+  activeQueryPhase = phase;
+}
+
+void FrameProfiler::end(ProfilePhase phase)
+{
+  if (activeQueryPhase == phase) {
+    glEndQuery(GL_TIME_ELAPSED);
+    activeQueryPhase = -1;
+  }
+  slots[current].cpuMs[phase] += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - phaseBegin[phase]).count();
+}
+
+void FrameProfiler::collect(FrameSlot& slot)
+{
+  if (slot.number < 0) return;
+  float gpuMs[ProfilePhaseCount] = {};
+  for (int i = 0; i < slot.queryCount; i++) {
+    // two frames old, waits only when the GPU is further behind
+    GLuint64 nanoseconds = 0;
+    glGetQueryObjectui64v(slot.queries[i], GL_QUERY_RESULT, &nanoseconds);
+    gpuMs[slot.queryPhases[i]] += nanoseconds / 1e6f;
+  }
+  for (int phase = 0; phase < ProfilePhaseCount; phase++) {
+    if (!slot.isEntered[phase]) continue;
+    history[phase][0].add(slot.cpuMs[phase]);
+    history[phase][1].add(gpuMs[phase]);
+  }
+  frameHistory.add(slot.frameMs);
+  if (csv.is_open()) {
+    char line[64];
+    snprintf(line, sizeof(line), "%lld,%.4f", slot.number, slot.frameMs);
+    csv << line;
+    for (int phase = 0; phase < ProfilePhaseCount; phase++) {
+      snprintf(line, sizeof(line), ",%.4f,%.4f", slot.cpuMs[phase], gpuMs[phase]);
+      csv << line;
+    }
+    csv << "\n";
+  }
+}
+
+bool FrameProfiler::openCsv(const char* path)
+{
+  csv.open(path, std::ios::trunc);
+  if (!csv) {
+    std::cout << "Cannot write " << path << std::endl;
+    return false;
+  }
+  csv << "frame,frame_ms";
+  for (int phase = 0; phase < ProfilePhaseCount; phase++) {
+    csv << "," << phaseName((ProfilePhase)phase) << "_cpu_ms," << phaseName((ProfilePhase)phase) << "_gpu_ms";
+  }
+  csv << "\n";
+  return true;
+}
+
+void FrameProfiler::print() const
+{
+  ProfileSummary f = frame();
+  printf("Profile of the last %d frames, ms: frame avg %.3f, p50 %.3f, p95 %.3f, p99 %.3f\n", f.samples, f.average, f.p50, f.p95, f.p99);
+  printf("phase              CPU avg    p50    p95    p99 |  GPU avg    p50    p95    p99\n");
+  for (int phase = 0; phase < ProfilePhaseCount; phase++) {
+    ProfileSummary c = cpu((ProfilePhase)phase), g = gpu((ProfilePhase)phase);
+    if (c.samples == 0) continue;
+    printf("%-12s %12.3f %6.3f %6.3f %6.3f | %8.3f %6.3f %6.3f %6.3f\n", phaseName((ProfilePhase)phase),
+           c.average, c.p50, c.p95, c.p99, g.average, g.p50, g.p95, g.p99);
+  }
+}
+
+void FrameProfiler::drawOverlay(int width, int height) const
+{
+  const float colors[ProfilePhaseCount][3] = {
+    { 0.9f, 0.9f, 0.3f }, { 0.3f, 0.8f, 0.3f }, { 0.3f, 0.5f, 1.f }, { 0.9f, 0.4f, 0.9f }, { 0.9f, 0.5f, 0.2f }
+  };
+  const int BAR_HEIGHT = 6;
+  const int ROW_HEIGHT = 2 * BAR_HEIGHT + 2;
+  float pixelsPerMs = width / (2.f * FRAME_BUDGET_MS);
+  int top = height - ProfilePhaseCount * ROW_HEIGHT;
+
+  // a clear inside a scissor box is all a solid rectangle needs
+  GLfloat clearColor[4];
+  glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+  glEnable(GL_SCISSOR_TEST);
+  auto rectangle = [](int x, int y, int w, int h, float r, float g, float b) {
+    if (w <= 0) return;
+    glScissor(x, y, w, h);
+    glClearColor(r, g, b, 1.f);
+    glClear(GL_COLOR_BUFFER_BIT);
+  };
+  rectangle(0, top, width, height - top, 0.f, 0.f, 0.f);
+  for (int phase = 0; phase < ProfilePhaseCount; phase++) {
+    ProfileSummary c = cpu((ProfilePhase)phase), g = gpu((ProfilePhase)phase);
+    const float* color = colors[phase];
+    int y = height - (phase + 1) * ROW_HEIGHT;
+    rectangle(0, y + BAR_HEIGHT + 1, (int)(c.average * pixelsPerMs + 0.5f), BAR_HEIGHT, color[0], color[1], color[2]);
+    rectangle(0, y + 1, (int)(g.average * pixelsPerMs + 0.5f), BAR_HEIGHT, color[0] * 0.6f, color[1] * 0.6f, color[2] * 0.6f);
+  }
+  rectangle((int)(FRAME_BUDGET_MS * pixelsPerMs), top, 1, height - top, 1.f, 1.f, 1.f);
+  glDisable(GL_SCISSOR_TEST);
+  glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+}
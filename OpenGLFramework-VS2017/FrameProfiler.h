@@ -0,0 +1,113 @@
+///////////////////////////////////////////////////////////////////////////////
+// FrameProfiler.h
+// ===============
+// CPU and GPU time of each phase of a frame
+//
+// begin() and end() around a phase read the CPU clock and put a
+// GL_TIME_ELAPSED query around the GL commands in between. A phase may be
+// entered several times in a frame, its times add up, but phases must not
+// overlap: only one GL_TIME_ELAPSED query can be active.
+//
+// Queries go into one of two sets, one per frame in turn. beginFrame()
+// reads back the set it is about to reuse, which is two frames old and so
+// normally finished on the GPU, and only then are that frame's times added
+// to the history and the CSV file. Averages and percentiles cover the last
+// HISTORY frames.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef FRAME_PROFILER_H_DEF
+#define FRAME_PROFILER_H_DEF
+
+#include <chrono>
+#include <fstream>
+#include <vector>
+#include <glad/glad.h>
+
+enum ProfilePhase
+{
+  ProfileTransforms = 0, // model transforms, culling and the draw list
+  ProfileGouraud,        // left half
+  ProfilePhong,          // right half, with the depth pre-pass and the deferred resolve
+  ProfileSwap,
+  ProfilePoll,
+  ProfilePhaseCount
+};
+
+struct ProfileSummary
+{
+  float average = 0.f;
+  float p50 = 0.f, p95 = 0.f, p99 = 0.f;
+  int samples = 0;
+};
+
+class FrameProfiler
+{
+public:
+  enum { HISTORY = 240 };
+
+  void beginFrame();                  // before the first phase of every frame
+  void begin(ProfilePhase phase);
+  void end(ProfilePhase phase);
+  void finish();                      // at the end of a run, collects the frames still in flight
+
+  ProfileSummary cpu(ProfilePhase phase) const { return history[phase][0].summary(); }
+  ProfileSummary gpu(ProfilePhase phase) const { return history[phase][1].summary(); }
+  ProfileSummary frame() const { return frameHistory.summary(); } // CPU time from one beginFrame() to the next
+  static const char* phaseName(ProfilePhase phase);
+
+  // one row per frame: frame number, frame time, then CPU and GPU time of
+  // every phase, all in ms
+  bool openCsv(const char* path);
+  void print() const;                 // table of every phase to stdout
+  // bars at the top of the window: per phase, CPU average above, GPU
+  // average below; the full width is two 60 Hz frames, with a tick at one
+  void drawOverlay(int width, int height) const;
+
+private:
+  // the last HISTORY values
+  struct Samples
+  {
+    std::vector<float> values;
+    int next = 0;
+    void add(float ms);
+    ProfileSummary summary() const;
+  };
+
+  // everything recorded in one frame
+  struct FrameSlot
+  {
+    std::vector<GLuint> queries;      // grows to the most queries a frame has used
+    std::vector<int> queryPhases;
+    int queryCount = 0;
+    float cpuMs[ProfilePhaseCount] = {};
+    bool isEntered[ProfilePhaseCount] = {};
+    float frameMs = 0.f;
+    long long number = -1;            // -1 while empty
+  };
+
+  void collect(FrameSlot& slot);
+
+  FrameSlot slots[2];
+  int current = 0;
+  long long frameCount = 0;
+  int activeQueryPhase = -1;
+  std::chrono::steady_clock::time_point frameBegin;
+  std::chrono::steady_clock::time_point phaseBegin[ProfilePhaseCount];
+  Samples history[ProfilePhaseCount][2];  // CPU, GPU
+  Samples frameHistory;
+  std::ofstream csv;
+};
+
+// begin() now, end() at the end of the scope
+class ProfileScope
+{
+public:
+  ProfileScope(FrameProfiler& profiler, ProfilePhase phase) : profiler(profiler), phase(phase) { profiler.begin(phase); }
+  ~ProfileScope() { profiler.end(phase); }
+
+private:
+  FrameProfiler& profiler;
+  ProfilePhase phase;
+};
+
+#endif
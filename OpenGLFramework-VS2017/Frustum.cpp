@@ -0,0 +1,159 @@
+///////////////////////////////////////////////////////////////////////////////
+// Frustum.cpp
+// ===========
+// Bounding volumes and view frustum culling
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cmath>
+#include "Frustum.h"
+#if defined(FRUSTUM_USE_AVX)
+# include <immintrin.h>
+#elif defined(FRUSTUM_USE_SSE)
+# include <xmmintrin.h>
+#endif
+
+void BoundingBox::expand(const Vector3& p)
+{
+  if (p.x < min.x) min.x = p.x;
+  if (p.y < min.y) min.y = p.y;
+  if (p.z < min.z) min.z = p.z;
+  if (p.x > max.x) max.x = p.x;
+  if (p.y > max.y) max.y = p.y;
+  if (p.z > max.z) max.z = p.z;
+}
+
+void computeBounds(const float* positions, int vertexCount, BoundingBox& box, BoundingSphere& sphere)
+{
+  box = BoundingBox();
+  for (int i = 0; i < vertexCount; i++) {
+    box.expand(Vector3(positions[i * 3 + 0], positions[i * 3 + 1], positions[i * 3 + 2]));
+  }
+  // the sphere shares the box center; its radius is the farthest vertex,
+  // which is never larger than the half diagonal of the box
+  sphere.center = box.center();
+  float maxDistanceSquare = 0.f;
+  for (int i = 0; i < vertexCount; i++) {
+    Vector3 d = Vector3(positions[i * 3 + 0], positions[i * 3 + 1], positions[i * 3 + 2]) - sphere.center;
+    float distanceSquare = d.dot(d);
+    if (distanceSquare > maxDistanceSquare) maxDistanceSquare = distanceSquare;
+  }
+  sphere.radius = sqrtf(maxDistanceSquare);
+}
+
+void BoundsBatch::clear()
+{
+  cx.clear(); cy.clear(); cz.clear();
+  ex.clear(); ey.clear(); ez.clear();
+  radius.clear();
+}
+
+void BoundsBatch::add(const BoundingBox& box, const BoundingSphere& sphere)
+{
+  Vector3 c = box.center();
+  Vector3 e = box.extent();
+  cx.push_back(c.x); cy.push_back(c.y); cz.push_back(c.z);
+  ex.push_back(e.x); ey.push_back(e.y); ez.push_back(e.z);
+  radius.push_back(sphere.radius);
+}
+
+void Frustum::setFromMatrix(const Matrix4& clip)
+{
+  Vector4 row0 = clip.getRow(0);
+  Vector4 row1 = clip.getRow(1);
+  Vector4 row2 = clip.getRow(2);
+  Vector4 row3 = clip.getRow(3);
+  planes[0] = row3 + row0; // left
+  planes[1] = row3 - row0; // right
+  planes[2] = row3 + row1; // bottom
+  planes[3] = row3 - row1; // top
+  planes[4] = row3 + row2; // near
+  planes[5] = row3 - row2; // far
+  for (int i = 0; i < 6; i++) {
+    // scale the whole plane so that xyz is unit length and w is a distance
+    float length = sqrtf(planes[i].x * planes[i].x + planes[i].y * planes[i].y + planes[i].z * planes[i].z);
+    if (length > 0.f) planes[i] /= length;
+  }
+}
+
+int Frustum::cull(const BoundsBatch& bounds, unsigned char* visible) const
+{
+  const int count = bounds.size();
+  int visibleCount = 0;
+  int i = 0;
+
+#if defined(FRUSTUM_USE_AVX)
+  for (; i + 8 <= count; i += 8) {
+    __m256 cx = _mm256_loadu_ps(&bounds.cx[i]);
+    __m256 cy = _mm256_loadu_ps(&bounds.cy[i]);
+    __m256 cz = _mm256_loadu_ps(&bounds.cz[i]);
+    __m256 ex = _mm256_loadu_ps(&bounds.ex[i]);
+    __m256 ey = _mm256_loadu_ps(&bounds.ey[i]);
+    __m256 ez = _mm256_loadu_ps(&bounds.ez[i]);
+    __m256 negRadius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(&bounds.radius[i]));
+    __m256 outside = _mm256_setzero_ps();
+    for (int p = 0; p < 6; p++) {
+      const Vector4& plane = planes[p];
+      // signed distance of the center
+      __m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane.x), cx),
+                                             _mm256_mul_ps(_mm256_set1_ps(plane.y), cy)),
+                               _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane.z), cz),
+                                             _mm256_set1_ps(plane.w)));
+      // projected radius of the box onto the plane normal
+      __m256 r = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(fabsf(plane.x)), ex),
+                                             _mm256_mul_ps(_mm256_set1_ps(fabsf(plane.y)), ey)),
+                               _mm256_mul_ps(_mm256_set1_ps(fabsf(plane.z)), ez));
+      outside = _mm256_or_ps(outside, _mm256_cmp_ps(d, negRadius, _CMP_LT_OQ));
+      outside = _mm256_or_ps(outside, _mm256_cmp_ps(_mm256_add_ps(d, r), _mm256_setzero_ps(), _CMP_LT_OQ));
+    }
+    int mask = _mm256_movemask_ps(outside);
+    for (int k = 0; k < 8; k++) {
+      visible[i + k] = (mask >> k) & 1 ? 0 : 1;
+      visibleCount += visible[i + k];
+    }
+  }
+#endif
+
+#if defined(FRUSTUM_USE_SSE) || defined(FRUSTUM_USE_AVX)
+  for (; i + 4 <= count; i += 4) {
+    __m128 cx = _mm_loadu_ps(&bounds.cx[i]);
+    __m128 cy = _mm_loadu_ps(&bounds.cy[i]);
+    __m128 cz = _mm_loadu_ps(&bounds.cz[i]);
+    __m128 ex = _mm_loadu_ps(&bounds.ex[i]);
+    __m128 ey = _mm_loadu_ps(&bounds.ey[i]);
+    __m128 ez = _mm_loadu_ps(&bounds.ez[i]);
+    __m128 negRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&bounds.radius[i]));
+    __m128 outside = _mm_setzero_ps();
+    for (int p = 0; p < 6; p++) {
+      const Vector4& plane = planes[p];
+      __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.x), cx),
+                                       _mm_mul_ps(_mm_set1_ps(plane.y), cy)),
+                            _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.z), cz),
+                                       _mm_set1_ps(plane.w)));
+      __m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(fabsf(plane.x)), ex),
+                                       _mm_mul_ps(_mm_set1_ps(fabsf(plane.y)), ey)),
+                            _mm_mul_ps(_mm_set1_ps(fabsf(plane.z)), ez));
+      outside = _mm_or_ps(outside, _mm_cmplt_ps(d, negRadius));
+      outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(d, r), _mm_setzero_ps()));
+    }
+    int mask = _mm_movemask_ps(outside);
+    for (int k = 0; k < 4; k++) {
+      visible[i + k] = (mask >> k) & 1 ? 0 : 1;
+      visibleCount += visible[i + k];
+    }
+  }
+#endif
+
+  // scalar remainder (and fallback)
+  for (; i < count; i++) {
+    bool outside = false;
+    for (int p = 0; p < 6 && !outside; p++) {
+      const Vector4& plane = planes[p];
+      float d = plane.x * bounds.cx[i] + plane.y * bounds.cy[i] + plane.z * bounds.cz[i] + plane.w;
+      float r = fabsf(plane.x) * bounds.ex[i] + fabsf(plane.y) * bounds.ey[i] + fabsf(plane.z) * bounds.ez[i];
+      outside = d < -bounds.radius[i] || d + r < 0.f;
+    }
+    visible[i] = outside ? 0 : 1;
+    visibleCount += visible[i];
+  }
+  return visibleCount;
+}
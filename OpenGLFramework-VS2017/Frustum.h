@@ -0,0 +1,73 @@
+///////////////////////////////////////////////////////////////////////////////
+// Frustum.h
+// =========
+// Bounding volumes and view frustum culling
+//
+// Planes are extracted from a combined clip matrix (project * view * model),
+// so they live in the same space as the bounds that are tested against them.
+// Bounds are kept in structure-of-arrays form and tested 4 (SSE) or 8 (AVX)
+// at a time.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef FRUSTUM_H_DEF
+#define FRUSTUM_H_DEF
+
+#include <vector>
+#include "Vectors.h"
+#include "Matrices.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+# define FRUSTUM_USE_SSE
+#endif
+#if defined(__AVX__)
+# define FRUSTUM_USE_AVX
+#endif
+
+struct BoundingBox
+{
+  Vector3 min = Vector3( 1e30f,  1e30f,  1e30f);
+  Vector3 max = Vector3(-1e30f, -1e30f, -1e30f);
+
+  void    expand(const Vector3& p);
+  Vector3 center() const { return (min + max) * 0.5f; }
+  Vector3 extent() const { return (max - min) * 0.5f; }
+};
+
+struct BoundingSphere
+{
+  Vector3 center;
+  float radius = 0.f;
+};
+
+// compute the AABB and a bounding sphere (centered at the AABB center) of
+// a tightly packed xyz position array
+void computeBounds(const float* positions, int vertexCount, BoundingBox& box, BoundingSphere& sphere);
+
+// structure-of-arrays copy of many bounding volumes
+struct BoundsBatch
+{
+  std::vector<float> cx, cy, cz;  // box center (== sphere center)
+  std::vector<float> ex, ey, ez;  // box half extent
+  std::vector<float> radius;      // sphere radius
+
+  void clear();
+  void add(const BoundingBox& box, const BoundingSphere& sphere);
+  int  size() const { return (int)cx.size(); }
+};
+
+class Frustum
+{
+public:
+  void setFromMatrix(const Matrix4& clip);      // Gribb/Hartmann plane extraction
+
+  // writes 1 to visible[i] if volume i intersects the frustum, 0 otherwise.
+  // returns the number of visible volumes.
+  int  cull(const BoundsBatch& bounds, unsigned char* visible) const;
+
+  const Vector4& plane(int index) const { return planes[index]; }
+
+private:
+  Vector4 planes[6];  // left, right, bottom, top, near, far; xyz points inside
+};
+
+#endif
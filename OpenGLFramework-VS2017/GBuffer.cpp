@@ -0,0 +1,64 @@
+///////////////////////////////////////////////////////////////////////////////
+// GBuffer.cpp
+// ===========
+// Render targets of the deferred shading path
+///////////////////////////////////////////////////////////////////////////////
+
+#include <iostream>
+#include "GBuffer.h"
+#include "Offscreen.h"
+
+void GBuffer::resize(int w, int h)
+{
+  if (fbo && w == width && h == height) return;
+  if (fbo) {
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteTextures(GBufferTargetCount, textures);
+  }
+  width = w;
+  height = h;
+
+  const GLenum internalFormats[GBufferTargetCount] = { GL_RGBA8, GL_RGBA8, GL_RGBA8, GL_RG16, GL_DEPTH24_STENCIL8 };
+  const GLenum formats[GBufferTargetCount] = { GL_RGBA, GL_RGBA, GL_RGBA, GL_RG, GL_DEPTH_STENCIL };
+  const GLenum types[GBufferTargetCount] = { GL_UNSIGNED_BYTE, GL_UNSIGNED_BYTE, GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT, GL_UNSIGNED_INT_24_8 };
+  glGenFramebuffers(1, &fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  glGenTextures(GBufferTargetCount, textures);
+  for (int i = 0; i < GBufferTargetCount; i++) {
+    glBindTexture(GL_TEXTURE_2D, textures[i]);
+    glTexImage2D(GL_TEXTURE_2D, 0, internalFormats[i], width, height, 0, formats[i], types[i], NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    GLenum attachment = i == GBufferDepth ? GL_DEPTH_STENCIL_ATTACHMENT : GL_COLOR_ATTACHMENT0 + i;
+    glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, textures[i], 0);
+  }
+  const GLenum drawBuffers[GBufferDepth] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3 };
+  glDrawBuffers(GBufferDepth, drawBuffers);
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    std::cout << "G-buffer is incomplete" << std::endl;
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glBindFramebuffer(GL_FRAMEBUFFER, screenFramebuffer());
+}
+
+void GBuffer::bindForWriting()
+{
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+}
+
+void GBuffer::bindTextures(int firstUnit) const
+{
+  for (int i = 0; i < GBufferTargetCount; i++) {
+    glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+    glBindTexture(GL_TEXTURE_2D, textures[i]);
+  }
+  glActiveTexture(GL_TEXTURE0);
+}
+
+void GBuffer::blitDepth(int x, int y, int w, int h) const
+{
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, screenFramebuffer());
+  glBlitFramebuffer(x, y, x + w, y + h, x, y, x + w, y + h, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+  glBindFramebuffer(GL_FRAMEBUFFER, screenFramebuffer());
+}
@@ -0,0 +1,48 @@
+///////////////////////////////////////////////////////////////////////////////
+// GBuffer.h
+// =========
+// Render targets of the deferred shading path
+//
+// Per pixel, 16 bytes of color plus depth:
+//   albedo    RGBA8  diffuse texture times vertex color
+//   diffuse   RGBA8  material Kd, Ka averaged into alpha
+//   specular  RGBA8  material Ks
+//   normal    RG16   octahedral encoded world space normal, in [0, 1]
+//   depth     DEPTH24_STENCIL8, same format as the default framebuffer and
+//             the offscreen target so it can be blitted back for the passes
+//             that follow
+// The targets are as large as the window, so the geometry pass can use the
+// same viewport as the forward path.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef GBUFFER_H_DEF
+#define GBUFFER_H_DEF
+
+#include <glad/glad.h>
+
+enum GBufferTarget
+{
+  GBufferAlbedo = 0,
+  GBufferDiffuse,
+  GBufferSpecular,
+  GBufferNormal,
+  GBufferDepth,
+  GBufferTargetCount
+};
+
+class GBuffer
+{
+public:
+  void resize(int width, int height);   // (re)allocate when the size changes
+  void bindForWriting();                // draw into every color target
+  void bindTextures(int firstUnit) const;
+  // copy the depth of a window rectangle into screenFramebuffer()
+  void blitDepth(int x, int y, int width, int height) const;
+
+private:
+  GLuint fbo = 0;
+  GLuint textures[GBufferTargetCount] = { 0, 0, 0, 0, 0 };
+  int width = 0, height = 0;
+};
+
+#endif
@@ -0,0 +1,97 @@
+///////////////////////////////////////////////////////////////////////////////
+// HeadlessContext.cpp
+// ===================
+// OpenGL context without a window or display server, through EGL
+///////////////////////////////////////////////////////////////////////////////
+
+#include "HeadlessContext.h"
+
+#if defined(CG_HAS_EGL)
+
+#include <cstring>
+#include <iostream>
+#include <EGL/eglext.h>
+
+// whole word match in a space separated extension string
+static bool hasExtension(const char* extensions, const char* name)
+{
+  if (extensions == NULL) return false;
+  size_t length = strlen(name);
+  for (const char* p = strstr(extensions, name); p != NULL; p = strstr(p + length, name)) {
+    bool isStart = p == extensions || p[-1] == ' ';
+    bool isEnd = p[length] == ' ' || p[length] == '\0';
+    if (isStart && isEnd) return true;
+  }
+  return false;
+}
+
+bool HeadlessContext::create(int major, int minor)
+{
+  const char* clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+  PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+    (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+  if (getPlatformDisplay != NULL && hasExtension(clientExtensions, "EGL_MESA_platform_surfaceless")) {
+    display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+  }
+  if (display == EGL_NO_DISPLAY) display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+  EGLint eglMajor, eglMinor;
+  if (display == EGL_NO_DISPLAY || !eglInitialize(display, &eglMajor, &eglMinor)) {
+    std::cout << "Failed to initialize EGL" << std::endl;
+    display = EGL_NO_DISPLAY;
+    return false;
+  }
+  const char* displayExtensions = eglQueryString(display, EGL_EXTENSIONS);
+  if (!hasExtension(displayExtensions, "EGL_KHR_surfaceless_context")) {
+    std::cout << "EGL_KHR_surfaceless_context is not supported" << std::endl;
+    destroy();
+    return false;
+  }
+  if (!eglBindAPI(EGL_OPENGL_API)) {
+    std::cout << "EGL cannot bind desktop OpenGL" << std::endl;
+    destroy();
+    return false;
+  }
+
+  // no surface is ever created, so any config that renders desktop OpenGL
+  // does; without EGL_KHR_no_config_context one still has to be picked
+  EGLConfig config = (EGLConfig)0;
+  if (!hasExtension(displayExtensions, "EGL_KHR_no_config_context")) {
+    const EGLint configAttributes[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+    EGLint configCount = 0;
+    if (!eglChooseConfig(display, configAttributes, &config, 1, &configCount) || configCount == 0) {
+      std::cout << "No EGL config renders OpenGL" << std::endl;
+      destroy();
+      return false;
+    }
+  }
+  const EGLint contextAttributes[] = {
+    EGL_CONTEXT_MAJOR_VERSION, major,
+    EGL_CONTEXT_MINOR_VERSION, minor,
+    EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+    EGL_NONE
+  };
+  context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttributes);
+  if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+    std::cout << "Failed to create an OpenGL " << major << "." << minor << " core context through EGL" << std::endl;
+    destroy();
+    return false;
+  }
+  return true;
+}
+
+void HeadlessContext::destroy()
+{
+  if (display == EGL_NO_DISPLAY) return;
+  eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  if (context != EGL_NO_CONTEXT) eglDestroyContext(display, context);
+  eglTerminate(display);
+  context = EGL_NO_CONTEXT;
+  display = EGL_NO_DISPLAY;
+}
+
+void* HeadlessContext::getProcAddress(const char* name)
+{
+  return (void*)eglGetProcAddress(name);
+}
+
+#endif
@@ -0,0 +1,42 @@
+///////////////////////////////////////////////////////////////////////////////
+// HeadlessContext.h
+// =================
+// OpenGL context without a window or display server, through EGL
+//
+// The display comes from Mesa's surfaceless platform when the driver offers
+// it (EGL_MESA_platform_surfaceless) and from EGL_DEFAULT_DISPLAY otherwise.
+// The context is made current with no surface at all
+// (EGL_KHR_surfaceless_context), so every frame has to go to a framebuffer
+// object, see OffscreenTarget. Mesa's llvmpipe runs it on the CPU.
+//
+// Only built where EGL is found (CG_HAS_EGL); the Windows project renders
+// through GLFW windows only.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef HEADLESS_CONTEXT_H_DEF
+#define HEADLESS_CONTEXT_H_DEF
+
+#if defined(CG_HAS_EGL)
+
+#include <EGL/egl.h>
+
+class HeadlessContext
+{
+public:
+  ~HeadlessContext() { destroy(); }
+
+  // core profile context of the given version, current on this thread
+  bool create(int major, int minor);
+  void destroy();
+
+  // for gladLoadGLLoader()
+  static void* getProcAddress(const char* name);
+
+private:
+  EGLDisplay display = EGL_NO_DISPLAY;
+  EGLContext context = EGL_NO_CONTEXT;
+};
+
+#endif
+
+#endif
@@ -0,0 +1,205 @@
+///////////////////////////////////////////////////////////////////////////////
+// LightClusters.cpp
+// =================
+// Clustered forward lighting
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cmath>
+#include "LightClusters.h"
+#if defined(CLUSTER_USE_AVX)
+# include <immintrin.h>
+#elif defined(CLUSTER_USE_SSE)
+# include <xmmintrin.h>
+#endif
+
+// where the first depth slice ends, at most
+const float CLUSTER_NEAR_SPLIT = 0.05f;
+
+void LightClusters::setProjection(float xs, float ys, float nearClip, float farClip)
+{
+  if (boxesValid && xs == xScale && ys == yScale && nearClip == zNear && farClip == zFar) return;
+  xScale = xs;
+  yScale = ys;
+  zNear = nearClip;
+  zFar = farClip;
+  zSplit = zNear > CLUSTER_NEAR_SPLIT ? zNear : CLUSTER_NEAR_SPLIT;
+  zScale = CLUSTER_Z / logf(zFar / zSplit);
+  zBias = -logf(zSplit) * zScale;
+  initBoxes();
+}
+
+void LightClusters::initBoxes()
+{
+  minX.resize(CLUSTER_COUNT); minY.resize(CLUSTER_COUNT); minZ.resize(CLUSTER_COUNT);
+  maxX.resize(CLUSTER_COUNT); maxY.resize(CLUSTER_COUNT); maxZ.resize(CLUSTER_COUNT);
+  for (int k = 0; k < CLUSTER_Z; k++) {
+    float dn = k == 0 ? zNear : zSplit * powf(zFar / zSplit, (float)k / CLUSTER_Z);
+    float df = k == CLUSTER_Z - 1 ? zFar : zSplit * powf(zFar / zSplit, (float)(k + 1) / CLUSTER_Z);
+    for (int j = 0; j < CLUSTER_Y; j++) {
+      float y0 = -1.f + 2.f * j / CLUSTER_Y;
+      float y1 = -1.f + 2.f * (j + 1) / CLUSTER_Y;
+      for (int i = 0; i < CLUSTER_X; i++) {
+        float x0 = -1.f + 2.f * i / CLUSTER_X;
+        float x1 = -1.f + 2.f * (i + 1) / CLUSTER_X;
+        // the tile's edges at both ends of the slice, view space looks down -z
+        float xs[4] = { x0 * dn / xScale, x1 * dn / xScale, x0 * df / xScale, x1 * df / xScale };
+        float ys[4] = { y0 * dn / yScale, y1 * dn / yScale, y0 * df / yScale, y1 * df / yScale };
+        int c = (k * CLUSTER_Y + j) * CLUSTER_X + i;
+        minX[c] = maxX[c] = xs[0];
+        minY[c] = maxY[c] = ys[0];
+        for (int n = 1; n < 4; n++) {
+          if (xs[n] < minX[c]) minX[c] = xs[n];
+          if (xs[n] > maxX[c]) maxX[c] = xs[n];
+          if (ys[n] < minY[c]) minY[c] = ys[n];
+          if (ys[n] > maxY[c]) maxY[c] = ys[n];
+        }
+        minZ[c] = -df;
+        maxZ[c] = -dn;
+      }
+    }
+  }
+  boxesValid = true;
+}
+
+int LightClusters::slice(float depth) const
+{
+  if (depth <= zSplit) return 0;
+  int k = (int)(logf(depth) * zScale + zBias);
+  return k < CLUSTER_Z ? k : CLUSTER_Z - 1;
+}
+
+void LightClusters::appendSlice(int k, float x, float y, float z, float radius, unsigned short light)
+{
+  const int first = k * CLUSTER_X * CLUSTER_Y;
+  const int last = first + CLUSTER_X * CLUSTER_Y;
+  const float radiusSquare = radius * radius;
+  int c = first;
+
+  // squared distance from the sphere center to the box, 0 inside
+#if defined(CLUSTER_USE_AVX)
+  {
+    __m256 px = _mm256_set1_ps(x), py = _mm256_set1_ps(y), pz = _mm256_set1_ps(z);
+    __m256 r2 = _mm256_set1_ps(radiusSquare);
+    __m256 zero = _mm256_setzero_ps();
+    for (; c + 8 <= last; c += 8) {
+      __m256 dx = _mm256_max_ps(_mm256_max_ps(_mm256_sub_ps(_mm256_loadu_ps(&minX[c]), px), _mm256_sub_ps(px, _mm256_loadu_ps(&maxX[c]))), zero);
+      __m256 dy = _mm256_max_ps(_mm256_max_ps(_mm256_sub_ps(_mm256_loadu_ps(&minY[c]), py), _mm256_sub_ps(py, _mm256_loadu_ps(&maxY[c]))), zero);
+      __m256 dz = _mm256_max_ps(_mm256_max_ps(_mm256_sub_ps(_mm256_loadu_ps(&minZ[c]), pz), _mm256_sub_ps(pz, _mm256_loadu_ps(&maxZ[c]))), zero);
+      __m256 d2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+      int mask = _mm256_movemask_ps(_mm256_cmp_ps(d2, r2, _CMP_LE_OQ));
+      for (int b = 0; b < 8; b++) {
+        if (!((mask >> b) & 1)) continue;
+        int n = c + b;
+        if (counts[n] < MAX_LIGHTS_PER_CLUSTER) slots[n * MAX_LIGHTS_PER_CLUSTER + counts[n]++] = light;
+        else dropped++;
+      }
+    }
+  }
+#endif
+
+#if defined(CLUSTER_USE_SSE) || defined(CLUSTER_USE_AVX)
+  {
+    __m128 px = _mm_set1_ps(x), py = _mm_set1_ps(y), pz = _mm_set1_ps(z);
+    __m128 r2 = _mm_set1_ps(radiusSquare);
+    __m128 zero = _mm_setzero_ps();
+    for (; c + 4 <= last; c += 4) {
+      __m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minX[c]), px), _mm_sub_ps(px, _mm_loadu_ps(&maxX[c]))), zero);
+      __m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minY[c]), py), _mm_sub_ps(py, _mm_loadu_ps(&maxY[c]))), zero);
+      __m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minZ[c]), pz), _mm_sub_ps(pz, _mm_loadu_ps(&maxZ[c]))), zero);
+      __m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+      int mask = _mm_movemask_ps(_mm_cmple_ps(d2, r2));
+      for (int b = 0; b < 4; b++) {
+        if (!((mask >> b) & 1)) continue;
+        int n = c + b;
+        if (counts[n] < MAX_LIGHTS_PER_CLUSTER) slots[n * MAX_LIGHTS_PER_CLUSTER + counts[n]++] = light;
+        else dropped++;
+      }
+    }
+  }
+#endif
+
+  // scalar remainder (and fallback)
+  for (; c < last; c++) {
+    float dx = fmaxf(fmaxf(minX[c] - x, x - maxX[c]), 0.f);
+    float dy = fmaxf(fmaxf(minY[c] - y, y - maxY[c]), 0.f);
+    float dz = fmaxf(fmaxf(minZ[c] - z, z - maxZ[c]), 0.f);
+    if (dx * dx + dy * dy + dz * dz > radiusSquare) continue;
+    if (counts[c] < MAX_LIGHTS_PER_CLUSTER) slots[c * MAX_LIGHTS_PER_CLUSTER + counts[c]++] = light;
+    else dropped++;
+  }
+}
+
+void LightClusters::build(const std::vector<ClusterLight>& lights, const Matrix4& view)
+{
+  if (!boxesValid) initBoxes();
+  counts.assign(CLUSTER_COUNT, 0);
+  slots.resize((size_t)CLUSTER_COUNT * MAX_LIGHTS_PER_CLUSTER);
+  dropped = 0;
+
+  int lightCount = (int)lights.size() < MAX_CLUSTER_LIGHTS ? (int)lights.size() : MAX_CLUSTER_LIGHTS;
+  lightData.resize((size_t)lightCount * 12);
+  for (int l = 0; l < lightCount; l++) {
+    const ClusterLight& light = lights[l];
+    float* texel = &lightData[(size_t)l * 12];
+    texel[0] = light.position.x;  texel[1] = light.position.y;  texel[2] = light.position.z;  texel[3] = light.range;
+    texel[4] = light.color.x;     texel[5] = light.color.y;     texel[6] = light.color.z;     texel[7] = (float)light.mode;
+    texel[8] = light.direction.x; texel[9] = light.direction.y; texel[10] = light.direction.z; texel[11] = light.cosineCutOff;
+
+    // spot lights are bounded by the sphere of their range as well
+    Vector4 p = view * Vector4(light.position.x, light.position.y, light.position.z, 1.f);
+    float depth = -p.z;
+    if (depth + light.range < zNear || depth - light.range > zFar) continue;
+    int k0 = slice(depth - light.range);
+    int k1 = slice(depth + light.range);
+    for (int k = k0; k <= k1; k++) {
+      appendSlice(k, p.x, p.y, p.z, light.range, (unsigned short)l);
+    }
+  }
+
+  // compact the fixed size slots into one list
+  grid.resize((size_t)CLUSTER_COUNT * 2);
+  indices.clear();
+  for (int c = 0; c < CLUSTER_COUNT; c++) {
+    int count = counts[c];
+    if ((int)indices.size() + count > maxTexels) {
+      dropped += (int)indices.size() + count - maxTexels;
+      count = maxTexels - (int)indices.size();
+    }
+    grid[c * 2 + 0] = (GLuint)indices.size();
+    grid[c * 2 + 1] = count;
+    indices.insert(indices.end(), &slots[(size_t)c * MAX_LIGHTS_PER_CLUSTER], &slots[(size_t)c * MAX_LIGHTS_PER_CLUSTER] + count);
+  }
+  if (indices.empty()) indices.push_back(0); // keep the buffer non-empty
+  if (lightData.empty()) lightData.resize(12, 0.f);
+}
+
+void LightClusters::upload()
+{
+  if (!buffers[0]) {
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+    glGenBuffers(3, buffers);
+    glGenTextures(3, textures);
+  }
+  const GLenum formats[3] = { GL_RGBA32F, GL_RG32UI, GL_R16UI };
+  const void* data[3] = { lightData.data(), grid.data(), indices.data() };
+  const size_t sizes[3] = { lightData.size() * sizeof(float), grid.size() * sizeof(GLuint), indices.size() * sizeof(unsigned short) };
+  for (int i = 0; i < 3; i++) {
+    glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+    // orphan last frame's storage instead of waiting for it
+    glBufferData(GL_TEXTURE_BUFFER, sizes[i], NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, sizes[i], data[i]);
+    glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+    glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+  }
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+void LightClusters::bind(int firstUnit) const
+{
+  for (int i = 0; i < 3; i++) {
+    glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+    glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+  }
+  glActiveTexture(GL_TEXTURE0);
+}
@@ -0,0 +1,92 @@
+///////////////////////////////////////////////////////////////////////////////
+// LightClusters.h
+// ===============
+// Clustered forward lighting
+//
+// The view frustum is split into a CLUSTER_X x CLUSTER_Y x CLUSTER_Z grid:
+// screen tiles in x and y, exponential depth slices in z. Every frame each
+// light's bounding sphere is tested against the view space boxes of the
+// clusters in its depth slices, 4 (SSE) or 8 (AVX) boxes at a time, and the
+// overlapping light indices are appended to the cluster's list.
+//
+// The result is uploaded to three buffer textures:
+//   lights   RGBA32F, 3 texels per light: (position, range),
+//            (color, mode), (direction, cosine cut-off), world space
+//   grid     RG32UI, per cluster: (first index, light count)
+//   indices  R16UI, the concatenated per cluster light lists
+// so the fragment shader only loops over the lights of its own cluster.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef LIGHT_CLUSTERS_H_DEF
+#define LIGHT_CLUSTERS_H_DEF
+
+#include <vector>
+#include <glad/glad.h>
+#include "Vectors.h"
+#include "Matrices.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+# define CLUSTER_USE_SSE
+#endif
+#if defined(__AVX__)
+# define CLUSTER_USE_AVX
+#endif
+
+const int CLUSTER_X = 16;
+const int CLUSTER_Y = 16;
+const int CLUSTER_Z = 24;
+const int CLUSTER_COUNT = CLUSTER_X * CLUSTER_Y * CLUSTER_Z;
+const int MAX_LIGHTS_PER_CLUSTER = 128;
+const int MAX_CLUSTER_LIGHTS = 65535; // indices are 16 bit
+
+struct ClusterLight
+{
+  Vector3 position;       // world space
+  float range;            // no contribution beyond this distance
+  Vector3 color;
+  int mode;               // 1 point, 2 spot, as LightMode
+  Vector3 direction;      // spot only, normalized
+  float cosineCutOff;     // spot only
+};
+
+class LightClusters
+{
+public:
+  // xScale and yScale are project[0] and project[5]; the first slice ends
+  // at a fixed distance so a tiny near plane does not waste the others
+  void setProjection(float xScale, float yScale, float nearClip, float farClip);
+  void build(const std::vector<ClusterLight>& lights, const Matrix4& view);
+  void upload();
+  // binds lights, grid and indices to firstUnit, firstUnit + 1, firstUnit + 2
+  void bind(int firstUnit) const;
+
+  // shader side slice = log(depth) * sliceScale + sliceBias
+  float sliceScale() const { return zScale; }
+  float sliceBias() const  { return zBias; }
+  int indexCount() const   { return (int)indices.size(); }
+  int overflow() const     { return dropped; } // light references that did not fit
+
+private:
+  void initBoxes();
+  int  slice(float depth) const;
+  void appendSlice(int k, float x, float y, float z, float radius, unsigned short light);
+
+  float xScale = 1.f, yScale = 1.f, zNear = 0.1f, zFar = 100.f, zSplit = 0.1f;
+  float zScale = 1.f, zBias = 0.f;
+  bool boxesValid = false;
+  // view space cluster boxes, structure of arrays
+  std::vector<float> minX, minY, minZ, maxX, maxY, maxZ;
+
+  std::vector<unsigned short> counts;
+  std::vector<unsigned short> slots;   // MAX_LIGHTS_PER_CLUSTER per cluster
+  std::vector<GLuint> grid;
+  std::vector<unsigned short> indices;
+  std::vector<float> lightData;
+  int dropped = 0;
+  GLint maxTexels = 65536; // guaranteed texture buffer size until queried
+
+  GLuint buffers[3] = { 0, 0, 0 };
+  GLuint textures[3] = { 0, 0, 0 };
+};
+
+#endif
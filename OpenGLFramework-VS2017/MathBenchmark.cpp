@@ -0,0 +1,389 @@
+///////////////////////////////////////////////////////////////////////////////
+// MathBenchmark.cpp
+// =================
+// Micro-benchmarks of the math library: Matrix4 products, inverses and
+// transposes, the camera matrices built as setViewingMatrix() and
+// setPerspective() do, Transform, Quaternion, the BatchMath kernels and the
+// normalize tiers, the last also with their largest error.
+//
+// Every operation is reported in ns/op for the compiled path (see
+// mathSimdPath() in Matrices.h and batchMathPath() in BatchMath.h). Build
+// once as is and once with MATH_NO_SIMD or MATRIX4_ROW_MAJOR defined to
+// compare. With --json the results are written as one JSON object instead
+// of a table, so runs of two builds can be diffed or fed to a script.
+//
+//   MathBenchmark [--json] [--seed N] [--seconds S]
+//
+// The inputs are random and read through an index the compiler cannot see
+// through, and every result is stored whole to memory read after the timing,
+// so no operation can be hoisted out of the timing loop or trimmed.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include "Matrices.h"
+#include "BatchMath.h"
+#include "Transform.h"
+
+const int INPUT_COUNT = 1024;          // power of two, fits in L1/L2 with the results
+const int BATCH_COUNT = 4096;          // elements per BatchMath call
+
+double g_minSeconds = 0.2;             // per operation
+
+struct Inputs
+{
+  std::vector<Matrix4> matrices;       // general, well conditioned
+  std::vector<Matrix4> euclidean;      // rotation and translation
+  std::vector<Matrix4> affine;         // rotation, non-uniform scale and translation
+  std::vector<Matrix4> projective;     // perspective * euclidean
+  std::vector<Vector4> vectors;
+  std::vector<Vector3> points;         // in [-4, 4]^3, lookAt eyes and centers
+  std::vector<Vector4> lenses;         // fovy degree, aspect, near, far
+  std::vector<Quaternion> quaternions; // unit length
+  std::vector<Transform> transforms;
+  std::vector<Matrix4> matrixResults;
+  std::vector<Vector4> vectorResults;
+};
+
+struct Result
+{
+  std::string group;
+  std::string name;
+  double nanoseconds;                  // per operation, or per element for batches
+  double error;                        // largest error against double precision, < 0 if not measured
+};
+
+static std::vector<Result> g_results;
+static volatile float g_sink;
+
+static Inputs makeInputs(unsigned int seed)
+{
+  std::mt19937 random(seed);
+  std::uniform_real_distribution<float> value(-1.f, 1.f);
+  std::uniform_real_distribution<float> unit(0.f, 1.f);
+  Inputs inputs;
+  inputs.matrices.resize(INPUT_COUNT);
+  inputs.euclidean.resize(INPUT_COUNT);
+  inputs.affine.resize(INPUT_COUNT);
+  inputs.projective.resize(INPUT_COUNT);
+  inputs.vectors.resize(INPUT_COUNT);
+  inputs.points.resize(INPUT_COUNT);
+  inputs.lenses.resize(INPUT_COUNT);
+  inputs.quaternions.resize(INPUT_COUNT);
+  inputs.transforms.resize(INPUT_COUNT);
+  inputs.matrixResults.resize(INPUT_COUNT);
+  inputs.vectorResults.resize(INPUT_COUNT);
+  for (int i = 0; i < INPUT_COUNT; i++) {
+    Matrix4& m = inputs.matrices[i];
+    for (int j = 0; j < 16; j++) m[j] = value(random);
+    m[0] += 4.f; m[5] += 4.f; m[10] += 4.f; m[15] += 4.f; // diagonally dominant, never singular
+    inputs.vectors[i] = Vector4(value(random), value(random), value(random), value(random));
+    inputs.points[i] = Vector3(value(random), value(random), value(random)) * 4.f;
+    inputs.quaternions[i] = Quaternion(value(random), value(random), value(random), value(random) + 2.f).normalize();
+    Vector3 translation(value(random), value(random), value(random));
+    Vector3 scale(0.5f + unit(random), 0.5f + unit(random), 0.5f + unit(random));
+    inputs.transforms[i] = Transform(translation, inputs.quaternions[i], scale);
+    inputs.euclidean[i] = Transform(translation, inputs.quaternions[i], Vector3(1.f, 1.f, 1.f)).matrix();
+    inputs.affine[i] = inputs.transforms[i].matrix();
+    inputs.lenses[i] = Vector4(30.f + 70.f * unit(random), 0.5f + 1.5f * unit(random),
+                               0.01f + unit(random), 10.f + 990.f * unit(random));
+    inputs.projective[i] = perspectiveMatrix(inputs.lenses[i].x, inputs.lenses[i].y, inputs.lenses[i].z, inputs.lenses[i].w) *
+                           inputs.euclidean[i];
+  }
+  return inputs;
+}
+
+// run op(i) with i cycling through the inputs until g_minSeconds have
+// passed; op stores its result to the i-th result slot
+template <class Op>
+static double nanosecondsPerOp(Inputs& in, const Op& op)
+{
+  typedef std::chrono::steady_clock Clock;
+  long long count = 0;
+  int batch = INPUT_COUNT;
+  Clock::time_point start = Clock::now();
+  double seconds = 0.;
+  while (seconds < g_minSeconds) {
+    for (int i = 0; i < batch; i++) op(i & (INPUT_COUNT - 1));
+    count += batch;
+    seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    if (batch < (1 << 20)) batch *= 2;
+  }
+  float checksum = 0.f;
+  for (int i = 0; i < INPUT_COUNT; i++) checksum += in.matrixResults[i][i & 15] + in.vectorResults[i].x;
+  g_sink = checksum;
+  return seconds * 1e9 / count;
+}
+
+// run op() over BATCH_COUNT elements until g_minSeconds have passed; op
+// writes its results to out. Returns ns per element.
+template <class Op>
+static double nanosecondsPerElement(const Vector3Batch& out, const Op& op)
+{
+  typedef std::chrono::steady_clock Clock;
+  long long count = 0;
+  Clock::time_point start = Clock::now();
+  double seconds = 0.;
+  while (seconds < g_minSeconds) {
+    for (int i = 0; i < 16; i++) op();
+    count += 16 * BATCH_COUNT;
+    seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  }
+  float checksum = 0.f;
+  for (int i = 0; i < out.size(); i++) checksum += out.x[i] + out.y[i] + out.z[i];
+  g_sink = checksum;
+  return seconds * 1e9 / count;
+}
+
+static void record(const char* group, const char* name, double nanoseconds, double error = -1.)
+{
+  Result result;
+  result.group = group;
+  result.name = name;
+  result.nanoseconds = nanoseconds;
+  result.error = error;
+  g_results.push_back(result);
+}
+
+// largest component error of normalized against the vectors of source
+// normalized in double precision
+static double normalizeError(const Vector3Batch& source, const Vector3Batch& normalized)
+{
+  double error = 0.;
+  for (int i = 0; i < source.size(); i++) {
+    double x = source.x[i], y = source.y[i], z = source.z[i];
+    double length = sqrt(x * x + y * y + z * z);
+    if (length == 0.) continue;
+    error = std::max(error, fabs(normalized.x[i] - x / length));
+    error = std::max(error, fabs(normalized.y[i] - y / length));
+    error = std::max(error, fabs(normalized.z[i] - z / length));
+  }
+  return error;
+}
+
+// speed of a normalize tier, then its error on one fresh pass
+template <class Op>
+static void recordNormalize(const char* name, const Vector3Batch& source, Vector3Batch& out, const Op& op)
+{
+  out = source;
+  double nanoseconds = nanosecondsPerElement(out, op); // repeated passes keep normalizing unit vectors
+  out = source;
+  op();
+  record("normalize", name, nanoseconds, normalizeError(source, out));
+}
+
+static void benchmarkMatrix4(Inputs& in)
+{
+  const int MASK = INPUT_COUNT - 1;
+  record("Matrix4", "Matrix4 * Matrix4", nanosecondsPerOp(in, [&](int i) {
+    in.matrixResults[i] = in.matrices[i] * in.matrices[(i + 1) & MASK];
+  }));
+  record("Matrix4", "multiplyAffine", nanosecondsPerOp(in, [&](int i) {
+    in.matrixResults[i] = in.affine[i].multiplyAffine(in.affine[(i + 1) & MASK]);
+  }));
+  record("Matrix4", "Matrix4 * Vector4", nanosecondsPerOp(in, [&](int i) {
+    in.vectorResults[i] = in.matrices[i] * in.vectors[i];
+  }));
+  record("Matrix4", "Matrix4 * Vector3", nanosecondsPerOp(in, [&](int i) {
+    Vector3 v = in.matrices[i] * in.points[i];
+    in.vectorResults[i] = Vector4(v.x, v.y, v.z, 0.f);
+  }));
+  record("Matrix4", "getTranspose", nanosecondsPerOp(in, [&](int i) {
+    in.matrixResults[i].set(in.matrices[i].getTranspose());
+  }));
+  record("Matrix4", "transpose", nanosecondsPerOp(in, [&](int i) {
+    in.matrixResults[i] = in.matrices[i];
+    in.matrixResults[i].transpose();
+  }));
+  record("Matrix4", "getDeterminant", nanosecondsPerOp(in, [&](int i) {
+    in.vectorResults[i].x = in.matrices[i].getDeterminant();
+  }));
+  // invert() picks a variant from the last row, so it is timed on both kinds
+  record("Matrix4", "invert (general input)", nanosecondsPerOp(in, [&](int i) {
+    in.matrixResults[i] = in.matrices[i];
+    in.matrixResults[i].invert();
+  }));
+  record("Matrix4", "invert (affine input)", nanosecondsPerOp(in, [&](int i) {
+    in.matrixResults[i] = in.affine[i];
+    in.matrixResults[i].invert();
+  }));
+  record("Matrix4", "invertGeneral", nanosecondsPerOp(in, [&](int i) {
+    in.matrixResults[i] = in.matrices[i];
+    in.matrixResults[i].invertGeneral();
+  }));
+  record("Matrix4", "invertProjective", nanosecondsPerOp(in, [&](int i) {
+    in.matrixResults[i] = in.projective[i];
+    in.matrixResults[i].invertProjective();
+  }));
+  record("Matrix4", "invertAffine", nanosecondsPerOp(in, [&](int i) {
+    in.matrixResults[i] = in.affine[i];
+    in.matrixResults[i].invertAffine();
+  }));
+  record("Matrix4", "invertEuclidean", nanosecondsPerOp(in, [&](int i) {
+    in.matrixResults[i] = in.euclidean[i];
+    in.matrixResults[i].invertEuclidean();
+  }));
+}
+
+static void benchmarkTransform(Inputs& in)
+{
+  const int MASK = INPUT_COUNT - 1;
+  record("camera", "lookAtMatrix", nanosecondsPerOp(in, [&](int i) {
+    in.matrixResults[i] = lookAtMatrix(in.points[i], in.points[(i + 1) & MASK], Vector3(0.f, 1.f, 0.f));
+  }));
+  record("camera", "perspectiveMatrix", nanosecondsPerOp(in, [&](int i) {
+    const Vector4& lens = in.lenses[i];
+    in.matrixResults[i] = perspectiveMatrix(lens.x, lens.y, lens.z, lens.w);
+  }));
+  record("Transform", "Transform::matrix", nanosecondsPerOp(in, [&](int i) {
+    in.matrixResults[i] = in.transforms[i].matrix();
+  }));
+  record("Transform", "Transform::inverseMatrix", nanosecondsPerOp(in, [&](int i) {
+    in.matrixResults[i] = in.transforms[i].inverseMatrix();
+  }));
+  record("Transform", "Transform::normalMatrix", nanosecondsPerOp(in, [&](int i) {
+    in.matrixResults[i] = in.transforms[i].normalMatrix();
+  }));
+  record("Quaternion", "Quaternion * Quaternion", nanosecondsPerOp(in, [&](int i) {
+    Quaternion q = in.quaternions[i] * in.quaternions[(i + 1) & MASK];
+    in.vectorResults[i] = Vector4(q.x, q.y, q.z, q.w);
+  }));
+  record("Quaternion", "toMatrix4", nanosecondsPerOp(in, [&](int i) {
+    in.matrixResults[i] = toMatrix4(in.quaternions[i]);
+  }));
+  record("Quaternion", "nlerp", nanosecondsPerOp(in, [&](int i) {
+    Quaternion q = nlerp(in.quaternions[i], in.quaternions[(i + 1) & MASK], 0.3f);
+    in.vectorResults[i] = Vector4(q.x, q.y, q.z, q.w);
+  }));
+  record("Quaternion", "slerp", nanosecondsPerOp(in, [&](int i) {
+    Quaternion q = slerp(in.quaternions[i], in.quaternions[(i + 1) & MASK], 0.3f);
+    in.vectorResults[i] = Vector4(q.x, q.y, q.z, q.w);
+  }));
+}
+
+static void benchmarkBatches(const Inputs& in, unsigned int seed)
+{
+  std::mt19937 random(seed + 1);
+  std::uniform_real_distribution<float> value(-1.f, 1.f);
+  std::vector<Vector3> points(BATCH_COUNT);
+  Vector3Batch a, b, out, extents;
+  a.resize(BATCH_COUNT); b.resize(BATCH_COUNT); out.resize(BATCH_COUNT); extents.resize(BATCH_COUNT);
+  for (int i = 0; i < BATCH_COUNT; i++) {
+    points[i] = Vector3(value(random), value(random), value(random));
+    a.set(i, points[i]);
+    b.set(i, Vector3(value(random), value(random), value(random)));
+  }
+  const Matrix4& m = in.affine[0];
+
+  record("BatchMath", "Matrix4 * Vector3 loop", nanosecondsPerElement(out, [&]() {
+    for (int i = 0; i < BATCH_COUNT; i++) {
+      Vector4 r = m * Vector4(points[i].x, points[i].y, points[i].z, 1.f);
+      out.set(i, Vector3(r.x, r.y, r.z));
+    }
+  }));
+  record("BatchMath", "transformPoints", nanosecondsPerElement(out, [&]() {
+    transformPoints(m, a.x.data(), a.y.data(), a.z.data(), BATCH_COUNT, out.x.data(), out.y.data(), out.z.data());
+  }));
+  record("BatchMath", "transformDirections", nanosecondsPerElement(out, [&]() {
+    transformDirections(m, a.x.data(), a.y.data(), a.z.data(), BATCH_COUNT, out.x.data(), out.y.data(), out.z.data());
+  }));
+  record("BatchMath", "transformBoxes", nanosecondsPerElement(extents, [&]() {
+    transformBoxes(m, a.x.data(), a.y.data(), a.z.data(), b.x.data(), b.y.data(), b.z.data(), BATCH_COUNT,
+                   out.x.data(), out.y.data(), out.z.data(), extents.x.data(), extents.y.data(), extents.z.data());
+  }));
+  record("BatchMath", "dotVectors", nanosecondsPerElement(out, [&]() {
+    dotVectors(a.x.data(), a.y.data(), a.z.data(), b.x.data(), b.y.data(), b.z.data(), BATCH_COUNT, out.x.data());
+  }));
+  record("BatchMath", "crossVectors", nanosecondsPerElement(out, [&]() {
+    crossVectors(a.x.data(), a.y.data(), a.z.data(), b.x.data(), b.y.data(), b.z.data(), BATCH_COUNT,
+                 out.x.data(), out.y.data(), out.z.data());
+  }));
+
+  recordNormalize("Vector3::normalize", a, out, [&]() {
+    for (int i = 0; i < BATCH_COUNT; i++) out.set(i, out.get(i).normalize());
+  });
+  recordNormalize("Vector3::normalizeFast", a, out, [&]() {
+    for (int i = 0; i < BATCH_COUNT; i++) out.set(i, out.get(i).normalizeFast());
+  });
+  recordNormalize("normalizeVectors", a, out, [&]() {
+    normalizeVectors(out.x.data(), out.y.data(), out.z.data(), BATCH_COUNT);
+  });
+  recordNormalize("normalizeVectorsFast", a, out, [&]() {
+    normalizeVectorsFast(out.x.data(), out.y.data(), out.z.data(), BATCH_COUNT);
+  });
+}
+
+static const char* matrix4Layout()
+{
+#if defined(MATRIX4_COLUMN_MAJOR)
+  return "column major";
+#else
+  return "row major";
+#endif
+}
+
+static void printTable(unsigned int seed)
+{
+  printf("Matrix4 kernels: %s, %s; BatchMath: %s; seed %u\n", mathSimdPath(), matrix4Layout(), batchMathPath(), seed);
+  std::string group;
+  for (const Result& result : g_results) {
+    if (result.group != group) {
+      group = result.group;
+      printf("\n%s\n", group.c_str());
+    }
+    printf("  %-28s %9.2f ns/op %10.1f M/s", result.name.c_str(), result.nanoseconds, 1e3 / result.nanoseconds);
+    if (result.error >= 0.) printf("   max error %.2e", result.error);
+    printf("\n");
+  }
+}
+
+static void printJson(unsigned int seed)
+{
+  printf("{\n");
+  printf("  \"simd\": \"%s\",\n", mathSimdPath());
+  printf("  \"batch\": \"%s\",\n", batchMathPath());
+  printf("  \"matrix4_layout\": \"%s\",\n", matrix4Layout());
+  printf("  \"seed\": %u,\n", seed);
+  printf("  \"min_seconds\": %g,\n", g_minSeconds);
+  printf("  \"results\": [\n");
+  for (size_t i = 0; i < g_results.size(); i++) {
+    const Result& result = g_results[i];
+    printf("    {\"group\": \"%s\", \"name\": \"%s\", \"ns_per_op\": %.4f",
+           result.group.c_str(), result.name.c_str(), result.nanoseconds);
+    if (result.error >= 0.) printf(", \"max_error\": %.3e", result.error);
+    printf("}%s\n", i + 1 < g_results.size() ? "," : "");
+  }
+  printf("  ]\n");
+  printf("}\n");
+}
+
+int main(int argc, char** argv)
+{
+  bool isJson = false;
+  unsigned int seed = 20240531;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--json") == 0) isJson = true;
+    else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) seed = (unsigned int)strtoul(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) g_minSeconds = atof(argv[++i]);
+    else {
+      fprintf(stderr, "usage: %s [--json] [--seed N] [--seconds S]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  Inputs in = makeInputs(seed);
+  benchmarkMatrix4(in);
+  benchmarkTransform(in);
+  benchmarkBatches(in, seed);
+
+  if (isJson) printJson(seed);
+  else printTable(seed);
+  return 0;
+}
@@ -3,11 +3,13 @@
 // ===========
 // NxN Matrix Math classes
 //
-// All matrices are row major. (OpenGL uses column-major matrix)
-// | 0 1 |    | 0 1 2 |    |  0  1  2  3 |
-// | 2 3 |    | 3 4 5 |    |  4  5  6  7 |
-//            | 6 7 8 |    |  8  9 10 11 |
-//                         | 12 13 14 15 |
+// Matrix2 and Matrix3 are row major. Matrix4 is column major like OpenGL,
+// unless MATRIX4_ROW_MAJOR is defined. Its functions name elements by row
+// and column (M03 is row 0, column 3) so they work with either storage order.
+// | 0 1 |    | 0 1 2 |    |  0  4  8 12 |
+// | 2 3 |    | 3 4 5 |    |  1  5  9 13 |
+//            | 6 7 8 |    |  2  6 10 14 |
+//                         |  3  7 11 15 |
 //
 //  AUTHOR: Song Ho Ahn (song.ahn@gmail.com)
 // CREATED: 2005-06-24
@@ -118,12 +120,18 @@ Matrix3& Matrix3::invert()
 ///////////////////////////////////////////////////////////////////////////////
 Matrix4& Matrix4::transpose()
 {
+#if defined(MATH_USE_SSE)
+    __m128 r0 = _mm_loadu_ps(&m[0]), r1 = _mm_loadu_ps(&m[4]), r2 = _mm_loadu_ps(&m[8]), r3 = _mm_loadu_ps(&m[12]);
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+    _mm_storeu_ps(&m[0], r0);  _mm_storeu_ps(&m[4], r1);  _mm_storeu_ps(&m[8], r2);  _mm_storeu_ps(&m[12], r3);
+#else
     std::swap(m[1],  m[4]);
     std::swap(m[2],  m[8]);
     std::swap(m[3],  m[12]);
     std::swap(m[6],  m[9]);
     std::swap(m[7],  m[13]);
     std::swap(m[11], m[14]);
+#endif
 
     return *this;
 }
@@ -137,13 +145,13 @@ Matrix4& Matrix4::invert()
 {
     // If the 4th row is [0,0,0,1] then it is affine matrix and
     // it has no projective transformation.
-    if(m[12] == 0 && m[13] == 0 && m[14] == 0 && m[15] == 1)
+    if(m[M30] == 0 && m[M31] == 0 && m[M32] == 0 && m[M33] == 1)
         this->invertAffine();
     else
     {
         this->invertGeneral();
         /*@@ invertProjective() is not optimized (slower than generic one)
-        if(fabs(m[0]*m[5] - m[1]*m[4]) > 0.00001f)
+        if(fabs(m[M00]*m[M11] - m[M01]*m[M10]) > 0.00001f)
             this->invertProjective();   // inverse using matrix partition
         else
             this->invertGeneral();      // generalized inverse
@@ -183,20 +191,20 @@ Matrix4& Matrix4::invertEuclidean()
     // | ----+-- |
     // |  0  | 1 |
     float tmp;
-    tmp = m[1];  m[1] = m[4];  m[4] = tmp;
-    tmp = m[2];  m[2] = m[8];  m[8] = tmp;
-    tmp = m[6];  m[6] = m[9];  m[9] = tmp;
+    tmp = m[M01];  m[M01] = m[M10];  m[M10] = tmp;
+    tmp = m[M02];  m[M02] = m[M20];  m[M20] = tmp;
+    tmp = m[M12];  m[M12] = m[M21];  m[M21] = tmp;
 
     // compute translation part -R^T * T
     // | 0 | -R^T x |
     // | --+------- |
     // | 0 |   0    |
-    float x = m[3];
-    float y = m[7];
-    float z = m[11];
-    m[3]  = -(m[0] * x + m[1] * y + m[2] * z);
-    m[7]  = -(m[4] * x + m[5] * y + m[6] * z);
-    m[11] = -(m[8] * x + m[9] * y + m[10]* z);
+    float x = m[M03];
+    float y = m[M13];
+    float z = m[M23];
+    m[M03] = -(m[M00] * x + m[M01] * y + m[M02] * z);
+    m[M13] = -(m[M10] * x + m[M11] * y + m[M12] * z);
+    m[M23] = -(m[M20] * x + m[M21] * y + m[M22] * z);
 
     // last row should be unchanged (0,0,0,1)
 
@@ -224,23 +232,23 @@ Matrix4& Matrix4::invertEuclidean()
 Matrix4& Matrix4::invertAffine()
 {
     // R^-1
-    Matrix3 r(m[0],m[1],m[2], m[4],m[5],m[6], m[8],m[9],m[10]);
+    Matrix3 r(m[M00],m[M01],m[M02], m[M10],m[M11],m[M12], m[M20],m[M21],m[M22]);
     r.invert();
-    m[0] = r[0];  m[1] = r[1];  m[2] = r[2];
-    m[4] = r[3];  m[5] = r[4];  m[6] = r[5];
-    m[8] = r[6];  m[9] = r[7];  m[10]= r[8];
+    m[M00] = r[0];  m[M01] = r[1];  m[M02] = r[2];
+    m[M10] = r[3];  m[M11] = r[4];  m[M12] = r[5];
+    m[M20] = r[6];  m[M21] = r[7];  m[M22] = r[8];
 
     // -R^-1 * T
-    float x = m[3];
-    float y = m[7];
-    float z = m[11];
-    m[3]  = -(r[0] * x + r[1] * y + r[2] * z);
-    m[7]  = -(r[3] * x + r[4] * y + r[5] * z);
-    m[11] = -(r[6] * x + r[7] * y + r[8] * z);
+    float x = m[M03];
+    float y = m[M13];
+    float z = m[M23];
+    m[M03] = -(r[0] * x + r[1] * y + r[2] * z);
+    m[M13] = -(r[3] * x + r[4] * y + r[5] * z);
+    m[M23] = -(r[6] * x + r[7] * y + r[8] * z);
 
     // last row should be unchanged (0,0,0,1)
-    //m[12] = m[13] = m[14] = 0.0f;
-    //m[15] = 1.0f;
+    //m[M30] = m[M31] = m[M32] = 0.0f;
+    //m[M33] = 1.0f;
 
     return * this;
 }
@@ -319,6 +327,90 @@ Matrix4& Matrix4::invertProjective()
 // If cannot find inverse, return indentity matrix
 // M^-1 = adj(M) / det(M)
 ///////////////////////////////////////////////////////////////////////////////
+#if defined(MATH_USE_SSE)
+// the SIMD version partitions M into 2x2 blocks, each held in one register
+// as (m00, m01, m10, m11), and builds the blocks of adj(M) from 2x2
+// adjugates and products:
+// M = | A B |   adj(M) = | |D|A - B(D#C)     |B|C - D(A#B)# |#
+//     | C D |            | |C|B - A(D#C)#    |A|D - C(A#B)  |
+// where X# is the 2x2 adjugate and
+// |M| = |A||D| + |B||C| - tr((A#B)(D#C))
+
+#define MATH_SHUFFLE(a, b, x, y, z, w)  _mm_shuffle_ps(a, b, _MM_SHUFFLE(w, z, y, x))
+#define MATH_SWIZZLE(a, x, y, z, w)     MATH_SHUFFLE(a, a, x, y, z, w)
+
+// A * B
+static inline __m128 mat2Mul(__m128 a, __m128 b)
+{
+    return _mm_add_ps(_mm_mul_ps(a, MATH_SWIZZLE(b, 0,3,0,3)),
+                      _mm_mul_ps(MATH_SWIZZLE(a, 1,0,3,2), MATH_SWIZZLE(b, 2,1,2,1)));
+}
+
+// A# * B
+static inline __m128 mat2AdjMul(__m128 a, __m128 b)
+{
+    return _mm_sub_ps(_mm_mul_ps(MATH_SWIZZLE(a, 3,3,0,0), b),
+                      _mm_mul_ps(MATH_SWIZZLE(a, 1,1,2,2), MATH_SWIZZLE(b, 2,3,0,1)));
+}
+
+// A * B#
+static inline __m128 mat2MulAdj(__m128 a, __m128 b)
+{
+    return _mm_sub_ps(_mm_mul_ps(a, MATH_SWIZZLE(b, 3,0,3,0)),
+                      _mm_mul_ps(MATH_SWIZZLE(a, 1,0,3,2), MATH_SWIZZLE(b, 2,1,2,1)));
+}
+
+Matrix4& Matrix4::invertGeneral()
+{
+    __m128 r0 = _mm_loadu_ps(&m[0]), r1 = _mm_loadu_ps(&m[4]), r2 = _mm_loadu_ps(&m[8]), r3 = _mm_loadu_ps(&m[12]);
+    __m128 a = _mm_movelh_ps(r0, r1);
+    __m128 b = _mm_movehl_ps(r1, r0);
+    __m128 c = _mm_movelh_ps(r2, r3);
+    __m128 d = _mm_movehl_ps(r3, r2);
+
+    // (|A|, |B|, |C|, |D|)
+    __m128 detSub = _mm_sub_ps(_mm_mul_ps(MATH_SHUFFLE(r0, r2, 0,2,0,2), MATH_SHUFFLE(r1, r3, 1,3,1,3)),
+                               _mm_mul_ps(MATH_SHUFFLE(r0, r2, 1,3,1,3), MATH_SHUFFLE(r1, r3, 0,2,0,2)));
+    __m128 detA = MATH_SWIZZLE(detSub, 0,0,0,0);
+    __m128 detB = MATH_SWIZZLE(detSub, 1,1,1,1);
+    __m128 detC = MATH_SWIZZLE(detSub, 2,2,2,2);
+    __m128 detD = MATH_SWIZZLE(detSub, 3,3,3,3);
+
+    __m128 dc = mat2AdjMul(d, c);
+    __m128 ab = mat2AdjMul(a, b);
+    __m128 x = _mm_sub_ps(_mm_mul_ps(detD, a), mat2Mul(b, dc));
+    __m128 w = _mm_sub_ps(_mm_mul_ps(detA, d), mat2Mul(c, ab));
+    __m128 y = _mm_sub_ps(_mm_mul_ps(detB, c), mat2MulAdj(d, ab));
+    __m128 z = _mm_sub_ps(_mm_mul_ps(detC, b), mat2MulAdj(a, dc));
+
+    __m128 trace = _mm_mul_ps(ab, MATH_SWIZZLE(dc, 0,2,1,3));
+    trace = _mm_add_ps(trace, MATH_SWIZZLE(trace, 2,3,0,1));
+    trace = _mm_add_ps(trace, MATH_SWIZZLE(trace, 1,0,3,2));
+    __m128 determinant = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(detA, detD), _mm_mul_ps(detB, detC)), trace);
+    if(fabs(_mm_cvtss_f32(determinant)) <= 0.00001f)
+    {
+        return identity();
+    }
+
+    // 1/|M| with the signs of the 2x2 adjugate
+    __m128 invDeterminant = _mm_div_ps(_mm_setr_ps(1.0f, -1.0f, -1.0f, 1.0f), determinant);
+    x = _mm_mul_ps(x, invDeterminant);
+    y = _mm_mul_ps(y, invDeterminant);
+    z = _mm_mul_ps(z, invDeterminant);
+    w = _mm_mul_ps(w, invDeterminant);
+
+    // the adjugate swizzle of each block folded into the stores
+    _mm_storeu_ps(&m[0],  MATH_SHUFFLE(x, y, 3,1,3,1));
+    _mm_storeu_ps(&m[4],  MATH_SHUFFLE(x, y, 2,0,2,0));
+    _mm_storeu_ps(&m[8],  MATH_SHUFFLE(z, w, 3,1,3,1));
+    _mm_storeu_ps(&m[12], MATH_SHUFFLE(z, w, 2,0,2,0));
+
+    return *this;
+}
+
+#undef MATH_SWIZZLE
+#undef MATH_SHUFFLE
+#else
 Matrix4& Matrix4::invertGeneral()
 {
     // get cofactors of minor matrices
@@ -375,6 +467,7 @@ Matrix4& Matrix4::invertGeneral()
 
     return *this;
 }
+#endif
 
 
 
@@ -417,9 +510,9 @@ Matrix4& Matrix4::translate(const Vector3& v)
 
 Matrix4& Matrix4::translate(float x, float y, float z)
 {
-    m[0] += m[12]*x;   m[1] += m[13]*x;   m[2] += m[14]*x;   m[3] += m[15]*x;
-    m[4] += m[12]*y;   m[5] += m[13]*y;   m[6] += m[14]*y;   m[7] += m[15]*y;
-    m[8] += m[12]*z;   m[9] += m[13]*z;   m[10]+= m[14]*z;   m[11]+= m[15]*z;
+    m[M00] += m[M30]*x;   m[M01] += m[M31]*x;   m[M02] += m[M32]*x;   m[M03] += m[M33]*x;
+    m[M10] += m[M30]*y;   m[M11] += m[M31]*y;   m[M12] += m[M32]*y;   m[M13] += m[M33]*y;
+    m[M20] += m[M30]*z;   m[M21] += m[M31]*z;   m[M22] += m[M32]*z;   m[M23] += m[M33]*z;
     return *this;
 }
 
@@ -435,9 +528,9 @@ Matrix4& Matrix4::scale(float s)
 
 Matrix4& Matrix4::scale(float x, float y, float z)
 {
-    m[0] = m[0]*x;   m[1] = m[1]*x;   m[2] = m[2]*x;   m[3] = m[3]*x;
-    m[4] = m[4]*y;   m[5] = m[5]*y;   m[6] = m[6]*y;   m[7] = m[7]*y;
-    m[8] = m[8]*z;   m[9] = m[9]*z;   m[10]= m[10]*z;  m[11]= m[11]*z;
+    m[M00] = m[M00]*x;   m[M01] = m[M01]*x;   m[M02] = m[M02]*x;   m[M03] = m[M03]*x;
+    m[M10] = m[M10]*y;   m[M11] = m[M11]*y;   m[M12] = m[M12]*y;   m[M13] = m[M13]*y;
+    m[M20] = m[M20]*z;   m[M21] = m[M21]*z;   m[M22] = m[M22]*z;   m[M23] = m[M23]*z;
     return *this;
 }
 
@@ -465,22 +558,22 @@ Matrix4& Matrix4::rotate(float angle, float x, float y, float z)
 
     // build rotation matrix
     Matrix4 m;
-    m[0] = xx * (1 - c) + c;
-    m[1] = xy * (1 - c) - z * s;
-    m[2] = xz * (1 - c) + y * s;
-    m[3] = 0;
-    m[4] = xy * (1 - c) + z * s;
-    m[5] = yy * (1 - c) + c;
-    m[6] = yz * (1 - c) - x * s;
-    m[7] = 0;
-    m[8] = xz * (1 - c) - y * s;
-    m[9] = yz * (1 - c) + x * s;
-    m[10]= zz * (1 - c) + c;
-    m[11]= 0;
-    m[12]= 0;
-    m[13]= 0;
-    m[14]= 0;
-    m[15]= 1;
+    m[M00] = xx * (1 - c) + c;
+    m[M01] = xy * (1 - c) - z * s;
+    m[M02] = xz * (1 - c) + y * s;
+    m[M03] = 0;
+    m[M10] = xy * (1 - c) + z * s;
+    m[M11] = yy * (1 - c) + c;
+    m[M12] = yz * (1 - c) - x * s;
+    m[M13] = 0;
+    m[M20] = xz * (1 - c) - y * s;
+    m[M21] = yz * (1 - c) + x * s;
+    m[M22] = zz * (1 - c) + c;
+    m[M23] = 0;
+    m[M30] = 0;
+    m[M31] = 0;
+    m[M32] = 0;
+    m[M33] = 1;
 
     // multiply it
     *this = m * (*this);
@@ -492,17 +585,17 @@ Matrix4& Matrix4::rotateX(float angle)
 {
     float c = cosf(angle * DEG2RAD);
     float s = sinf(angle * DEG2RAD);
-    float m4 = m[4], m5 = m[5], m6 = m[6],  m7 = m[7],
-          m8 = m[8], m9 = m[9], m10= m[10], m11= m[11];
-
-    m[4] = m4 * c + m8 *-s;
-    m[5] = m5 * c + m9 *-s;
-    m[6] = m6 * c + m10*-s;
-    m[7] = m7 * c + m11*-s;
-    m[8] = m4 * s + m8 * c;
-    m[9] = m5 * s + m9 * c;
-    m[10]= m6 * s + m10* c;
-    m[11]= m7 * s + m11* c;
+    float m4 = m[M10], m5 = m[M11], m6 = m[M12],  m7 = m[M13],
+          m8 = m[M20], m9 = m[M21], m10= m[M22], m11= m[M23];
+
+    m[M10] = m4 * c + m8 *-s;
+    m[M11] = m5 * c + m9 *-s;
+    m[M12] = m6 * c + m10*-s;
+    m[M13] = m7 * c + m11*-s;
+    m[M20] = m4 * s + m8 * c;
+    m[M21] = m5 * s + m9 * c;
+    m[M22] = m6 * s + m10* c;
+    m[M23] = m7 * s + m11* c;
 
     return *this;
 }
@@ -511,17 +604,17 @@ Matrix4& Matrix4::rotateY(float angle)
 {
     float c = cosf(angle * DEG2RAD);
     float s = sinf(angle * DEG2RAD);
-    float m0 = m[0], m1 = m[1], m2 = m[2],  m3 = m[3],
-          m8 = m[8], m9 = m[9], m10= m[10], m11= m[11];
-
-    m[0] = m0 * c + m8 * s;
-    m[1] = m1 * c + m9 * s;
-    m[2] = m2 * c + m10* s;
-    m[3] = m3 * c + m11* s;
-    m[8] = m0 *-s + m8 * c;
-    m[9] = m1 *-s + m9 * c;
-    m[10]= m2 *-s + m10* c;
-    m[11]= m3 *-s + m11* c;
+    float m0 = m[M00], m1 = m[M01], m2 = m[M02],  m3 = m[M03],
+          m8 = m[M20], m9 = m[M21], m10= m[M22], m11= m[M23];
+
+    m[M00] = m0 * c + m8 * s;
+    m[M01] = m1 * c + m9 * s;
+    m[M02] = m2 * c + m10* s;
+    m[M03] = m3 * c + m11* s;
+    m[M20] = m0 *-s + m8 * c;
+    m[M21] = m1 *-s + m9 * c;
+    m[M22] = m2 *-s + m10* c;
+    m[M23] = m3 *-s + m11* c;
 
     return *this;
 }
@@ -530,17 +623,17 @@ Matrix4& Matrix4::rotateZ(float angle)
 {
     float c = cosf(angle * DEG2RAD);
     float s = sinf(angle * DEG2RAD);
-    float m0 = m[0], m1 = m[1], m2 = m[2],  m3 = m[3],
-          m4 = m[4], m5 = m[5], m6 = m[6],  m7 = m[7];
-
-    m[0] = m0 * c + m4 *-s;
-    m[1] = m1 * c + m5 *-s;
-    m[2] = m2 * c + m6 *-s;
-    m[3] = m3 * c + m7 *-s;
-    m[4] = m0 * s + m4 * c;
-    m[5] = m1 * s + m5 * c;
-    m[6] = m2 * s + m6 * c;
-    m[7] = m3 * s + m7 * c;
+    float m0 = m[M00], m1 = m[M01], m2 = m[M02],  m3 = m[M03],
+          m4 = m[M10], m5 = m[M11], m6 = m[M12],  m7 = m[M13];
+
+    m[M00] = m0 * c + m4 *-s;
+    m[M01] = m1 * c + m5 *-s;
+    m[M02] = m2 * c + m6 *-s;
+    m[M03] = m3 * c + m7 *-s;
+    m[M10] = m0 * s + m4 * c;
+    m[M11] = m1 * s + m5 * c;
+    m[M12] = m2 * s + m6 * c;
+    m[M13] = m3 * s + m7 * c;
 
     return *this;
 }
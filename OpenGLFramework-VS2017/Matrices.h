@@ -3,11 +3,12 @@
 // =========
 // NxN Matrix Math classes
 //
-// All matrices are row major. (OpenGL uses column-major matrix)
-// | 0 1 |    | 0 1 2 |    |  0  1  2  3 |
-// | 2 3 |    | 3 4 5 |    |  4  5  6  7 |
-//            | 6 7 8 |    |  8  9 10 11 |
-//                         | 12 13 14 15 |
+// Matrix2 and Matrix3 are row major. Matrix4 is column major like OpenGL,
+// unless MATRIX4_ROW_MAJOR is defined; see below.
+// | 0 1 |    | 0 1 2 |    |  0  4  8 12 |
+// | 2 3 |    | 3 4 5 |    |  1  5  9 13 |
+//            | 6 7 8 |    |  2  6 10 14 |
+//                         |  3  7 11 15 |
 //
 //  AUTHOR: Song Ho Ahn (song.ahn@gmail.com)
 // CREATED: 2005-06-24
@@ -21,6 +22,28 @@
 
 #include "Vectors.h"
 
+// Matrix4 storage order. Column major by default, so a matrix goes to
+// glUniformMatrix4fv or a mapped buffer as is; MATRIX4_ROW_MAJOR stores rows
+// contiguously instead. The layout only shows through operator[], get() and
+// set(const float[16]); the 16 value constructor and set() take elements in
+// row order, and rows, columns and all operators mean the same either way.
+// Every translation unit must see the same choice.
+#if !defined(MATRIX4_ROW_MAJOR)
+#define MATRIX4_COLUMN_MAJOR
+#endif
+
+// name of the compiled Matrix4 kernels, for benchmark reports
+inline const char* mathSimdPath()
+{
+#if defined(MATH_USE_AVX)
+    return "AVX";
+#elif defined(MATH_USE_SSE)
+    return "SSE";
+#else
+    return "scalar";
+#endif
+}
+
 ///////////////////////////////////////////////////////////////////////////
 // 2x2 matrix
 ///////////////////////////////////////////////////////////////////////////
@@ -154,8 +177,10 @@ public:
     void        setColumn(int index, const float col[4]);
     void        setColumn(int index, const Vector4& v);
     void        setColumn(int index, const Vector3& v);
+    Vector4     getRow(int index) const;
+    Vector4     getColumn(int index) const;
 
-    const float* get() const;
+    const float* get() const;                           // in storage order
     const float* getTranspose();                        // return transposed matrix
     float        getDeterminant();
 
@@ -187,10 +212,11 @@ public:
     Vector3     operator*(const Vector3& rhs) const;    // multiplication: v' = M * v
     Matrix4     operator*(const Matrix4& rhs) const;    // multiplication: M3 = M1 * M2
     Matrix4&    operator*=(const Matrix4& rhs);         // multiplication: M1' = M1 * M2
+    Matrix4     multiplyAffine(const Matrix4& rhs) const; // M1 * M2 when both last rows are (0,0,0,1)
     bool        operator==(const Matrix4& rhs) const;   // exact compare, no epsilon
     bool        operator!=(const Matrix4& rhs) const;   // exact compare, no epsilon
-    float       operator[](int index) const;            // subscript operator v[0], v[1]
-    float&      operator[](int index);                  // subscript operator v[0], v[1]
+    float       operator[](int index) const;            // subscript operator v[0], v[1], in storage order
+    float&      operator[](int index);                  // subscript operator v[0], v[1], in storage order
 
     friend Matrix4 operator-(const Matrix4& m);                     // unary operator (-)
     friend Matrix4 operator*(float scalar, const Matrix4& m);       // pre-multiplication
@@ -205,8 +231,34 @@ private:
                             float m3, float m4, float m5,
                             float m6, float m7, float m8);
 
-    float m[16];
-    float tm[16];                                       // transpose m
+    struct Uninitialized {};
+    explicit Matrix4(Uninitialized) {}                  // for results that overwrite all elements
+
+    // storage index of the element in row R, column C
+    enum
+    {
+#if defined(MATRIX4_COLUMN_MAJOR)
+        M00 = 0,  M01 = 4,  M02 = 8,  M03 = 12,
+        M10 = 1,  M11 = 5,  M12 = 9,  M13 = 13,
+        M20 = 2,  M21 = 6,  M22 = 10, M23 = 14,
+        M30 = 3,  M31 = 7,  M32 = 11, M33 = 15
+#else
+        M00 = 0,  M01 = 1,  M02 = 2,  M03 = 3,
+        M10 = 4,  M11 = 5,  M12 = 6,  M13 = 7,
+        M20 = 8,  M21 = 9,  M22 = 10, M23 = 11,
+        M30 = 12, M31 = 13, M32 = 14, M33 = 15
+#endif
+    };
+    static int  index(int row, int col);
+
+    // kernels on 16 floats read as row major 4x4 matrices; the layout
+    // dependent operators pick the one that matches the storage order
+    static void    multiply(const float a[16], const float b[16], float r[16]); // r = a * b
+    static Vector4 dotRows(const float a[16], const Vector4& v);   // (row i . v)
+    static Vector4 sumRows(const float a[16], const Vector4& v);   // sum of v[i] * row i
+
+    alignas(16) float m[16];                            // 16-byte rows for the SIMD kernels
+    alignas(16) float tm[16];                           // transpose m
 
 };
 
@@ -671,52 +723,77 @@ inline void Matrix4::set(float xx, float xy, float xz, float xw,
                          float zx, float zy, float zz, float zw,
                          float wx, float wy, float wz, float ww)
 {
-    m[0] = xx;  m[1] = xy;  m[2] = xz;  m[3] = xw;
-    m[4] = yx;  m[5] = yy;  m[6] = yz;  m[7] = yw;
-    m[8] = zx;  m[9] = zy;  m[10]= zz;  m[11]= zw;
-    m[12]= wx;  m[13]= wy;  m[14]= wz;  m[15]= ww;
+    m[M00] = xx;  m[M01] = xy;  m[M02] = xz;  m[M03] = xw;
+    m[M10] = yx;  m[M11] = yy;  m[M12] = yz;  m[M13] = yw;
+    m[M20] = zx;  m[M21] = zy;  m[M22] = zz;  m[M23] = zw;
+    m[M30] = wx;  m[M31] = wy;  m[M32] = wz;  m[M33] = ww;
 }
 
 
 
 inline void Matrix4::setRow(int index, const float row[4])
 {
-    m[index*4] = row[0];  m[index*4 + 1] = row[1];  m[index*4 + 2] = row[2];  m[index*4 + 3] = row[3];
+    m[Matrix4::index(index, 0)] = row[0];  m[Matrix4::index(index, 1)] = row[1];  m[Matrix4::index(index, 2)] = row[2];  m[Matrix4::index(index, 3)] = row[3];
 }
 
 
 
 inline void Matrix4::setRow(int index, const Vector4& v)
 {
-    m[index*4] = v.x;  m[index*4 + 1] = v.y;  m[index*4 + 2] = v.z;  m[index*4 + 3] = v.w;
+    m[Matrix4::index(index, 0)] = v.x;  m[Matrix4::index(index, 1)] = v.y;  m[Matrix4::index(index, 2)] = v.z;  m[Matrix4::index(index, 3)] = v.w;
 }
 
 
 
 inline void Matrix4::setRow(int index, const Vector3& v)
 {
-    m[index*4] = v.x;  m[index*4 + 1] = v.y;  m[index*4 + 2] = v.z;
+    m[Matrix4::index(index, 0)] = v.x;  m[Matrix4::index(index, 1)] = v.y;  m[Matrix4::index(index, 2)] = v.z;
 }
 
 
 
 inline void Matrix4::setColumn(int index, const float col[4])
 {
-    m[index] = col[0];  m[index + 4] = col[1];  m[index + 8] = col[2];  m[index + 12] = col[3];
+    m[Matrix4::index(0, index)] = col[0];  m[Matrix4::index(1, index)] = col[1];  m[Matrix4::index(2, index)] = col[2];  m[Matrix4::index(3, index)] = col[3];
 }
 
 
 
 inline void Matrix4::setColumn(int index, const Vector4& v)
 {
-    m[index] = v.x;  m[index + 4] = v.y;  m[index + 8] = v.z;  m[index + 12] = v.w;
+    m[Matrix4::index(0, index)] = v.x;  m[Matrix4::index(1, index)] = v.y;  m[Matrix4::index(2, index)] = v.z;  m[Matrix4::index(3, index)] = v.w;
 }
 
 
 
 inline void Matrix4::setColumn(int index, const Vector3& v)
 {
-    m[index] = v.x;  m[index + 4] = v.y;  m[index + 8] = v.z;
+    m[Matrix4::index(0, index)] = v.x;  m[Matrix4::index(1, index)] = v.y;  m[Matrix4::index(2, index)] = v.z;
+}
+
+
+
+inline Vector4 Matrix4::getRow(int index) const
+{
+    return Vector4(m[Matrix4::index(index, 0)], m[Matrix4::index(index, 1)], m[Matrix4::index(index, 2)], m[Matrix4::index(index, 3)]);
+}
+
+
+
+inline Vector4 Matrix4::getColumn(int index) const
+{
+    return Vector4(m[Matrix4::index(0, index)], m[Matrix4::index(1, index)], m[Matrix4::index(2, index)], m[Matrix4::index(3, index)]);
+}
+
+
+
+inline int Matrix4::index(int row, int col)
+{
+#if defined(MATRIX4_COLUMN_MAJOR)
+    return col * 4 + row;
+#else
+    return row * 4 + col;
+#endif
 }
 
 
@@ -730,10 +807,16 @@ inline const float* Matrix4::get() const
 
 inline const float* Matrix4::getTranspose()
 {
+#if defined(MATH_USE_SSE)
+    __m128 r0 = _mm_loadu_ps(&m[0]), r1 = _mm_loadu_ps(&m[4]), r2 = _mm_loadu_ps(&m[8]), r3 = _mm_loadu_ps(&m[12]);
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+    _mm_storeu_ps(&tm[0], r0);  _mm_storeu_ps(&tm[4], r1);  _mm_storeu_ps(&tm[8], r2);  _mm_storeu_ps(&tm[12], r3);
+#else
     tm[0] = m[0];   tm[1] = m[4];   tm[2] = m[8];   tm[3] = m[12];
     tm[4] = m[1];   tm[5] = m[5];   tm[6] = m[9];   tm[7] = m[13];
     tm[8] = m[2];   tm[9] = m[6];   tm[10]= m[10];  tm[11]= m[14];
     tm[12]= m[3];   tm[13]= m[7];   tm[14]= m[11];  tm[15]= m[15];
+#endif
     return tm;
 }
 
@@ -750,20 +833,16 @@ inline Matrix4& Matrix4::identity()
 
 inline Matrix4 Matrix4::operator+(const Matrix4& rhs) const
 {
-    return Matrix4(m[0]+rhs[0],   m[1]+rhs[1],   m[2]+rhs[2],   m[3]+rhs[3],
-                   m[4]+rhs[4],   m[5]+rhs[5],   m[6]+rhs[6],   m[7]+rhs[7],
-                   m[8]+rhs[8],   m[9]+rhs[9],   m[10]+rhs[10], m[11]+rhs[11],
-                   m[12]+rhs[12], m[13]+rhs[13], m[14]+rhs[14], m[15]+rhs[15]);
+    Matrix4 r(*this);
+    return r += rhs;
 }
 
 
 
 inline Matrix4 Matrix4::operator-(const Matrix4& rhs) const
 {
-    return Matrix4(m[0]-rhs[0],   m[1]-rhs[1],   m[2]-rhs[2],   m[3]-rhs[3],
-                   m[4]-rhs[4],   m[5]-rhs[5],   m[6]-rhs[6],   m[7]-rhs[7],
-                   m[8]-rhs[8],   m[9]-rhs[9],   m[10]-rhs[10], m[11]-rhs[11],
-                   m[12]-rhs[12], m[13]-rhs[13], m[14]-rhs[14], m[15]-rhs[15]);
+    Matrix4 r(*this);
+    return r -= rhs;
 }
 
 
@@ -790,31 +869,121 @@ inline Matrix4& Matrix4::operator-=(const Matrix4& rhs)
 
 
 
+inline Vector4 Matrix4::dotRows(const float a[16], const Vector4& v)
+{
+#if defined(MATH_USE_SSE)
+    // products of each row with v, then a transpose turns the four
+    // horizontal sums into vertical adds
+    __m128 x = _mm_loadu_ps(&v.x);
+    __m128 r0 = _mm_mul_ps(_mm_loadu_ps(&a[0]), x);
+    __m128 r1 = _mm_mul_ps(_mm_loadu_ps(&a[4]), x);
+    __m128 r2 = _mm_mul_ps(_mm_loadu_ps(&a[8]), x);
+    __m128 r3 = _mm_mul_ps(_mm_loadu_ps(&a[12]), x);
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+    Vector4 result;
+    _mm_storeu_ps(&result.x, _mm_add_ps(_mm_add_ps(r0, r1), _mm_add_ps(r2, r3)));
+    return result;
+#else
+    return Vector4(a[0]*v.x  + a[1]*v.y  + a[2]*v.z  + a[3]*v.w,
+                   a[4]*v.x  + a[5]*v.y  + a[6]*v.z  + a[7]*v.w,
+                   a[8]*v.x  + a[9]*v.y  + a[10]*v.z + a[11]*v.w,
+                   a[12]*v.x + a[13]*v.y + a[14]*v.z + a[15]*v.w);
+#endif
+}
+
+
+
+inline Vector4 Matrix4::sumRows(const float a[16], const Vector4& v)
+{
+#if defined(MATH_USE_SSE)
+    __m128 sum = _mm_mul_ps(_mm_set1_ps(v.x), _mm_loadu_ps(&a[0]));
+    sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(v.y), _mm_loadu_ps(&a[4])));
+    sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(v.z), _mm_loadu_ps(&a[8])));
+    sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(v.w), _mm_loadu_ps(&a[12])));
+    Vector4 result;
+    _mm_storeu_ps(&result.x, sum);
+    return result;
+#else
+    return Vector4(v.x*a[0] + v.y*a[4] + v.z*a[8]  + v.w*a[12],
+                   v.x*a[1] + v.y*a[5] + v.z*a[9]  + v.w*a[13],
+                   v.x*a[2] + v.y*a[6] + v.z*a[10] + v.w*a[14],
+                   v.x*a[3] + v.y*a[7] + v.z*a[11] + v.w*a[15]);
+#endif
+}
+
+
+
+inline void Matrix4::multiply(const float a[16], const float b[16], float r[16])
+{
+    // row i of the product is the sum of a[i][k] * row k of b
+#if defined(MATH_USE_AVX)
+    __m256 b0 = _mm256_broadcast_ps((const __m128*)&b[0]);
+    __m256 b1 = _mm256_broadcast_ps((const __m128*)&b[4]);
+    __m256 b2 = _mm256_broadcast_ps((const __m128*)&b[8]);
+    __m256 b3 = _mm256_broadcast_ps((const __m128*)&b[12]);
+    for(int i = 0; i < 16; i += 8)
+    {
+        __m256 x = _mm256_loadu_ps(&a[i]);              // rows i/4 and i/4 + 1
+        __m256 sum = _mm256_mul_ps(_mm256_shuffle_ps(x, x, 0x00), b0);
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_shuffle_ps(x, x, 0x55), b1));
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_shuffle_ps(x, x, 0xAA), b2));
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_shuffle_ps(x, x, 0xFF), b3));
+        _mm256_storeu_ps(&r[i], sum);
+    }
+#elif defined(MATH_USE_SSE)
+    __m128 b0 = _mm_loadu_ps(&b[0]), b1 = _mm_loadu_ps(&b[4]), b2 = _mm_loadu_ps(&b[8]), b3 = _mm_loadu_ps(&b[12]);
+    for(int i = 0; i < 16; i += 4)
+    {
+        __m128 x = _mm_loadu_ps(&a[i]);
+        __m128 sum = _mm_mul_ps(_mm_shuffle_ps(x, x, 0x00), b0);
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_shuffle_ps(x, x, 0x55), b1));
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_shuffle_ps(x, x, 0xAA), b2));
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_shuffle_ps(x, x, 0xFF), b3));
+        _mm_storeu_ps(&r[i], sum);
+    }
+#else
+    for(int i = 0; i < 16; i += 4)
+    {
+        r[i]   = a[i]*b[0] + a[i+1]*b[4] + a[i+2]*b[8]  + a[i+3]*b[12];
+        r[i+1] = a[i]*b[1] + a[i+1]*b[5] + a[i+2]*b[9]  + a[i+3]*b[13];
+        r[i+2] = a[i]*b[2] + a[i+1]*b[6] + a[i+2]*b[10] + a[i+3]*b[14];
+        r[i+3] = a[i]*b[3] + a[i+1]*b[7] + a[i+2]*b[11] + a[i+3]*b[15];
+    }
+#endif
+}
+
+
+
+// a column major matrix is stored as the row major array of its transpose,
+// so M * v sums the stored rows and M * N is computed as N^T * M^T
 inline Vector4 Matrix4::operator*(const Vector4& rhs) const
 {
-    return Vector4(m[0]*rhs.x  + m[1]*rhs.y  + m[2]*rhs.z  + m[3]*rhs.w,
-                   m[4]*rhs.x  + m[5]*rhs.y  + m[6]*rhs.z  + m[7]*rhs.w,
-                   m[8]*rhs.x  + m[9]*rhs.y  + m[10]*rhs.z + m[11]*rhs.w,
-                   m[12]*rhs.x + m[13]*rhs.y + m[14]*rhs.z + m[15]*rhs.w);
+#if defined(MATRIX4_COLUMN_MAJOR)
+    return sumRows(m, rhs);
+#else
+    return dotRows(m, rhs);
+#endif
 }
 
 
 
 inline Vector3 Matrix4::operator*(const Vector3& rhs) const
 {
-    return Vector3(m[0]*rhs.x + m[1]*rhs.y + m[2]*rhs.z,
-                   m[4]*rhs.x + m[5]*rhs.y + m[6]*rhs.z,
-                   m[8]*rhs.x + m[9]*rhs.y + m[10]*rhs.z);
+    Vector4 r = *this * Vector4(rhs.x, rhs.y, rhs.z, 0.0f);
+    return Vector3(r.x, r.y, r.z);
 }
 
 
 
 inline Matrix4 Matrix4::operator*(const Matrix4& n) const
 {
-    return Matrix4(m[0]*n[0]  + m[1]*n[4]  + m[2]*n[8]  + m[3]*n[12],   m[0]*n[1]  + m[1]*n[5]  + m[2]*n[9]  + m[3]*n[13],   m[0]*n[2]  + m[1]*n[6]  + m[2]*n[10]  + m[3]*n[14],   m[0]*n[3]  + m[1]*n[7]  + m[2]*n[11]  + m[3]*n[15],
-                   m[4]*n[0]  + m[5]*n[4]  + m[6]*n[8]  + m[7]*n[12],   m[4]*n[1]  + m[5]*n[5]  + m[6]*n[9]  + m[7]*n[13],   m[4]*n[2]  + m[5]*n[6]  + m[6]*n[10]  + m[7]*n[14],   m[4]*n[3]  + m[5]*n[7]  + m[6]*n[11]  + m[7]*n[15],
-                   m[8]*n[0]  + m[9]*n[4]  + m[10]*n[8] + m[11]*n[12],  m[8]*n[1]  + m[9]*n[5]  + m[10]*n[9] + m[11]*n[13],  m[8]*n[2]  + m[9]*n[6]  + m[10]*n[10] + m[11]*n[14],  m[8]*n[3]  + m[9]*n[7]  + m[10]*n[11] + m[11]*n[15],
-                   m[12]*n[0] + m[13]*n[4] + m[14]*n[8] + m[15]*n[12],  m[12]*n[1] + m[13]*n[5] + m[14]*n[9] + m[15]*n[13],  m[12]*n[2] + m[13]*n[6] + m[14]*n[10] + m[15]*n[14],  m[12]*n[3] + m[13]*n[7] + m[14]*n[11] + m[15]*n[15]);
+    Matrix4 r((Uninitialized()));
+#if defined(MATRIX4_COLUMN_MAJOR)
+    multiply(n.m, m, r.m);
+#else
+    multiply(m, n.m, r.m);
+#endif
+    return r;
 }
 
 
@@ -827,6 +996,43 @@ inline Matrix4& Matrix4::operator*=(const Matrix4& rhs)
 
 
 
+// the last rows are known, so only the upper 3x4 block is computed: 36
+// multiplications instead of 64
+inline Matrix4 Matrix4::multiplyAffine(const Matrix4& n) const
+{
+    Matrix4 r((Uninitialized()));
+#if defined(MATH_USE_SSE) && defined(MATRIX4_COLUMN_MAJOR)
+    // column j of the product is M times column j of N
+    __m128 c0 = _mm_loadu_ps(&m[0]), c1 = _mm_loadu_ps(&m[4]), c2 = _mm_loadu_ps(&m[8]);
+    for(int j = 0; j < 16; j += 4)
+    {
+        __m128 sum = _mm_mul_ps(_mm_set1_ps(n.m[j]), c0);
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(n.m[j+1]), c1));
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(n.m[j+2]), c2));
+        _mm_storeu_ps(&r.m[j], sum);
+    }
+    _mm_storeu_ps(&r.m[12], _mm_add_ps(_mm_loadu_ps(&r.m[12]), _mm_loadu_ps(&m[12])));
+#else
+    r.m[M00] = m[M00]*n.m[M00] + m[M01]*n.m[M10] + m[M02]*n.m[M20];
+    r.m[M01] = m[M00]*n.m[M01] + m[M01]*n.m[M11] + m[M02]*n.m[M21];
+    r.m[M02] = m[M00]*n.m[M02] + m[M01]*n.m[M12] + m[M02]*n.m[M22];
+    r.m[M03] = m[M00]*n.m[M03] + m[M01]*n.m[M13] + m[M02]*n.m[M23] + m[M03];
+    r.m[M10] = m[M10]*n.m[M00] + m[M11]*n.m[M10] + m[M12]*n.m[M20];
+    r.m[M11] = m[M10]*n.m[M01] + m[M11]*n.m[M11] + m[M12]*n.m[M21];
+    r.m[M12] = m[M10]*n.m[M02] + m[M11]*n.m[M12] + m[M12]*n.m[M22];
+    r.m[M13] = m[M10]*n.m[M03] + m[M11]*n.m[M13] + m[M12]*n.m[M23] + m[M13];
+    r.m[M20] = m[M20]*n.m[M00] + m[M21]*n.m[M10] + m[M22]*n.m[M20];
+    r.m[M21] = m[M20]*n.m[M01] + m[M21]*n.m[M11] + m[M22]*n.m[M21];
+    r.m[M22] = m[M20]*n.m[M02] + m[M21]*n.m[M12] + m[M22]*n.m[M22];
+    r.m[M23] = m[M20]*n.m[M03] + m[M21]*n.m[M13] + m[M22]*n.m[M23] + m[M23];
+    r.m[M30] = r.m[M31] = r.m[M32] = 0.0f;
+    r.m[M33] = 1.0f;
+#endif
+    return r;
+}
+
+
+
 inline bool Matrix4::operator==(const Matrix4& n) const
 {
     return (m[0] == n[0])   && (m[1] == n[1])   && (m[2] == n[2])   && (m[3] == n[3]) &&
@@ -863,39 +1069,77 @@ inline float& Matrix4::operator[](int index)
 
 inline Matrix4 operator-(const Matrix4& rhs)
 {
-    return Matrix4(-rhs[0], -rhs[1], -rhs[2], -rhs[3], -rhs[4], -rhs[5], -rhs[6], -rhs[7], -rhs[8], -rhs[9], -rhs[10], -rhs[11], -rhs[12], -rhs[13], -rhs[14], -rhs[15]);
+    Matrix4 r((Matrix4::Uninitialized()));
+    for(int i = 0; i < 16; ++i)
+        r.m[i] = -rhs.m[i];
+    return r;
 }
 
 
 
 inline Matrix4 operator*(float s, const Matrix4& rhs)
 {
-    return Matrix4(s*rhs[0], s*rhs[1], s*rhs[2], s*rhs[3], s*rhs[4], s*rhs[5], s*rhs[6], s*rhs[7], s*rhs[8], s*rhs[9], s*rhs[10], s*rhs[11], s*rhs[12], s*rhs[13], s*rhs[14], s*rhs[15]);
+    Matrix4 r((Matrix4::Uninitialized()));
+    for(int i = 0; i < 16; ++i)
+        r.m[i] = s * rhs.m[i];
+    return r;
 }
 
 
 
 inline Vector4 operator*(const Vector4& v, const Matrix4& m)
 {
-    return Vector4(v.x*m[0] + v.y*m[4] + v.z*m[8] + v.w*m[12],  v.x*m[1] + v.y*m[5] + v.z*m[9] + v.w*m[13],  v.x*m[2] + v.y*m[6] + v.z*m[10] + v.w*m[14], v.x*m[3] + v.y*m[7] + v.z*m[11] + v.w*m[15]);
+#if defined(MATRIX4_COLUMN_MAJOR)
+    return Matrix4::dotRows(m.m, v);
+#else
+    return Matrix4::sumRows(m.m, v);
+#endif
 }
 
 
 
 inline Vector3 operator*(const Vector3& v, const Matrix4& m)
 {
-    return Vector3(v.x*m[0] + v.y*m[4] + v.z*m[8],  v.x*m[1] + v.y*m[5] + v.z*m[9],  v.x*m[2] + v.y*m[6] + v.z*m[10]);
+    Vector4 r = Vector4(v.x, v.y, v.z, 0.0f) * m;
+    return Vector3(r.x, r.y, r.z);
 }
 
 
 
 inline std::ostream& operator<<(std::ostream& os, const Matrix4& m)
 {
-    os << "(" << m[0]  << ",\t" << m[1]  << ",\t" << m[2]  <<  ",\t" << m[3] << ")\n"
-       << "(" << m[4]  << ",\t" << m[5]  << ",\t" << m[6]  <<  ",\t" << m[7] << ")\n"
-       << "(" << m[8]  << ",\t" << m[9]  << ",\t" << m[10] <<  ",\t" << m[11] << ")\n"
-       << "(" << m[12] << ",\t" << m[13] << ",\t" << m[14] <<  ",\t" << m[15] << ")\n";
+    for(int i = 0; i < 4; ++i)
+    {
+        Vector4 row = m.getRow(i);
+        os << "(" << row.x << ",\t" << row.y << ",\t" << row.z << ",\t" << row.w << ")\n";
+    }
     return os;
 }
 // END OF MATRIX4 INLINE //////////////////////////////////////////////////////
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+// rotation matrix of a unit quaternion, straight from its products, without
+// trig or matrix multiplies
+///////////////////////////////////////////////////////////////////////////////
+inline Matrix3 toMatrix3(const Quaternion& q)
+{
+    float x2 = q.x + q.x, y2 = q.y + q.y, z2 = q.z + q.z;
+    float xx = q.x * x2, yy = q.y * y2, zz = q.z * z2;
+    float xy = q.x * y2, xz = q.x * z2, yz = q.y * z2;
+    float wx = q.w * x2, wy = q.w * y2, wz = q.w * z2;
+    return Matrix3(1.0f - yy - zz, xy - wz,        xz + wy,
+                   xy + wz,        1.0f - xx - zz, yz - wx,
+                   xz - wy,        yz + wx,        1.0f - xx - yy);
+}
+
+inline Matrix4 toMatrix4(const Quaternion& q)
+{
+    Matrix3 r = toMatrix3(q);
+    return Matrix4(r[0], r[1], r[2], 0.0f,
+                   r[3], r[4], r[5], 0.0f,
+                   r[6], r[7], r[8], 0.0f,
+                   0.0f, 0.0f, 0.0f, 1.0f);
+}
 #endif
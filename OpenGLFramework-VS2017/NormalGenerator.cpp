@@ -0,0 +1,225 @@
+///////////////////////////////////////////////////////////////////////////////
+// NormalGenerator.cpp
+// ===================
+// Smooth vertex normals for meshes loaded without them, and tangent frames
+// for normal mapping
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cmath>
+#include <thread>
+#include "Vectors.h"
+#include "BatchMath.h"
+#include "NormalGenerator.h"
+
+// below this many items the threads cost more than they save
+const int MIN_PARALLEL_COUNT = 16384;
+
+// run body(begin, end) over [0, count), one contiguous range per thread
+template <class Body>
+static void parallelFor(int count, int threadCount, const Body& body)
+{
+  if (threadCount <= 1 || count < MIN_PARALLEL_COUNT) {
+    body(0, count);
+    return;
+  }
+  int chunk = (count + threadCount - 1) / threadCount;
+  std::vector<std::thread> workers;
+  for (int begin = chunk; begin < count; begin += chunk) {
+    int end = begin + chunk < count ? begin + chunk : count;
+    workers.emplace_back([&body, begin, end]() { body(begin, end); });
+  }
+  body(0, chunk);
+  for (auto& worker : workers) worker.join();
+}
+
+static Vector3 corner(const std::vector<float>& positions, int c)
+{
+  return Vector3(positions[3 * c + 0], positions[3 * c + 1], positions[3 * c + 2]);
+}
+
+// angle between two edges leaving a corner
+static float cornerAngle(const Vector3& u, const Vector3& v)
+{
+  float length = u.length() * v.length();
+  if (length <= 0.f) return 0.f;
+  float cosine = u.dot(v) / length;
+  cosine = cosine < -1.f ? -1.f : (cosine > 1.f ? 1.f : cosine);
+  return acosf(cosine);
+}
+
+// corners of each shared position, counting sort by position
+static void buildVertexCorners(const std::vector<int>& cornerVertex, int vertexCount,
+                               std::vector<int>& firstCorner, std::vector<int>& vertexCorners)
+{
+  int cornerCount = (int)cornerVertex.size();
+  firstCorner.assign(vertexCount + 1, 0);
+  for (int c = 0; c < cornerCount; c++) firstCorner[cornerVertex[c] + 1]++;
+  for (int v = 0; v < vertexCount; v++) firstCorner[v + 1] += firstCorner[v];
+  vertexCorners.resize(cornerCount);
+  std::vector<int> cursor(firstCorner.begin(), firstCorner.end() - 1);
+  for (int c = 0; c < cornerCount; c++) vertexCorners[cursor[cornerVertex[c]]++] = c;
+}
+
+// signed 10 bit normalized
+static unsigned int packSnorm10(float value)
+{
+  value = value < -1.f ? -1.f : (value > 1.f ? 1.f : value);
+  return (unsigned int)(int)floorf(value * 511.f + 0.5f) & 0x3FF;
+}
+
+// unit vector -> octahedron folded onto the [-1, 1] square, as gbuffer.fs
+static unsigned int packTangent(const Vector3& tangent, float sign)
+{
+  Vector3 t = tangent / (fabsf(tangent.x) + fabsf(tangent.y) + fabsf(tangent.z));
+  float x = t.x, y = t.y;
+  if (t.z < 0.f) {
+    x = (1.f - fabsf(t.y)) * (t.x >= 0.f ? 1.f : -1.f);
+    y = (1.f - fabsf(t.x)) * (t.y >= 0.f ? 1.f : -1.f);
+  }
+  return packSnorm10(x) | packSnorm10(y) << 10 | (sign < 0.f ? 3u : 1u) << 30;
+}
+
+void generateSmoothNormals(const std::vector<float>& positions, const std::vector<int>& cornerVertex, int vertexCount,
+                           const std::vector<unsigned int>& smoothingGroups, const NormalSettings& settings,
+                           std::vector<float>& normals)
+{
+  int cornerCount = (int)cornerVertex.size();
+  int faceCount = cornerCount / 3;
+  int threadCount = settings.threadCount > 0 ? settings.threadCount : (int)std::thread::hardware_concurrency();
+
+  // unit face normals, and the weight each face gives to its three corners
+  std::vector<Vector3> faceNormals(faceCount);
+  std::vector<float> cornerWeights(cornerCount);
+  parallelFor(faceCount, threadCount, [&](int begin, int end) {
+    for (int f = begin; f < end; f++) {
+      Vector3 p0 = corner(positions, 3 * f), p1 = corner(positions, 3 * f + 1), p2 = corner(positions, 3 * f + 2);
+      Vector3 normal = (p1 - p0).cross(p2 - p0);
+      float lengthSquare = normal.dot(normal);
+      float invLength = lengthSquare > 0.f ? invSqrtFast(lengthSquare) : 0.f;
+      faceNormals[f] = normal * invLength;
+      if (settings.weighting == NormalWeightArea) {
+        cornerWeights[3 * f] = cornerWeights[3 * f + 1] = cornerWeights[3 * f + 2] = lengthSquare * invLength;
+      }
+      else {
+        cornerWeights[3 * f + 0] = cornerAngle(p1 - p0, p2 - p0);
+        cornerWeights[3 * f + 1] = cornerAngle(p2 - p1, p0 - p1);
+        cornerWeights[3 * f + 2] = cornerAngle(p0 - p2, p1 - p2);
+      }
+    }
+  });
+
+  std::vector<int> firstCorner, vertexCorners;
+  buildVertexCorners(cornerVertex, vertexCount, firstCorner, vertexCorners);
+
+  bool hasGroups = false;
+  if ((int)smoothingGroups.size() == faceCount) {
+    for (unsigned int group : smoothingGroups) {
+      if (group) {
+        hasGroups = true;
+        break;
+      }
+    }
+  }
+  float cosineCrease = cosf(settings.creaseAngleDegree * 3.14159265f / 180.f);
+
+  // every corner gathers from its neighbours, so no two threads write the same
+  // normal. The sums of a range are normalized in one batch before they are
+  // interleaved into normals.
+  normals.resize((size_t)cornerCount * 3);
+  std::vector<float> sumX(cornerCount), sumY(cornerCount), sumZ(cornerCount);
+  parallelFor(cornerCount, threadCount, [&](int begin, int end) {
+    for (int c = begin; c < end; c++) {
+      int f = c / 3;
+      unsigned int group = hasGroups ? smoothingGroups[f] : 1;
+      const Vector3& faceNormal = faceNormals[f];
+      Vector3 sum = faceNormal;
+      if (group) {
+        sum = Vector3(0.f, 0.f, 0.f);
+        int v = cornerVertex[c];
+        for (int i = firstCorner[v]; i < firstCorner[v + 1]; i++) {
+          int other = vertexCorners[i];
+          int g = other / 3;
+          if (hasGroups && smoothingGroups[g] != group) continue;
+          if (g != f && faceNormal.dot(faceNormals[g]) < cosineCrease) continue;
+          sum += faceNormals[g] * cornerWeights[other];
+        }
+        if (sum.length() <= 0.f) sum = faceNormal; // zero weights, e.g. slivers only
+      }
+      sumX[c] = sum.x;
+      sumY[c] = sum.y;
+      sumZ[c] = sum.z;
+    }
+    normalizeVectorsFast(sumX.data() + begin, sumY.data() + begin, sumZ.data() + begin, end - begin);
+    for (int c = begin; c < end; c++) {
+      bool isDegenerate = sumX[c] == 0.f && sumY[c] == 0.f && sumZ[c] == 0.f; // left zero by the batch
+      normals[3 * c + 0] = sumX[c];
+      normals[3 * c + 1] = sumY[c];
+      normals[3 * c + 2] = isDegenerate ? 1.f : sumZ[c];
+    }
+  });
+}
+
+void generateTangents(const std::vector<float>& positions, const std::vector<float>& normals,
+                      const std::vector<float>& texCoords, const std::vector<int>& cornerVertex, int vertexCount,
+                      const NormalSettings& settings, std::vector<unsigned int>& tangents)
+{
+  int cornerCount = (int)cornerVertex.size();
+  int faceCount = cornerCount / 3;
+  int threadCount = settings.threadCount > 0 ? settings.threadCount : (int)std::thread::hardware_concurrency();
+
+  // texture space tangent of every face, unit length and flipped on mirrored
+  // faces, plus the corner angles it is weighted by
+  std::vector<Vector3> faceTangents(faceCount);
+  std::vector<signed char> faceOrientations(faceCount);
+  std::vector<float> cornerAngles(cornerCount);
+  parallelFor(faceCount, threadCount, [&](int begin, int end) {
+    for (int f = begin; f < end; f++) {
+      Vector3 p0 = corner(positions, 3 * f), p1 = corner(positions, 3 * f + 1), p2 = corner(positions, 3 * f + 2);
+      Vector3 d1 = p1 - p0, d2 = p2 - p0;
+      float t21x = texCoords[6 * f + 2] - texCoords[6 * f + 0], t21y = texCoords[6 * f + 3] - texCoords[6 * f + 1];
+      float t31x = texCoords[6 * f + 4] - texCoords[6 * f + 0], t31y = texCoords[6 * f + 5] - texCoords[6 * f + 1];
+      float signedArea = t21x * t31y - t21y * t31x;
+      faceOrientations[f] = signedArea > 0.f ? 1 : -1;
+      Vector3 tangent = (d1 * t31y - d2 * t21y) * (float)faceOrientations[f];
+      faceTangents[f] = signedArea != 0.f ? tangent.normalizeFast() : Vector3(0.f, 0.f, 0.f);
+      cornerAngles[3 * f + 0] = cornerAngle(d1, d2);
+      cornerAngles[3 * f + 1] = cornerAngle(p2 - p1, p0 - p1);
+      cornerAngles[3 * f + 2] = cornerAngle(p0 - p2, p1 - p2);
+    }
+  });
+
+  std::vector<int> firstCorner, vertexCorners;
+  buildVertexCorners(cornerVertex, vertexCount, firstCorner, vertexCorners);
+
+  tangents.resize(cornerCount);
+  parallelFor(cornerCount, threadCount, [&](int begin, int end) {
+    for (int c = begin; c < end; c++) {
+      int f = c / 3;
+      Vector3 normal = corner(normals, c);
+      float u = texCoords[2 * c], v = texCoords[2 * c + 1];
+      Vector3 sum(0.f, 0.f, 0.f);
+      int vertex = cornerVertex[c];
+      for (int i = firstCorner[vertex]; i < firstCorner[vertex + 1]; i++) {
+        int other = vertexCorners[i];
+        int g = other / 3;
+        // the same vertex to MikkTSpace: identical attributes and orientation
+        if (faceOrientations[g] != faceOrientations[f]) continue;
+        if (normals[3 * other] != normal.x || normals[3 * other + 1] != normal.y || normals[3 * other + 2] != normal.z) continue;
+        if (texCoords[2 * other] != u || texCoords[2 * other + 1] != v) continue;
+        Vector3 projected = faceTangents[g] - normal * normal.dot(faceTangents[g]);
+        sum += projected.normalizeFast() * cornerAngles[other];
+      }
+      // packed to 10 bits below, so the fast normalize loses nothing
+      if (sum.dot(sum) > 0.f) {
+        sum.normalizeFast();
+      }
+      else {
+        // no usable texture gradient, any direction in the normal plane
+        Vector3 axis = fabsf(normal.x) < 0.9f ? Vector3(1.f, 0.f, 0.f) : Vector3(0.f, 1.f, 0.f);
+        sum = axis - normal * normal.dot(axis);
+        sum = sum.dot(sum) > 0.f ? sum.normalizeFast() : Vector3(1.f, 0.f, 0.f);
+      }
+      tangents[c] = packTangent(sum, (float)faceOrientations[f]);
+    }
+  });
+}
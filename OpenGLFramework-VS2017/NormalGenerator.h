@@ -0,0 +1,58 @@
+///////////////////////////////////////////////////////////////////////////////
+// NormalGenerator.h
+// =================
+// Smooth vertex normals for meshes loaded without them, and tangent frames
+// for normal mapping
+//
+// The input is a triangle list in draw order, three corners per face, where
+// every corner also names the shared position it came from. A corner's
+// normal is the weighted sum of the face normals around its position, taken
+// only over faces in the same smoothing group whose normal is within the
+// crease angle of the corner's own face, so hard edges stay hard.
+//
+// Face normals and the per-corner sums are computed on worker threads, each
+// owning a contiguous range of faces or corners; the position -> corners
+// table in between is built with a counting sort.
+//
+// Tangents follow the MikkTSpace conventions, so normal maps baked against
+// MikkTSpace come out right: the per-face tangent is derived from the
+// texture coordinate gradients, projected onto the corner's normal plane and
+// weighted by corner angle, then averaged over corners that share position,
+// normal, texture coordinate and texture space orientation. The bitangent is
+// not stored; the shader rebuilds it as sign * cross(normal, tangent).
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef NORMAL_GENERATOR_H_DEF
+#define NORMAL_GENERATOR_H_DEF
+
+#include <vector>
+
+enum NormalWeighting
+{
+  NormalWeightArea = 0,   // large faces dominate
+  NormalWeightAngle       // by the corner angle, independent of tessellation
+};
+
+struct NormalSettings
+{
+  NormalWeighting weighting = NormalWeightAngle;
+  float creaseAngleDegree = 60.f; // faces further apart than this do not share normals
+  int threadCount = 0;            // 0: one per hardware thread
+};
+
+// positions: 3 floats per corner; cornerVertex: shared position of each corner
+// in [0, vertexCount); smoothingGroups: per face, may be empty. Group 0 never
+// smooths, unless no face has a group, then every face is in one group.
+// normals receives 3 floats per corner.
+void generateSmoothNormals(const std::vector<float>& positions, const std::vector<int>& cornerVertex, int vertexCount,
+                           const std::vector<unsigned int>& smoothingGroups, const NormalSettings& settings,
+                           std::vector<float>& normals);
+
+// positions, normals: 3 floats per corner; texCoords: 2 floats per corner.
+// tangents receives one GL_INT_2_10_10_10_REV value per corner: the unit
+// tangent octahedral encoded in x and y, the bitangent sign in w.
+void generateTangents(const std::vector<float>& positions, const std::vector<float>& normals,
+                      const std::vector<float>& texCoords, const std::vector<int>& cornerVertex, int vertexCount,
+                      const NormalSettings& settings, std::vector<unsigned int>& tangents);
+
+#endif
@@ -0,0 +1,182 @@
+///////////////////////////////////////////////////////////////////////////////
+// OcclusionCuller.cpp
+// ===================
+// Occlusion culling against a hierarchical depth (Hi-Z) pyramid
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cmath>
+#include <cstring>
+#include "OcclusionCuller.h"
+
+// a box whose nearest point is within this fraction in front of the
+// occluder is not trusted to the one frame old pyramid
+const float BORDERLINE_BAND = 0.1f;
+// slack for depth precision before a box is declared hidden
+const float OCCLUDED_MARGIN = 0.01f;
+
+void HiZBuffer::build(const float* depth, int width, int height)
+{
+  if (levels.empty() || levels[0].width != width || levels[0].height != height) {
+    levels.clear();
+    int w = width, h = height;
+    while (true) {
+      Level level;
+      level.width = w;
+      level.height = h;
+      level.depth.resize((size_t)w * h);
+      levels.push_back(level);
+      if (w == 1 && h == 1) break;
+      w = (w + 1) / 2;
+      h = (h + 1) / 2;
+    }
+  }
+
+  memcpy(levels[0].depth.data(), depth, sizeof(float) * width * height);
+  for (size_t l = 1; l < levels.size(); l++) {
+    const Level& src = levels[l - 1];
+    Level& dst = levels[l];
+    for (int y = 0; y < dst.height; y++) {
+      int y0 = y * 2;
+      int y1 = y0 + 1 < src.height ? y0 + 1 : y0;
+      const float* row0 = &src.depth[(size_t)y0 * src.width];
+      const float* row1 = &src.depth[(size_t)y1 * src.width];
+      float* out = &dst.depth[(size_t)y * dst.width];
+      for (int x = 0; x < dst.width; x++) {
+        int x0 = x * 2;
+        int x1 = x0 + 1 < src.width ? x0 + 1 : x0;
+        float a = row0[x0] > row0[x1] ? row0[x0] : row0[x1];
+        float b = row1[x0] > row1[x1] ? row1[x0] : row1[x1];
+        out[x] = a > b ? a : b;
+      }
+    }
+  }
+  valid = true;
+}
+
+float HiZBuffer::linearDepth(float depth) const
+{
+  float ndc = depth * 2.f - 1.f;
+  return 2.f * zNear * zFar / (zFar + zNear - ndc * (zFar - zNear));
+}
+
+float HiZBuffer::farthestDepth(int level, int x0, int y0, int x1, int y1) const
+{
+  const Level& lv = levels[level];
+  float farthest = 0.f;
+  for (int y = y0; y <= y1; y++) {
+    for (int x = x0; x <= x1; x++) {
+      float d = lv.depth[(size_t)y * lv.width + x];
+      if (d > farthest) farthest = d;
+    }
+  }
+  return farthest;
+}
+
+OcclusionResult HiZBuffer::test(const BoundingBox& box, const Matrix4& mvp, int vpX, int vpY, int vpWidth, int vpHeight) const
+{
+  if (!valid) return OcclusionVisible;
+
+  float minX = 1e30f, minY = 1e30f, maxX = -1e30f, maxY = -1e30f;
+  float nearest = 1e30f;
+  for (int i = 0; i < 8; i++) {
+    Vector4 corner((i & 1) ? box.max.x : box.min.x,
+                   (i & 2) ? box.max.y : box.min.y,
+                   (i & 4) ? box.max.z : box.min.z,
+                   1.f);
+    Vector4 clip = mvp * corner;
+    // crossing the near plane, the projected rectangle is unbounded
+    if (clip.w <= zNear) return OcclusionVisible;
+    float x = clip.x / clip.w;
+    float y = clip.y / clip.w;
+    if (x < minX) minX = x;
+    if (x > maxX) maxX = x;
+    if (y < minY) minY = y;
+    if (y > maxY) maxY = y;
+    if (clip.w < nearest) nearest = clip.w; // w is the view distance for perspective
+  }
+
+  // normalized device -> window pixels, clamped to the viewport
+  const Level& base = levels[0];
+  int x0 = (int)floorf(vpX + (minX * 0.5f + 0.5f) * vpWidth);
+  int x1 = (int)floorf(vpX + (maxX * 0.5f + 0.5f) * vpWidth);
+  int y0 = (int)floorf(vpY + (minY * 0.5f + 0.5f) * vpHeight);
+  int y1 = (int)floorf(vpY + (maxY * 0.5f + 0.5f) * vpHeight);
+  if (x0 < vpX) x0 = vpX;
+  if (y0 < vpY) y0 = vpY;
+  if (x1 > vpX + vpWidth - 1) x1 = vpX + vpWidth - 1;
+  if (y1 > vpY + vpHeight - 1) y1 = vpY + vpHeight - 1;
+  if (x1 > base.width - 1) x1 = base.width - 1;
+  if (y1 > base.height - 1) y1 = base.height - 1;
+  if (x0 > x1 || y0 > y1) return OcclusionVisible; // off screen, left to the frustum test
+
+  // coarsest level where the rectangle spans at most 2x2 texels
+  int level = 0;
+  while (level + 1 < (int)levels.size() && ((x1 >> level) - (x0 >> level) > 1 || (y1 >> level) - (y0 >> level) > 1)) {
+    level++;
+  }
+  float farthest = farthestDepth(level, x0 >> level, y0 >> level, x1 >> level, y1 >> level);
+  if (farthest >= 1.f) return OcclusionVisible; // background is uncovered
+
+  float occluder = linearDepth(farthest);
+  if (nearest > occluder * (1.f + OCCLUDED_MARGIN)) return OcclusionOccluded;
+  if (nearest > occluder * (1.f - BORDERLINE_BAND)) return OcclusionBorderline;
+  return OcclusionVisible;
+}
+
+void DepthReadback::release()
+{
+  for (int i = 0; i < 2; i++) {
+    if (fence[i]) glDeleteSync(fence[i]);
+    fence[i] = 0;
+  }
+  if (pbo[0]) glDeleteBuffers(2, pbo);
+  pbo[0] = pbo[1] = 0;
+}
+
+void DepthReadback::request(int w, int h)
+{
+  if (w != width || h != height || !pbo[0]) {
+    release();
+    width = w;
+    height = h;
+    glGenBuffers(2, pbo);
+    for (int i = 0; i < 2; i++) {
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[i]);
+      glBufferData(GL_PIXEL_PACK_BUFFER, sizeof(float) * width * height, NULL, GL_STREAM_READ);
+    }
+  }
+  if (fence[next]) glDeleteSync(fence[next]);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[next]);
+  glReadPixels(0, 0, width, height, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  fence[next] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  next ^= 1;
+}
+
+bool DepthReadback::fetch(HiZBuffer& hiz)
+{
+  // newest read first, it is the one just before the last request
+  for (int k = 1; k <= 2; k++) {
+    int i = (next + k) & 1;
+    if (!fence[i]) continue;
+    GLenum status = glClientWaitSync(fence[i], 0, 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) continue;
+    glDeleteSync(fence[i]);
+    fence[i] = 0;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[i]);
+    const float* depth = (const float*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, sizeof(float) * width * height, GL_MAP_READ_BIT);
+    if (depth) {
+      hiz.build(depth, width, height);
+      glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    if (k == 1) {
+      // the other read is older, drop it
+      int j = i ^ 1;
+      if (fence[j]) glDeleteSync(fence[j]);
+      fence[j] = 0;
+    }
+    return depth != NULL;
+  }
+  return false;
+}
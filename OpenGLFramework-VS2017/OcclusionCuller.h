@@ -0,0 +1,72 @@
+///////////////////////////////////////////////////////////////////////////////
+// OcclusionCuller.h
+// =================
+// Occlusion culling against a hierarchical depth (Hi-Z) pyramid
+//
+// The depth buffer of the previous frame is read back asynchronously through
+// a pair of pixel buffer objects, then reduced on the CPU into a pyramid in
+// which every texel keeps the farthest depth of the 2x2 texels below it.
+// A bounding box is occluded when its nearest point is behind the farthest
+// depth of every texel it covers. Boxes that are only just visible are
+// reported as borderline so the caller can confirm them with a hardware
+// occlusion query.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef OCCLUSION_CULLER_H_DEF
+#define OCCLUSION_CULLER_H_DEF
+
+#include <vector>
+#include <glad/glad.h>
+#include "Matrices.h"
+#include "Frustum.h"
+
+enum OcclusionResult
+{
+  OcclusionVisible = 0,
+  OcclusionOccluded,
+  OcclusionBorderline
+};
+
+class HiZBuffer
+{
+public:
+  // rebuild every level from a full resolution depth buffer (bottom-up rows)
+  void build(const float* depth, int width, int height);
+  void invalidate() { valid = false; }
+  bool isValid() const { return valid; }
+  void setDepthRange(float nearClip, float farClip) { zNear = nearClip; zFar = farClip; }
+
+  // box is in the object space of mvp; the viewport is in window pixels
+  OcclusionResult test(const BoundingBox& box, const Matrix4& mvp, int vpX, int vpY, int vpWidth, int vpHeight) const;
+
+private:
+  float linearDepth(float depth) const;                                 // window depth -> view distance
+  float farthestDepth(int level, int x0, int y0, int x1, int y1) const; // inclusive texel rectangle
+
+  struct Level
+  {
+    int width, height;
+    std::vector<float> depth;
+  };
+  std::vector<Level> levels;
+  float zNear = 0.1f, zFar = 100.f;
+  bool valid = false;
+};
+
+// double-buffered asynchronous read of the default framebuffer's depth
+class DepthReadback
+{
+public:
+  void request(int width, int height);  // queue a read of this frame's depth
+  bool fetch(HiZBuffer& hiz);           // build hiz from the newest finished read, if any
+
+private:
+  void release();
+
+  GLuint pbo[2] = { 0, 0 };
+  GLsync fence[2] = { 0, 0 };
+  int width = 0, height = 0;
+  int next = 0;
+};
+
+#endif
@@ -0,0 +1,77 @@
+///////////////////////////////////////////////////////////////////////////////
+// Offscreen.cpp
+// =============
+// Render target that stands in for the window when there is none
+///////////////////////////////////////////////////////////////////////////////
+
+#include <fstream>
+#include <iostream>
+#include "Offscreen.h"
+
+static GLuint s_screenFramebuffer = 0;
+
+GLuint screenFramebuffer()
+{
+  return s_screenFramebuffer;
+}
+
+void setScreenFramebuffer(GLuint fbo)
+{
+  s_screenFramebuffer = fbo;
+}
+
+bool OffscreenTarget::resize(int w, int h)
+{
+  if (fbo && w == width && h == height) return true;
+  if (fbo) {
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteRenderbuffers(2, renderbuffers);
+  }
+  width = w;
+  height = h;
+
+  glGenRenderbuffers(2, renderbuffers);
+  glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[0]);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+  glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[1]);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+  glGenFramebuffers(1, &fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffers[0]);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, renderbuffers[1]);
+  bool isComplete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+  if (!isComplete) {
+    std::cout << "Offscreen target is incomplete" << std::endl;
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, screenFramebuffer());
+  return isComplete;
+}
+
+void OffscreenTarget::readPixels(std::vector<unsigned char>& pixels) const
+{
+  pixels.resize((size_t)width * height * 3);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+  glReadBuffer(GL_COLOR_ATTACHMENT0);
+  // rows of 3 bytes per pixel are not 4 byte aligned for every width
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+  glPixelStorei(GL_PACK_ALIGNMENT, 4);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, screenFramebuffer());
+}
+
+bool OffscreenTarget::writePPM(const char* path, const std::vector<unsigned char>& pixels) const
+{
+  std::ofstream file(path, std::ios::binary);
+  if (!file) {
+    std::cout << "Cannot write " << path << std::endl;
+    return false;
+  }
+  file << "P6\n" << width << " " << height << "\n255\n";
+  size_t rowBytes = (size_t)width * 3;
+  for (int row = height - 1; row >= 0; row--) {
+    file.write((const char*)pixels.data() + row * rowBytes, rowBytes);
+  }
+  return (bool)file;
+}
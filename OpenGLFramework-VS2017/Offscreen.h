@@ -0,0 +1,45 @@
+///////////////////////////////////////////////////////////////////////////////
+// Offscreen.h
+// ===========
+// Render target that stands in for the window when there is none
+//
+// The headless mode draws every frame into an OffscreenTarget: RGBA8 color
+// plus DEPTH24_STENCIL8, the same formats as the window's framebuffer, so
+// the G-buffer depth can still be blitted into it.
+//
+// Passes that render into their own framebuffer bind screenFramebuffer()
+// again when they finish instead of 0, so they return to the offscreen
+// target in headless mode and to the window otherwise.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef OFFSCREEN_H_DEF
+#define OFFSCREEN_H_DEF
+
+#include <vector>
+#include <glad/glad.h>
+
+// framebuffer that frames end up in, 0 (the window) unless set
+GLuint screenFramebuffer();
+void   setScreenFramebuffer(GLuint fbo);
+
+class OffscreenTarget
+{
+public:
+  bool   resize(int width, int height);  // (re)allocate when the size changes, false if incomplete
+  GLuint framebuffer() const { return fbo; }
+  int    getWidth() const { return width; }
+  int    getHeight() const { return height; }
+
+  // color of the last frame, RGB rows from the bottom up as OpenGL stores
+  // them. Waits for the frame to finish.
+  void   readPixels(std::vector<unsigned char>& pixels) const;
+  // binary PPM, rows flipped to top down
+  bool   writePPM(const char* path, const std::vector<unsigned char>& pixels) const;
+
+private:
+  GLuint fbo = 0;
+  GLuint renderbuffers[2] = { 0, 0 };   // color, depth-stencil
+  int width = 0, height = 0;
+};
+
+#endif
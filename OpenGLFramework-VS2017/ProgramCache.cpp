@@ -0,0 +1,117 @@
+///////////////////////////////////////////////////////////////////////////////
+// ProgramCache.cpp
+// ================
+// On-disk cache of linked program binaries
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+#ifdef _WIN32
+# include <direct.h>
+#else
+# include <sys/stat.h>
+#endif
+#include "ProgramCache.h"
+
+const uint32_t CACHE_MAGIC = 0x4E494250; // "PBIN"
+
+uint64_t fnv1a(const void* data, size_t size, uint64_t hash)
+{
+  const unsigned char* bytes = (const unsigned char*)data;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+void ProgramCache::open(const std::string& dir)
+{
+  directory = dir;
+  GLint formatCount = 0;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+  enabled = formatCount > 0 && glGetProgramBinary && glProgramBinary && glProgramParameteri;
+  if (!enabled) return;
+
+  const char* renderer = (const char*)glGetString(GL_RENDERER);
+  const char* version = (const char*)glGetString(GL_VERSION);
+  fingerprint = std::string(renderer ? renderer : "") + '\n' + (version ? version : "");
+#ifdef _WIN32
+  _mkdir(directory.c_str());
+#else
+  mkdir(directory.c_str(), 0755);
+#endif
+}
+
+uint64_t ProgramCache::key(const std::string& vertexSource, const std::string& fragmentSource,
+                          const char* feedbackVarying, GLenum feedbackBufferMode) const
+{
+  // the separators keep "ab" + "c" apart from "a" + "bc"
+  uint64_t hash = fnv1a(vertexSource.c_str(), vertexSource.size() + 1);
+  hash = fnv1a(fragmentSource.c_str(), fragmentSource.size() + 1, hash);
+  if (feedbackVarying) {
+    hash = fnv1a(feedbackVarying, strlen(feedbackVarying) + 1, hash);
+    hash = fnv1a(&feedbackBufferMode, sizeof(feedbackBufferMode), hash);
+  }
+  return fnv1a(fingerprint.c_str(), fingerprint.size(), hash);
+}
+
+std::string ProgramCache::path(uint64_t key) const
+{
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+  return directory + "/" + name;
+}
+
+GLuint ProgramCache::load(uint64_t key)
+{
+  if (!enabled) return 0;
+  std::ifstream file(path(key), std::ios::binary);
+  uint32_t magic = 0, format = 0, length = 0;
+  file.read((char*)&magic, sizeof(magic));
+  file.read((char*)&format, sizeof(format));
+  file.read((char*)&length, sizeof(length));
+  if (!file || magic != CACHE_MAGIC || length == 0) {
+    missCount++;
+    return 0;
+  }
+  std::vector<char> binary(length);
+  file.read(binary.data(), length);
+  if (!file) {
+    missCount++;
+    return 0;
+  }
+  file.close();
+
+  GLuint program = glCreateProgram();
+  glProgramBinary(program, (GLenum)format, binary.data(), (GLsizei)length);
+  GLint success = 0;
+  glGetProgramiv(program, GL_LINK_STATUS, &success);
+  if (!success) {
+    // stale for this driver, rebuild it from source
+    glDeleteProgram(program);
+    remove(path(key).c_str());
+    missCount++;
+    return 0;
+  }
+  hitCount++;
+  return program;
+}
+
+void ProgramCache::store(uint64_t key, GLuint program)
+{
+  if (!enabled) return;
+  GLint length = 0;
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0) return;
+  std::vector<char> binary(length);
+  GLenum format = 0;
+  glGetProgramBinary(program, length, &length, &format, binary.data());
+
+  std::ofstream file(path(key), std::ios::binary | std::ios::trunc);
+  uint32_t header[3] = { CACHE_MAGIC, (uint32_t)format, (uint32_t)length };
+  file.write((const char*)header, sizeof(header));
+  file.write(binary.data(), length);
+}
@@ -0,0 +1,52 @@
+///////////////////////////////////////////////////////////////////////////////
+// ProgramCache.h
+// ==============
+// On-disk cache of linked program binaries
+//
+// A program is stored under the 64-bit FNV-1a hash of everything that
+// decides its binary: both shader sources (with the permutation defines
+// already inserted), the transform feedback varying and buffer mode set
+// before linking, and the GL_RENDERER / GL_VERSION strings, so a driver
+// update or another GPU simply misses. Each entry is one file,
+// <directory>/<hash>.bin, holding the binary format and the binary.
+// A binary the driver rejects is deleted and reported as a miss so the
+// caller compiles from source.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef PROGRAM_CACHE_H_DEF
+#define PROGRAM_CACHE_H_DEF
+
+#include <cstdint>
+#include <string>
+#include <glad/glad.h>
+
+class ProgramCache
+{
+public:
+  // needs a current context; the cache stays disabled if the driver has
+  // no binary formats
+  void open(const std::string& directory);
+  bool isEnabled() const { return enabled; }
+
+  // feedbackVarying is NULL for a program without transform feedback
+  uint64_t key(const std::string& vertexSource, const std::string& fragmentSource,
+               const char* feedbackVarying = NULL, GLenum feedbackBufferMode = GL_INTERLEAVED_ATTRIBS) const;
+  GLuint load(uint64_t key);              // linked program, 0 on a miss
+  void store(uint64_t key, GLuint program);
+
+  int hits() const   { return hitCount; }
+  int misses() const { return missCount; }
+
+private:
+  std::string path(uint64_t key) const;
+
+  std::string directory;
+  std::string fingerprint; // renderer and version
+  bool enabled = false;
+  int hitCount = 0, missCount = 0;
+};
+
+// 64-bit FNV-1a, chainable through hash
+uint64_t fnv1a(const void* data, size_t size, uint64_t hash = 14695981039346656037ull);
+
+#endif
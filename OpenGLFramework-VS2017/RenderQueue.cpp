@@ -0,0 +1,56 @@
+///////////////////////////////////////////////////////////////////////////////
+// RenderQueue.cpp
+// ===============
+// Sortable draw list
+///////////////////////////////////////////////////////////////////////////////
+
+#include "RenderQueue.h"
+
+uint64_t makeDrawKey(unsigned program, unsigned texture, unsigned vao, float depth01)
+{
+  if (depth01 < 0.f) depth01 = 0.f;
+  if (depth01 > 1.f) depth01 = 1.f;
+  uint64_t depth = (uint64_t)(depth01 * 65535.f);
+  return ((uint64_t)(program & 0xFF) << 56) |
+         ((uint64_t)(texture & 0xFFFFF) << 36) |
+         ((uint64_t)(vao & 0xFFFFF) << 16) |
+         depth;
+}
+
+void radixSortDrawItems(std::vector<DrawItem>& items, std::vector<DrawItem>& scratch)
+{
+  const size_t count = items.size();
+  if (count < 2) return;
+  scratch.resize(count);
+
+  // one histogram per byte, built in a single pass over the keys
+  size_t histogram[8][256] = {};
+  for (size_t i = 0; i < count; i++) {
+    uint64_t key = items[i].key;
+    for (int b = 0; b < 8; b++) {
+      histogram[b][(key >> (b * 8)) & 0xFF]++;
+    }
+  }
+
+  DrawItem* src = items.data();
+  DrawItem* dst = scratch.data();
+  for (int b = 0; b < 8; b++) {
+    size_t* bucket = histogram[b];
+    // all keys share this byte, nothing to reorder
+    if (bucket[(src[0].key >> (b * 8)) & 0xFF] == count) continue;
+
+    size_t offset = 0;
+    for (int d = 0; d < 256; d++) {
+      size_t n = bucket[d];
+      bucket[d] = offset;
+      offset += n;
+    }
+    for (size_t i = 0; i < count; i++) {
+      dst[bucket[(src[i].key >> (b * 8)) & 0xFF]++] = src[i];
+    }
+    DrawItem* tmp = src; src = dst; dst = tmp;
+  }
+
+  // an odd number of scatter passes leaves the result in scratch
+  if (src != items.data()) items.swap(scratch);
+}
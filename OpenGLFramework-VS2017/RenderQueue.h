@@ -0,0 +1,37 @@
+///////////////////////////////////////////////////////////////////////////////
+// RenderQueue.h
+// =============
+// Sortable draw list
+//
+// Every draw is described by a 64-bit key. Most significant first:
+// | program (8) | texture (20) | vao (20) | depth (16) |
+// so sorting the keys groups draws by program, then texture, then vertex
+// array, and finally orders them front to back inside each group.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef RENDER_QUEUE_H_DEF
+#define RENDER_QUEUE_H_DEF
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct DrawItem
+{
+  uint64_t key;
+  int modelIndex;
+  int shapeIndex;
+};
+
+// depth01 is the normalized view distance in [0, 1], 0 being the near plane
+uint64_t makeDrawKey(unsigned program, unsigned texture, unsigned vao, float depth01);
+
+inline unsigned drawKeyProgram(uint64_t key) { return (unsigned)(key >> 56); }
+inline unsigned drawKeyTexture(uint64_t key) { return (unsigned)(key >> 36) & 0xFFFFF; }
+inline unsigned drawKeyVAO(uint64_t key)     { return (unsigned)(key >> 16) & 0xFFFFF; }
+
+// LSD radix sort on the keys, 8 bits per pass. Passes whose byte is the same
+// for every key are skipped. scratch is resized as needed and reused.
+void radixSortDrawItems(std::vector<DrawItem>& items, std::vector<DrawItem>& scratch);
+
+#endif
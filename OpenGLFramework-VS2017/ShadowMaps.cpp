@@ -0,0 +1,199 @@
+///////////////////////////////////////////////////////////////////////////////
+// ShadowMaps.cpp
+// ==============
+// Shadow maps for the directional and spot lights
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cmath>
+#include "ShadowMaps.h"
+#include "Transform.h"
+#include "Offscreen.h"
+
+// blend of logarithmic (1) and uniform (0) cascade splits
+const float CASCADE_SPLIT_LAMBDA = 0.75f;
+// the first split never starts closer than this, whatever the near plane
+const float CASCADE_MIN_NEAR = 0.05f;
+// how far behind a cascade, towards the light, casters are still rendered
+const float CASTER_DISTANCE = 10.f;
+const float SPOT_SHADOW_NEAR = 0.05f;
+
+// clip space [-1, 1] -> texture space [0, 1]
+static Matrix4 textureBias()
+{
+  return Matrix4(0.5f, 0.f,  0.f,  0.5f,
+                 0.f,  0.5f, 0.f,  0.5f,
+                 0.f,  0.f,  0.5f, 0.5f,
+                 0.f,  0.f,  0.f,  1.f);
+}
+
+// rows are right, up and back, as in setViewingMatrix()
+static Matrix4 lightRotation(const Vector3& direction)
+{
+  Vector3 forward = direction;
+  forward.normalize();
+  Vector3 up = fabsf(forward.y) > 0.99f ? Vector3(1.f, 0.f, 0.f) : Vector3(0.f, 1.f, 0.f);
+  Vector3 right = forward.cross(up).normalize();
+  up = right.cross(forward);
+  return Matrix4(right.x,    right.y,    right.z,    0.f,
+                 up.x,       up.y,       up.z,       0.f,
+                 -forward.x, -forward.y, -forward.z, 0.f,
+                 0.f,        0.f,        0.f,        1.f);
+}
+
+void ShadowMaps::setResolution(int s)
+{
+  size = s;
+}
+
+void ShadowMaps::setupDirectional(const Vector3& direction, int cascades, const Matrix4& view,
+                                  float xScale, float yScale, float nearClip, float shadowDistance)
+{
+  passes = cascades < 1 ? 1 : (cascades > MAX_SHADOW_CASCADES ? MAX_SHADOW_CASCADES : cascades);
+  Matrix4 cameraToWorld = view;
+  invertTransform(cameraToWorld, TransformEuclidean);
+  Matrix4 rotation = lightRotation(direction);
+  float splitNear = nearClip > CASCADE_MIN_NEAR ? nearClip : CASCADE_MIN_NEAR;
+
+  float cascadeNear = nearClip;
+  for (int c = 0; c < passes; c++) {
+    float t = (float)(c + 1) / passes;
+    float logSplit = splitNear * powf(shadowDistance / splitNear, t);
+    float uniformSplit = splitNear + (shadowDistance - splitNear) * t;
+    float cascadeFar = CASCADE_SPLIT_LAMBDA * logSplit + (1.f - CASCADE_SPLIT_LAMBDA) * uniformSplit;
+    splits[c] = cascadeFar;
+
+    // bounding sphere of the slice's eight corners, in world space
+    Vector3 corners[8];
+    Vector3 center(0.f, 0.f, 0.f);
+    for (int i = 0; i < 8; i++) {
+      float depth = (i & 4) ? cascadeFar : cascadeNear;
+      float x = ((i & 1) ? 1.f : -1.f) * depth / xScale;
+      float y = ((i & 2) ? 1.f : -1.f) * depth / yScale;
+      Vector4 world = cameraToWorld * Vector4(x, y, -depth, 1.f);
+      corners[i] = Vector3(world.x, world.y, world.z);
+      center += corners[i];
+    }
+    center /= 8.f;
+    float radius = 0.f;
+    for (int i = 0; i < 8; i++) {
+      float distance = (corners[i] - center).length();
+      if (distance > radius) radius = distance;
+    }
+    radius = ceilf(radius * 16.f) / 16.f; // fewer distinct sizes as the slice moves
+
+    // snap the center, in light space, to whole texels
+    float texel = 2.f * radius / size;
+    Vector4 lightCenter = rotation * Vector4(center.x, center.y, center.z, 1.f);
+    lightCenter.x = floorf(lightCenter.x / texel) * texel;
+    lightCenter.y = floorf(lightCenter.y / texel) * texel;
+    Matrix4 lightView = Matrix4(1.f, 0.f, 0.f, -lightCenter.x,
+                                0.f, 1.f, 0.f, -lightCenter.y,
+                                0.f, 0.f, 1.f, -lightCenter.z,
+                                0.f, 0.f, 0.f, 1.f) * rotation;
+
+    // orthographic, depth from radius behind the center to the casters in front
+    float zNear = -(radius + CASTER_DISTANCE), zFar = radius;
+    Matrix4 ortho(1.f / radius, 0.f,          0.f,                   0.f,
+                  0.f,          1.f / radius, 0.f,                   0.f,
+                  0.f,          0.f,          -2.f / (zFar - zNear), -(zFar + zNear) / (zFar - zNear),
+                  0.f,          0.f,          0.f,                   1.f);
+    lightMatrices[c] = ortho * lightView;
+    shadowMatrices[c] = textureBias() * lightMatrices[c];
+    cascadeNear = cascadeFar;
+  }
+}
+
+void ShadowMaps::setupSpot(const Vector3& position, const Vector3& direction, float cutOffDegree, float farClip)
+{
+  passes = 1;
+  splits[0] = 1e30f;
+  Matrix4 lightView = lightRotation(direction) * Matrix4(1.f, 0.f, 0.f, -position.x,
+                                                         0.f, 1.f, 0.f, -position.y,
+                                                         0.f, 0.f, 1.f, -position.z,
+                                                         0.f, 0.f, 0.f, 1.f);
+  // the cone plus a little margin for the filter footprint
+  float halfAngle = (cutOffDegree + 2.f) / 180.f * 3.14159265f;
+  if (halfAngle > 1.5f) halfAngle = 1.5f;
+  float f = 1.f / tanf(halfAngle);
+  float n = SPOT_SHADOW_NEAR;
+  Matrix4 perspective(f,   0.f, 0.f,                     0.f,
+                      0.f, f,   0.f,                     0.f,
+                      0.f, 0.f, (farClip + n) / (n - farClip), 2.f * farClip * n / (n - farClip),
+                      0.f, 0.f, -1.f,                    0.f);
+  lightMatrices[0] = perspective * lightView;
+  shadowMatrices[0] = textureBias() * lightMatrices[0];
+}
+
+void ShadowMaps::allocate()
+{
+  if (!texture) {
+    glGenTextures(1, &texture);
+    glGenFramebuffers(1, &fbo);
+    glGenQueries(2 * MAX_SHADOW_CASCADES, &queries[0][0]);
+  }
+  glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+  glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, size, size, MAX_SHADOW_CASCADES, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+  // linear filtering on a comparison texture is the hardware 2x2 PCF
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+  allocatedSize = size;
+}
+
+void ShadowMaps::collectTimings()
+{
+  // the other set was issued a frame ago
+  int previous = frame ^ 1;
+  for (int i = 0; i < MAX_SHADOW_CASCADES; i++) {
+    if (!isQueryIssued[previous][i]) continue;
+    GLuint available = 0;
+    glGetQueryObjectuiv(queries[previous][i], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) continue;
+    GLuint64 nanoseconds = 0;
+    glGetQueryObjectui64v(queries[previous][i], GL_QUERY_RESULT, &nanoseconds);
+    gpuMs[i] = nanoseconds / 1e6f;
+    isQueryIssued[previous][i] = false;
+  }
+}
+
+void ShadowMaps::beginPass(int pass)
+{
+  if (pass == 0) {
+    if (allocatedSize != size) allocate();
+    collectTimings();
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+  }
+  glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0, pass);
+  glViewport(0, 0, size, size);
+  glClear(GL_DEPTH_BUFFER_BIT);
+  if (!isQueryIssued[frame][pass]) {
+    glBeginQuery(GL_TIME_ELAPSED, queries[frame][pass]);
+  }
+}
+
+void ShadowMaps::endPass(int pass)
+{
+  if (!isQueryIssued[frame][pass]) {
+    glEndQuery(GL_TIME_ELAPSED);
+    isQueryIssued[frame][pass] = true;
+  }
+}
+
+void ShadowMaps::finishFrame()
+{
+  glBindFramebuffer(GL_FRAMEBUFFER, screenFramebuffer());
+  frame ^= 1;
+}
+
+void ShadowMaps::bindTexture(int unit) const
+{
+  glActiveTexture(GL_TEXTURE0 + unit);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+  glActiveTexture(GL_TEXTURE0);
+}
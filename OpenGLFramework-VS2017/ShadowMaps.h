@@ -0,0 +1,69 @@
+///////////////////////////////////////////////////////////////////////////////
+// ShadowMaps.h
+// ============
+// Shadow maps for the directional and spot lights
+//
+// Directional lights get up to MAX_SHADOW_CASCADES cascades splitting the
+// view depth range. Each cascade bounds its slice of the view frustum with a
+// sphere, so its size does not change as the camera turns, and its origin
+// is snapped to whole shadow texels, so the map does not shimmer as the
+// camera moves. Spot lights use a single perspective map covering the cone.
+//
+// Every map is a layer of one depth texture array sampled with hardware PCF
+// (sampler2DArrayShadow). Each pass is timed with a GL_TIME_ELAPSED query,
+// read back one frame later so it never stalls.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef SHADOW_MAPS_H_DEF
+#define SHADOW_MAPS_H_DEF
+
+#include <glad/glad.h>
+#include "Vectors.h"
+#include "Matrices.h"
+
+const int MAX_SHADOW_CASCADES = 4;
+
+class ShadowMaps
+{
+public:
+  void setResolution(int size);       // texels per side, reallocated on the next pass
+  int resolution() const { return size; }
+
+  // view is the camera's, rotation and translation only; xScale and yScale
+  // are project[0] and project[5]. cascades cover the view depth range
+  // [nearClip, shadowDistance]
+  void setupDirectional(const Vector3& direction, int cascades, const Matrix4& view,
+                        float xScale, float yScale, float nearClip, float shadowDistance);
+  void setupSpot(const Vector3& position, const Vector3& direction, float cutOffDegree, float farClip);
+
+  int passCount() const { return passes; }
+  const Matrix4& lightMatrix(int pass) const { return lightMatrices[pass]; }   // world -> clip
+  const Matrix4& shadowMatrix(int pass) const { return shadowMatrices[pass]; } // world -> [0, 1] texture
+  float splitDepth(int pass) const { return splits[pass]; }                    // far view depth of a cascade
+
+  void beginPass(int pass);           // render target, viewport, clear and timer
+  void endPass(int pass);
+  void finishFrame();                 // back to screenFramebuffer()
+  void bindTexture(int unit) const;
+  float passMs(int pass) const { return gpuMs[pass]; } // of an earlier frame
+
+private:
+  void allocate();
+  void collectTimings();
+
+  int size = 2048;
+  int allocatedSize = 0;
+  int passes = 0;
+  Matrix4 lightMatrices[MAX_SHADOW_CASCADES];
+  Matrix4 shadowMatrices[MAX_SHADOW_CASCADES];
+  float splits[MAX_SHADOW_CASCADES] = {};
+
+  GLuint texture = 0;
+  GLuint fbo = 0;
+  GLuint queries[2][MAX_SHADOW_CASCADES] = {};
+  bool isQueryIssued[2][MAX_SHADOW_CASCADES] = {};
+  int frame = 0;
+  float gpuMs[MAX_SHADOW_CASCADES] = {};
+};
+
+#endif
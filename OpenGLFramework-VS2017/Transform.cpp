@@ -0,0 +1,94 @@
+///////////////////////////////////////////////////////////////////////////////
+// Transform.cpp
+// =============
+// Translation, rotation and scale kept as separate parts, composed as
+// T * R * S
+///////////////////////////////////////////////////////////////////////////////
+
+#include <cmath>
+#include "Transform.h"
+
+// 1 / s, with a collapsed axis left collapsed instead of infinite
+static float reciprocal(float s)
+{
+  return s != 0.f ? 1.f / s : 0.f;
+}
+
+Matrix4& invertTransform(Matrix4& m, TransformKind kind)
+{
+  switch (kind) {
+  case TransformIdentity:  return m;
+  case TransformEuclidean: return m.invertEuclidean();
+  case TransformAffine:    return m.invertAffine();
+  default:                 return m.invertGeneral();
+  }
+}
+
+Matrix4 lookAtMatrix(const Vector3& eye, const Vector3& center, const Vector3& up)
+{
+  // exact normalize: the basis is built once per camera change and every
+  // vertex goes through it
+  Vector3 forward = center - eye;
+  forward.normalize();
+  Vector3 right = forward.cross(up).normalize();
+  Vector3 newUp = right.cross(forward);
+  // rotation rows right, up, -forward, times the translation by -eye
+  return Matrix4(right.x,    right.y,    right.z,    -right.dot(eye),
+                 newUp.x,    newUp.y,    newUp.z,    -newUp.dot(eye),
+                 -forward.x, -forward.y, -forward.z, forward.dot(eye),
+                 0.f,        0.f,        0.f,        1.f);
+}
+
+Matrix4 perspectiveMatrix(float fovyDegree, float aspect, float nearClip, float farClip)
+{
+  float radian = fovyDegree * 3.14159265f / 180.f;
+  float angle = cosf(radian / 2.f) / sinf(radian / 2.f);
+  float firstDiag  = aspect >= 1.f ? angle / aspect : angle;
+  float secondDiag = aspect >= 1.f ? angle          : angle * aspect;
+  return Matrix4(firstDiag, 0.f,        0.f,                                          0.f,
+                 0.f,       secondDiag, 0.f,                                          0.f,
+                 0.f,       0.f,        (farClip + nearClip) / (nearClip - farClip),  2.f * farClip * nearClip / (nearClip - farClip),
+                 0.f,       0.f,        -1.f,                                         0.f);
+}
+
+Matrix4 Transform::matrix() const
+{
+  // column j of R scaled by scale[j], translation in the last column
+  Matrix3 r = toMatrix3(rotation);
+  return Matrix4(r[0] * scale.x, r[1] * scale.y, r[2] * scale.z, translation.x,
+                 r[3] * scale.x, r[4] * scale.y, r[5] * scale.z, translation.y,
+                 r[6] * scale.x, r[7] * scale.y, r[8] * scale.z, translation.z,
+                 0.f,            0.f,            0.f,            1.f);
+}
+
+Matrix4 Transform::inverseMatrix() const
+{
+  // row i of R^T, i.e. column i of R, divided by scale[i]
+  Matrix3 r = toMatrix3(rotation);
+  float ix = reciprocal(scale.x), iy = reciprocal(scale.y), iz = reciprocal(scale.z);
+  Vector3 row0(r[0] * ix, r[3] * ix, r[6] * ix);
+  Vector3 row1(r[1] * iy, r[4] * iy, r[7] * iy);
+  Vector3 row2(r[2] * iz, r[5] * iz, r[8] * iz);
+  return Matrix4(row0.x, row0.y, row0.z, -row0.dot(translation),
+                 row1.x, row1.y, row1.z, -row1.dot(translation),
+                 row2.x, row2.y, row2.z, -row2.dot(translation),
+                 0.f,    0.f,    0.f,    1.f);
+}
+
+Matrix4 Transform::normalMatrix() const
+{
+  Matrix3 r = toMatrix3(rotation);
+  float ix = reciprocal(scale.x), iy = reciprocal(scale.y), iz = reciprocal(scale.z);
+  return Matrix4(r[0] * ix, r[1] * iy, r[2] * iz, 0.f,
+                 r[3] * ix, r[4] * iy, r[5] * iz, 0.f,
+                 r[6] * ix, r[7] * iy, r[8] * iz, 0.f,
+                 0.f,       0.f,       0.f,       1.f);
+}
+
+Transform Transform::operator*(const Transform& child) const
+{
+  // T R S T' R' S' = T (R S t') R R' S S' when S commutes with R'
+  Vector3 scaled(scale.x * child.translation.x, scale.y * child.translation.y, scale.z * child.translation.z);
+  Vector3 scaleProduct(scale.x * child.scale.x, scale.y * child.scale.y, scale.z * child.scale.z);
+  return Transform(translation + rotation.rotate(scaled), rotation * child.rotation, scaleProduct);
+}
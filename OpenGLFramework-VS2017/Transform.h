@@ -0,0 +1,64 @@
+///////////////////////////////////////////////////////////////////////////////
+// Transform.h
+// ===========
+// Translation, rotation and scale kept as separate parts, composed as
+// T * R * S
+//
+// The parts are written straight into the matrix instead of being multiplied
+// out, and the inverse and the normal matrix come from them as well:
+// (T R S)^-1 = S^-1 R^T T^-1, and the inverse transpose of R S is R S^-1, so
+// no general 4x4 inverse is needed for a model.
+//
+// For matrices built some other way, such as the viewing matrix, the caller
+// states their TransformKind and invertTransform() picks the cheapest
+// Matrix4 inverse for it.
+//
+// lookAtMatrix() and perspectiveMatrix() build the camera matrices.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef TRANSFORM_H_DEF
+#define TRANSFORM_H_DEF
+
+#include "Vectors.h"
+#include "Matrices.h"
+
+enum TransformKind
+{
+  TransformIdentity = 0,
+  TransformEuclidean,   // rotation and translation only, lengths and angles kept
+  TransformAffine,      // with scale or shear, last row still (0, 0, 0, 1)
+  TransformGeneral      // projective
+};
+
+// inverts m in place with invertEuclidean(), invertAffine() or
+// invertGeneral(), as its kind allows
+Matrix4& invertTransform(Matrix4& m, TransformKind kind);
+
+// world -> view for a camera at eye looking at center, as gluLookAt. The
+// result is TransformEuclidean.
+Matrix4 lookAtMatrix(const Vector3& eye, const Vector3& center, const Vector3& up);
+
+// view -> clip. fovyDegree spans the shorter side of the viewport: the
+// height when aspect (width / height) >= 1, the width otherwise.
+Matrix4 perspectiveMatrix(float fovyDegree, float aspect, float nearClip, float farClip);
+
+struct Transform
+{
+  Vector3 translation = Vector3(0.f, 0.f, 0.f);
+  Quaternion rotation;                        // unit length
+  Vector3 scale = Vector3(1.f, 1.f, 1.f);
+
+  Transform() {}
+  Transform(const Vector3& translation, const Quaternion& rotation, const Vector3& scale)
+    : translation(translation), rotation(rotation), scale(scale) {}
+
+  Matrix4 matrix() const;                     // T * R * S
+  Matrix4 inverseMatrix() const;              // S^-1 * R^T * T^-1
+  Matrix4 normalMatrix() const;               // R * S^-1 in the upper 3x3, for mat3(normalTransform)
+
+  // this * child, as one transform. Exact when this scale is uniform or the
+  // child has no rotation; otherwise the shear of the product is dropped.
+  Transform operator*(const Transform& child) const;
+};
+
+#endif
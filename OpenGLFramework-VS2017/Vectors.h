@@ -1,7 +1,7 @@
 ///////////////////////////////////////////////////////////////////////////////
 // Vectors.h
 // =========
-// 2D/3D/4D vectors
+// 2D/3D/4D vectors and quaternion
 //
 //  AUTHOR: Song Ho Ahn (song.ahn@gmail.com)
 // CREATED: 2007-02-14
@@ -15,8 +15,24 @@
 #define VECTORS_H_DEF
 
 #include <cmath>
+#include <cstring>
 #include <iostream>
 
+// Matrix4 products, transposes and the general inverse, and the Quaternion
+// product, are vectorized at compile time: AVX (two rows per instruction)
+// when __AVX__ is defined, SSE on any x86-64 target, the scalar code
+// otherwise. Define MATH_NO_SIMD to force the scalar code.
+#if !defined(MATH_NO_SIMD)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MATH_USE_SSE
+#include <emmintrin.h>
+#endif
+#if defined(MATH_USE_SSE) && defined(__AVX__)
+#define MATH_USE_AVX
+#include <immintrin.h>
+#endif
+#endif
+
 ///////////////////////////////////////////////////////////////////////////////
 // 2D vector
 ///////////////////////////////////////////////////////////////////////////////
@@ -33,7 +49,8 @@ struct Vector2
     void        set(float x, float y);
     float       length() const;                         //
     float       distance(const Vector2& vec) const;     // distance between two vectors
-    Vector2&    normalize();                            //
+    Vector2&    normalize();                            // exact: sqrtf and divide
+    Vector2&    normalizeFast();                        // invSqrtFast(), zero vector left as is
     float       dot(const Vector2& vec) const;          // dot product
     bool        equal(const Vector2& vec, float e) const; // compare with epsilon
 
@@ -78,7 +95,8 @@ struct Vector3
     void        set(float x, float y, float z);
     float       length() const;                         //
     float       distance(const Vector3& vec) const;     // distance between two vectors
-    Vector3&    normalize();                            //
+    Vector3&    normalize();                            // exact: sqrtf and divide
+    Vector3&    normalizeFast();                        // invSqrtFast(), zero vector left as is
     float       dot(const Vector3& vec) const;          // dot product
     Vector3     cross(const Vector3& vec) const;        // cross product
     bool        equal(const Vector3& vec, float e) const; // compare with epsilon
@@ -153,17 +171,80 @@ struct Vector4
 
 
 
+///////////////////////////////////////////////////////////////////////////////
+// quaternion, (x, y, z) the vector part and w the scalar part
+// A unit quaternion is a rotation; q * p rotates by p first, then by q.
+///////////////////////////////////////////////////////////////////////////////
+struct Quaternion
+{
+    float x;
+    float y;
+    float z;
+    float w;
+
+    // ctors
+    Quaternion() : x(0), y(0), z(0), w(1) {};           // identity
+    Quaternion(float x, float y, float z, float w) : x(x), y(y), z(z), w(w) {};
+    Quaternion(const Vector3& axis, float angle);       // about a unit axis, angle in radians
+
+    // utils functions
+    void        set(float x, float y, float z, float w);
+    float       length() const;                         //
+    Quaternion& normalize();                            //
+    float       dot(const Quaternion& rhs) const;       // dot product
+    Quaternion  conjugate() const;                      // inverse of a unit quaternion
+    Vector3     rotate(const Vector3& vec) const;       // q * vec * q^-1, for a unit quaternion
+    bool        equal(const Quaternion& q, float e) const; // compare with epsilon
+
+    // operators
+    Quaternion  operator-() const;                      // unary operator (negate)
+    Quaternion  operator+(const Quaternion& rhs) const; // add rhs
+    Quaternion  operator*(const float scale) const;     // scale
+    Quaternion  operator*(const Quaternion& rhs) const; // Hamilton product, rhs applied first
+    Quaternion& operator*=(const Quaternion& rhs);      // multiply rhs and update this object
+    bool        operator==(const Quaternion& rhs) const;// exact compare, no epsilon
+    bool        operator!=(const Quaternion& rhs) const;// exact compare, no epsilon
+    float       operator[](int index) const;            // subscript operator q[0], q[1]
+    float&      operator[](int index);                  // subscript operator q[0], q[1]
+
+    friend std::ostream& operator<<(std::ostream& os, const Quaternion& q);
+};
+
+// interpolation from a (t = 0) to b (t = 1) along the shorter arc.
+// nlerp is a normalized straight blend, cheap but not constant speed; slerp
+// keeps the angular speed constant.
+Quaternion nlerp(const Quaternion& a, const Quaternion& b, float t);
+Quaternion slerp(const Quaternion& a, const Quaternion& b, float t);
+
+
+
 // fast math routines from Doom3 SDK
 inline float invSqrt(float x)
 {
     float xhalf = 0.5f * x;
-    int i = *(int*)&x;          // get bits for floating value
+    int i;
+    memcpy(&i, &x, sizeof(i));  // get bits for floating value
     i = 0x5f3759df - (i>>1);    // gives initial guess
-    x = *(float*)&i;            // convert bits back to float
+    memcpy(&x, &i, sizeof(x));  // convert bits back to float
     x = x * (1.5f - xhalf*x*x); // Newton step
     return x;
 }
 
+// 1 / sqrt(x) for x > 0, within about 3e-7 relative: the 12 bit hardware
+// estimate refined by one Newton step, or invSqrt() refined by a second one
+// (within about 5e-6) without SSE. Good enough for normals and directions
+// that end up in shading; use sqrtf where a result is accumulated or must be
+// reproducible.
+inline float invSqrtFast(float x)
+{
+#if defined(MATH_USE_SSE)
+    float y = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(x)));
+#else
+    float y = invSqrt(x);
+#endif
+    return y * (1.5f - 0.5f*x*y*y);     // Newton step
+}
+
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -262,6 +343,17 @@ inline Vector2& Vector2::normalize() {
     return *this;
 }
 
+inline Vector2& Vector2::normalizeFast() {
+    float xxyy = x*x + y*y;
+    if(xxyy <= 0.0f)
+        return *this;
+
+    float invLength = invSqrtFast(xxyy);
+    x *= invLength;
+    y *= invLength;
+    return *this;
+}
+
 inline float Vector2::dot(const Vector2& rhs) const {
     return (x*rhs.x + y*rhs.y);
 }
@@ -382,6 +474,18 @@ inline Vector3& Vector3::normalize() {
     return *this;
 }
 
+inline Vector3& Vector3::normalizeFast() {
+    float xxyyzz = x*x + y*y + z*z;
+    if(xxyyzz <= 0.0f)
+        return *this;
+
+    float invLength = invSqrtFast(xxyyzz);
+    x *= invLength;
+    y *= invLength;
+    z *= invLength;
+    return *this;
+}
+
 inline float Vector3::dot(const Vector3& rhs) const {
     return (x*rhs.x + y*rhs.y + z*rhs.z);
 }
@@ -527,4 +631,137 @@ inline std::ostream& operator<<(std::ostream& os, const Vector4& vec) {
 }
 // END OF VECTOR4 /////////////////////////////////////////////////////////////
 
+
+
+///////////////////////////////////////////////////////////////////////////////
+// inline functions for Quaternion
+///////////////////////////////////////////////////////////////////////////////
+inline Quaternion::Quaternion(const Vector3& axis, float angle) {
+    float s = sinf(angle * 0.5f);
+    x = axis.x * s; y = axis.y * s; z = axis.z * s; w = cosf(angle * 0.5f);
+}
+
+inline Quaternion Quaternion::operator-() const {
+    return Quaternion(-x, -y, -z, -w);
+}
+
+inline Quaternion Quaternion::operator+(const Quaternion& rhs) const {
+    return Quaternion(x+rhs.x, y+rhs.y, z+rhs.z, w+rhs.w);
+}
+
+inline Quaternion Quaternion::operator*(const float a) const {
+    return Quaternion(x*a, y*a, z*a, w*a);
+}
+
+inline Quaternion Quaternion::operator*(const Quaternion& rhs) const {
+#if defined(MATH_USE_SSE)
+    // each component of this scales a permutation of rhs with fixed signs:
+    // r = w*(x y z w) + x*(w -z y -x) + y*(z w -x -y) + z*(-y x w -z)
+    __m128 b = _mm_loadu_ps(&rhs.x);
+    __m128 r = _mm_mul_ps(_mm_set1_ps(w), b);
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(x), _mm_setr_ps(1.f, -1.f, 1.f, -1.f)),
+                                 _mm_shuffle_ps(b, b, _MM_SHUFFLE(0, 1, 2, 3))));
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(y), _mm_setr_ps(1.f, 1.f, -1.f, -1.f)),
+                                 _mm_shuffle_ps(b, b, _MM_SHUFFLE(1, 0, 3, 2))));
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(z), _mm_setr_ps(-1.f, 1.f, 1.f, -1.f)),
+                                 _mm_shuffle_ps(b, b, _MM_SHUFFLE(2, 3, 0, 1))));
+    Quaternion q;
+    _mm_storeu_ps(&q.x, r);
+    return q;
+#else
+    return Quaternion(w*rhs.x + x*rhs.w + y*rhs.z - z*rhs.y,
+                      w*rhs.y - x*rhs.z + y*rhs.w + z*rhs.x,
+                      w*rhs.z + x*rhs.y - y*rhs.x + z*rhs.w,
+                      w*rhs.w - x*rhs.x - y*rhs.y - z*rhs.z);
+#endif
+}
+
+inline Quaternion& Quaternion::operator*=(const Quaternion& rhs) {
+    *this = *this * rhs; return *this;
+}
+
+inline bool Quaternion::operator==(const Quaternion& rhs) const {
+    return (x == rhs.x) && (y == rhs.y) && (z == rhs.z) && (w == rhs.w);
+}
+
+inline bool Quaternion::operator!=(const Quaternion& rhs) const {
+    return (x != rhs.x) || (y != rhs.y) || (z != rhs.z) || (w != rhs.w);
+}
+
+inline float Quaternion::operator[](int index) const {
+    return (&x)[index];
+}
+
+inline float& Quaternion::operator[](int index) {
+    return (&x)[index];
+}
+
+inline void Quaternion::set(float x, float y, float z, float w) {
+    this->x = x; this->y = y; this->z = z; this->w = w;
+}
+
+inline float Quaternion::length() const {
+    return sqrtf(x*x + y*y + z*z + w*w);
+}
+
+inline Quaternion& Quaternion::normalize() {
+    float xxyyzzww = x*x + y*y + z*z + w*w;
+    if(xxyyzzww == 0.0f)
+        return *this;   // leave a zero quaternion alone
+
+    float invLength = 1.0f / sqrtf(xxyyzzww);
+    x *= invLength;
+    y *= invLength;
+    z *= invLength;
+    w *= invLength;
+    return *this;
+}
+
+inline float Quaternion::dot(const Quaternion& rhs) const {
+    return (x*rhs.x + y*rhs.y + z*rhs.z + w*rhs.w);
+}
+
+inline Quaternion Quaternion::conjugate() const {
+    return Quaternion(-x, -y, -z, w);
+}
+
+inline Vector3 Quaternion::rotate(const Vector3& vec) const {
+    // v + w*t + u x t with t = 2 u x v, u the vector part
+    Vector3 u(x, y, z);
+    Vector3 t = u.cross(vec) * 2.0f;
+    return vec + t * w + u.cross(t);
+}
+
+inline bool Quaternion::equal(const Quaternion& rhs, float epsilon) const {
+    return fabs(x - rhs.x) < epsilon && fabs(y - rhs.y) < epsilon &&
+           fabs(z - rhs.z) < epsilon && fabs(w - rhs.w) < epsilon;
+}
+
+inline std::ostream& operator<<(std::ostream& os, const Quaternion& q) {
+    os << "(" << q.x << ", " << q.y << ", " << q.z << ", " << q.w << ")";
+    return os;
+}
+
+inline Quaternion nlerp(const Quaternion& a, const Quaternion& b, float t) {
+    // q and -q are the same rotation; blend towards the one on a's side
+    float tb = a.dot(b) < 0.0f ? -t : t;
+    Quaternion q = a * (1.0f - t) + b * tb;
+    return q.normalize();
+}
+
+inline Quaternion slerp(const Quaternion& a, const Quaternion& b, float t) {
+    float cosTheta = a.dot(b);
+    float sign = 1.0f;
+    if(cosTheta < 0.0f) {
+        cosTheta = -cosTheta; sign = -1.0f;
+    }
+    if(cosTheta > 0.9995f)
+        return nlerp(a, b, t);  // nearly parallel, sin(theta) too small to divide by
+
+    float theta = acosf(cosTheta);
+    float invSin = 1.0f / sinf(theta);
+    return a * (sinf((1.0f - t) * theta) * invSin) + b * (sign * sinf(t * theta) * invSin);
+}
+// END OF QUATERNION //////////////////////////////////////////////////////////
+
 #endif
@@ -0,0 +1,8 @@
+#version 330 core
+
+// only used for occlusion queries, color and depth writes are masked off
+out vec4 FragColor;
+
+void main() {
+  FragColor = vec4(1.f);
+}
@@ -0,0 +1,12 @@
+#version 330 core
+
+uniform mat4 mvp;
+uniform vec3 boxCenter;
+uniform vec3 boxExtent;
+
+layout (location = 0) in vec3 aPos; // unit cube corner in [-1, 1]
+
+void main()
+{
+  gl_Position = mvp * vec4(boxCenter + aPos * boxExtent, 1.f);
+}
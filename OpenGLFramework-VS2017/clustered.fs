@@ -0,0 +1,89 @@
+#version 330 core
+
+// LIGHT_MODE, HAS_TEXTURE, HAS_EYE_OFFSET, HAS_SHADOW and HAS_NORMAL_MAP are defined by setShaders()
+
+uniform vec3 viewPos;
+uniform Light light;
+uniform Material material;
+#if HAS_EYE_OFFSET
+uniform vec2 eyeOffset;
+#endif
+#if HAS_TEXTURE
+uniform sampler2D sampleTexture;
+#endif
+
+// see LightClusters.h for the layouts
+uniform samplerBuffer clusterLights;
+uniform usamplerBuffer clusterGrid;
+uniform usamplerBuffer clusterIndices;
+uniform vec4 clusterViewport;   // x, y, width, height in window pixels
+uniform ivec3 clusterDims;
+uniform vec2 clusterSlice;      // slice = log(depth) * x + y
+
+in vec3 interpolatePos;
+in vec3 interpolateColor;
+in vec3 interpolateNormal;
+in vec2 interpolateTexCoord;
+
+out vec4 FragColor;
+
+#if HAS_NORMAL_MAP
+uniform sampler2D normalTexture;
+in vec4 interpolateTangent;
+#endif
+
+int clusterIndex() {
+  vec2 tile = (gl_FragCoord.xy - clusterViewport.xy) / clusterViewport.zw * vec2(clusterDims.xy);
+  float depth = 1.f / gl_FragCoord.w; // view depth for a perspective projection
+  int slice = int(max(log(depth) * clusterSlice.x + clusterSlice.y, 0.f));
+  ivec3 cluster = clamp(ivec3(ivec2(tile), slice), ivec3(0), clusterDims - 1);
+  return (cluster.z * clusterDims.y + cluster.y) * clusterDims.x + cluster.x;
+}
+
+void main() {
+#if HAS_NORMAL_MAP
+  vec3 norm = mappedNormal(normalTexture, interpolateTexCoord, interpolateNormal, interpolateTangent);
+#else
+  vec3 norm = normalize(interpolateNormal);
+#endif
+  vec3 viewDir = normalize(viewPos - interpolatePos);
+#if HAS_SHADOW
+  float shadow = shadowFactor(interpolatePos);
+#else
+  float shadow = 1.f;
+#endif
+  vec3 result = keyLight(light, material, interpolatePos, norm, viewDir, shadow);
+
+  uvec2 range = texelFetch(clusterGrid, clusterIndex()).xy;
+  for (uint i = 0u; i < range.y; i++) {
+    int index = int(texelFetch(clusterIndices, int(range.x + i)).x) * 3;
+    vec4 positionRange = texelFetch(clusterLights, index);
+    vec4 colorMode     = texelFetch(clusterLights, index + 1);
+    vec3 toLight = positionRange.xyz - interpolatePos;
+    float distance = length(toLight);
+    if (distance >= positionRange.w) continue;
+    vec3 lightDir = toLight / distance;
+    // windowed inverse square, reaches zero at the light's range
+    float window = clamp(1.f - pow(distance / positionRange.w, 4.f), 0.f, 1.f);
+    float attenuation = window * window / (1.f + distance * distance);
+    if (colorMode.w == 2.f) { // spot light
+      vec4 directionCutOff = texelFetch(clusterLights, index + 2);
+      float cosineTheta = dot(-lightDir, directionCutOff.xyz);
+      attenuation *= cosineTheta > directionCutOff.w ? pow(cosineTheta, 20.f) : 0.f;
+    }
+    vec3 diffuse = max(dot(norm, lightDir), 0.f) * material.diffuse;
+    vec3 specular = pow(max(dot(viewDir, reflect(-lightDir, norm)), 0.f), light.shininess) * material.specular;
+    result += (diffuse + specular) * colorMode.rgb * attenuation;
+  }
+
+#if HAS_EYE_OFFSET
+  vec2 texCoord = interpolateTexCoord + eyeOffset;
+#else
+  vec2 texCoord = interpolateTexCoord;
+#endif
+#if HAS_TEXTURE
+  FragColor = texture(sampleTexture, texCoord) * vec4(result * interpolateColor, 1.f);
+#else
+  FragColor = vec4(result * interpolateColor, 1.f);
+#endif
+}
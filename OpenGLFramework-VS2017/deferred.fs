@@ -0,0 +1,84 @@
+#version 330 core
+
+// LIGHT_MODE is defined by setShaders()
+
+uniform vec3 viewPos;
+uniform Light light;
+
+// see GBuffer.h for the layout
+uniform sampler2D gAlbedo;
+uniform sampler2D gDiffuse;
+uniform sampler2D gSpecular;
+uniform sampler2D gNormal;
+uniform sampler2D gDepth;
+uniform mat4 inverseViewProjection;
+uniform vec2 depthRange;        // near, far
+
+// see LightClusters.h for the layouts
+uniform samplerBuffer clusterLights;
+uniform usamplerBuffer clusterGrid;
+uniform usamplerBuffer clusterIndices;
+uniform vec4 clusterViewport;   // x, y, width, height in window pixels
+uniform ivec3 clusterDims;
+uniform vec2 clusterSlice;      // slice = log(depth) * x + y
+
+out vec4 FragColor;
+
+vec3 octDecode(vec2 e) {
+  vec3 n = vec3(e, 1.f - abs(e.x) - abs(e.y));
+  if (n.z < 0.f) {
+    vec2 signs = vec2(n.x >= 0.f ? 1.f : -1.f, n.y >= 0.f ? 1.f : -1.f);
+    n.xy = (1.f - abs(n.yx)) * signs;
+  }
+  return normalize(n);
+}
+
+void main() {
+  ivec2 pixel = ivec2(gl_FragCoord.xy);
+  float depth = texelFetch(gDepth, pixel, 0).r;
+  if (depth == 1.f) discard; // background keeps the clear color
+
+  vec3 albedo = texelFetch(gAlbedo, pixel, 0).rgb;
+  vec4 diffuseAmbient = texelFetch(gDiffuse, pixel, 0);
+  vec3 materialSpecular = texelFetch(gSpecular, pixel, 0).rgb;
+  vec3 norm = octDecode(texelFetch(gNormal, pixel, 0).rg * 2.f - 1.f);
+
+  // window -> world position
+  vec2 ndc = (gl_FragCoord.xy - clusterViewport.xy) / clusterViewport.zw * 2.f - 1.f;
+  vec4 world = inverseViewProjection * vec4(ndc, depth * 2.f - 1.f, 1.f);
+  vec3 position = world.xyz / world.w;
+  vec3 viewDir = normalize(viewPos - position);
+
+  // the G-buffer keeps the ambient factor in the alpha of the diffuse color
+  Material material = Material(vec3(diffuseAmbient.a), diffuseAmbient.rgb, materialSpecular);
+  vec3 result = keyLight(light, material, position, norm, viewDir, 1.f);
+
+  // clustered lights, as in clustered.fs
+  float ndcDepth = depth * 2.f - 1.f;
+  float viewDepth = 2.f * depthRange.x * depthRange.y / (depthRange.y + depthRange.x - ndcDepth * (depthRange.y - depthRange.x));
+  vec2 tile = (gl_FragCoord.xy - clusterViewport.xy) / clusterViewport.zw * vec2(clusterDims.xy);
+  int slice = int(max(log(viewDepth) * clusterSlice.x + clusterSlice.y, 0.f));
+  ivec3 cluster = clamp(ivec3(ivec2(tile), slice), ivec3(0), clusterDims - 1);
+  uvec2 range = texelFetch(clusterGrid, (cluster.z * clusterDims.y + cluster.y) * clusterDims.x + cluster.x).xy;
+  for (uint i = 0u; i < range.y; i++) {
+    int index = int(texelFetch(clusterIndices, int(range.x + i)).x) * 3;
+    vec4 positionRange = texelFetch(clusterLights, index);
+    vec4 colorMode     = texelFetch(clusterLights, index + 1);
+    vec3 toLight = positionRange.xyz - position;
+    float distance = length(toLight);
+    if (distance >= positionRange.w) continue;
+    vec3 clusterLightDir = toLight / distance;
+    float window = clamp(1.f - pow(distance / positionRange.w, 4.f), 0.f, 1.f);
+    float attenuation = window * window / (1.f + distance * distance);
+    if (colorMode.w == 2.f) { // spot light
+      vec4 directionCutOff = texelFetch(clusterLights, index + 2);
+      float cosineTheta = dot(-clusterLightDir, directionCutOff.xyz);
+      attenuation *= cosineTheta > directionCutOff.w ? pow(cosineTheta, 20.f) : 0.f;
+    }
+    vec3 clusterDiffuse = max(dot(norm, clusterLightDir), 0.f) * diffuseAmbient.rgb;
+    vec3 clusterSpecular = pow(max(dot(viewDir, reflect(-clusterLightDir, norm)), 0.f), light.shininess) * materialSpecular;
+    result += (clusterDiffuse + clusterSpecular) * colorMode.rgb * attenuation;
+  }
+
+  FragColor = vec4(albedo * result, 1.f);
+}
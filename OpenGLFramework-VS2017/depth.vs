@@ -0,0 +1,13 @@
+#version 330 core
+
+uniform mat4 mvp;
+
+layout (location = 0) in vec3 aPos;
+
+// must match shader.vs bit for bit, the Phong pass tests depth with GL_EQUAL
+invariant gl_Position;
+
+void main()
+{
+  gl_Position = mvp * vec4(aPos, 1.f);
+}
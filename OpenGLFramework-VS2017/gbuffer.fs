@@ -0,0 +1,55 @@
+#version 330 core
+
+// HAS_TEXTURE, HAS_EYE_OFFSET and HAS_NORMAL_MAP are defined by setShaders()
+
+uniform Material material;
+#if HAS_EYE_OFFSET
+uniform vec2 eyeOffset;
+#endif
+#if HAS_TEXTURE
+uniform sampler2D sampleTexture;
+#endif
+
+in vec3 interpolatePos;
+in vec3 interpolateColor;
+in vec3 interpolateNormal;
+in vec2 interpolateTexCoord;
+
+// see GBuffer.h for the layout
+layout (location = 0) out vec4 gAlbedo;
+layout (location = 1) out vec4 gDiffuse;
+layout (location = 2) out vec4 gSpecular;
+layout (location = 3) out vec2 gNormal;
+
+#if HAS_NORMAL_MAP
+uniform sampler2D normalTexture;
+in vec4 interpolateTangent;
+#endif
+
+// unit vector -> octahedron folded onto the [-1, 1] square
+vec2 octEncode(vec3 n) {
+  n /= abs(n.x) + abs(n.y) + abs(n.z);
+  vec2 signs = vec2(n.x >= 0.f ? 1.f : -1.f, n.y >= 0.f ? 1.f : -1.f);
+  return n.z >= 0.f ? n.xy : (1.f - abs(n.yx)) * signs;
+}
+
+void main() {
+#if HAS_EYE_OFFSET
+  vec2 texCoord = interpolateTexCoord + eyeOffset;
+#else
+  vec2 texCoord = interpolateTexCoord;
+#endif
+#if HAS_TEXTURE
+  vec4 albedo = texture(sampleTexture, texCoord);
+#else
+  vec4 albedo = vec4(1.f);
+#endif
+  gAlbedo = vec4(albedo.rgb * interpolateColor, 1.f);
+  gDiffuse = vec4(material.diffuse, dot(material.ambient, vec3(1.f / 3.f)));
+  gSpecular = vec4(material.specular, 1.f);
+#if HAS_NORMAL_MAP
+  gNormal = octEncode(mappedNormal(normalTexture, interpolateTexCoord, interpolateNormal, interpolateTangent)) * 0.5f + 0.5f;
+#else
+  gNormal = octEncode(normalize(interpolateNormal)) * 0.5f + 0.5f;
+#endif
+}
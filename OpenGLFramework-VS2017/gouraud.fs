@@ -1,7 +1,13 @@
 #version 330 core
 
+// HAS_TEXTURE and HAS_EYE_OFFSET are defined by setShaders()
+
+#if HAS_EYE_OFFSET
 uniform vec2 eyeOffset;
+#endif
+#if HAS_TEXTURE
 uniform sampler2D sampleTexture;
+#endif
 
 in vec3 interpolateColor;
 in vec2 interpolateTexCoord;
@@ -9,5 +15,14 @@ in vec2 interpolateTexCoord;
 out vec4 FragColor;
 
 void main() {
-  FragColor = texture(sampleTexture, interpolateTexCoord + eyeOffset) * vec4(interpolateColor, 1.f); // component-wise multiplication
+#if HAS_EYE_OFFSET
+  vec2 texCoord = interpolateTexCoord + eyeOffset;
+#else
+  vec2 texCoord = interpolateTexCoord;
+#endif
+#if HAS_TEXTURE
+  FragColor = texture(sampleTexture, texCoord) * vec4(interpolateColor, 1.f); // component-wise multiplication
+#else
+  FragColor = vec4(interpolateColor, 1.f);
+#endif
 }
@@ -1,7 +1,8 @@
 #version 330 core
 
+// LIGHT_MODE is defined by setShaders()
+
 struct Light {
-  int mode;
   vec3 position;
   vec3 direction;
   float ambient;
@@ -36,6 +37,9 @@ layout (location = 3) in vec2 aTexCoord;
 out vec3 interpolateColor;
 out vec2 interpolateTexCoord;
 
+// adaptive shading draws it in the Phong half too, after the depth pre-pass
+invariant gl_Position;
+
 void main()
 {
   gl_Position = mvp * vec4(aPos, 1.f);
@@ -47,22 +51,29 @@ void main()
   vec3 ambient = light.ambient * material.ambient;
   // diffuse
   vec3 norm = normalize(normal); // TODO is this necessary?
-  vec3 lightDir = light.mode == 0 ? normalize(-light.direction) : normalize(light.position - position);
+#if LIGHT_MODE == 0 // directional light
+  vec3 lightDir = normalize(-light.direction);
+#else
+  vec3 lightDir = normalize(light.position - position);
+#endif
   vec3 diffuse = max(dot(norm, lightDir), 0.f) * light.diffuse * material.diffuse;
   // specular
   vec3 viewDir = normalize(viewPos - position);
   vec3 reflectDir = reflect(-lightDir, norm);
   vec3 specular = pow(max(dot(viewDir, reflectDir), 0.f), light.shininess) * light.specular * material.specular;
   // attenuation
-  if (light.mode == 1 || light.mode == 2) { // point light or spot light
+#if LIGHT_MODE == 1 || LIGHT_MODE == 2 // point light or spot light
+  {
     float distance = length(light.position - position);
     float attenuation = 1.f / (light.constant + light.linear * distance + light.quadratic * distance * distance);
     ambient  *= attenuation;
     diffuse  *= attenuation;
     specular *= attenuation;
   }
+#endif
   // spot
-  if (light.mode == 2) { // spot light
+#if LIGHT_MODE == 2 // spot light
+  {
     float cosineTheta = dot(lightDir, normalize(-light.direction));
     float spot = 0.f;
     if (cosineTheta > light.cosineCutOff) {
@@ -72,6 +83,7 @@ void main()
     diffuse  *= spot;
     specular *= spot;
   }
+#endif
   // light
   interpolateColor = (ambient + diffuse + specular) * aColor; // component-wise multiplication
   interpolateTexCoord = aTexCoord;
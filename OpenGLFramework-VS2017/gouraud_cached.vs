@@ -0,0 +1,22 @@
+#version 330 core
+
+// replays the colors gouraud.vs lit and transform feedback captured
+
+uniform mat4 mvp;
+
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aLitColor;
+layout (location = 3) in vec2 aTexCoord;
+
+out vec3 interpolateColor;
+out vec2 interpolateTexCoord;
+
+// adaptive shading draws it in the Phong half too, after the depth pre-pass
+invariant gl_Position;
+
+void main()
+{
+  gl_Position = mvp * vec4(aPos, 1.f);
+  interpolateColor = aLitColor;
+  interpolateTexCoord = aTexCoord;
+}
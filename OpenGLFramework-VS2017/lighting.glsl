@@ -0,0 +1,100 @@
+// shared by the fragment shaders: readProgramSources() inserts it after the
+// defines, ahead of the shader's own declarations, so everything here takes
+// its inputs as parameters
+
+struct Light {
+  vec3 position;
+  vec3 direction;
+  float ambient;
+  float diffuse;
+  float specular;
+  float shininess;
+  float constant;
+  float linear;
+  float quadratic;
+  float cosineCutOff;
+  float spotExponential;
+};
+
+struct Material {
+  vec3 ambient;
+  vec3 diffuse;
+  vec3 specular;
+};
+
+#if HAS_NORMAL_MAP
+// tangent space normal of the map -> world; as MikkTSpace expects, the
+// frame is neither normalized nor orthogonalized after interpolation
+vec3 mappedNormal(sampler2D normalMap, vec2 texCoord, vec3 normal, vec4 tangent) {
+  vec3 bitangent = tangent.w * cross(normal, tangent.xyz);
+  vec3 m = texture(normalMap, texCoord).xyz * 2.f - 1.f;
+  return normalize(m.x * tangent.xyz + m.y * bitangent + m.z * normal);
+}
+#endif
+
+#if HAS_SHADOW
+// see ShadowMaps.h
+uniform sampler2DArrayShadow shadowMap;
+uniform mat4 shadowMatrices[4];   // world -> shadow texture space
+uniform vec4 shadowSplits;        // far view depth of each cascade
+uniform int shadowCascades;
+uniform float shadowBias;
+
+// lit fraction of the key light at a world position
+float shadowFactor(vec3 position) {
+  float depth = 1.f / gl_FragCoord.w; // view depth for a perspective projection
+  int cascade = 0;
+  for (int i = 0; i < shadowCascades - 1; i++) {
+    if (depth > shadowSplits[i]) cascade = i + 1;
+  }
+  if (depth > shadowSplits[shadowCascades - 1]) return 1.f; // past the last cascade
+  vec4 coord = shadowMatrices[cascade] * vec4(position, 1.f);
+  coord.xyz /= coord.w;
+  if (any(greaterThan(abs(coord.xy - 0.5f), vec2(0.5f))) || coord.z > 1.f) return 1.f;
+  // four bilinear comparisons, 4x4 texels of hardware PCF
+  vec2 texel = 1.f / vec2(textureSize(shadowMap, 0).xy);
+  float lit = 0.f;
+  for (int y = -1; y <= 1; y += 2) {
+    for (int x = -1; x <= 1; x += 2) {
+      lit += texture(shadowMap, vec4(coord.xy + vec2(x, y) * texel, float(cascade), coord.z - shadowBias));
+    }
+  }
+  return lit * 0.25f;
+}
+#endif
+
+// the editable key light at a world position; shadow scales diffuse and specular
+vec3 keyLight(Light light, Material material, vec3 position, vec3 norm, vec3 viewDir, float shadow) {
+  // TODO light color
+  vec3 ambient = light.ambient * material.ambient;
+#if LIGHT_MODE == 0 // directional light
+  vec3 lightDir = normalize(-light.direction);
+#else
+  vec3 lightDir = normalize(light.position - position);
+#endif
+  vec3 diffuse = max(dot(norm, lightDir), 0.f) * light.diffuse * material.diffuse;
+  vec3 reflectDir = reflect(-lightDir, norm);
+  vec3 specular = pow(max(dot(viewDir, reflectDir), 0.f), light.shininess) * light.specular * material.specular;
+#if LIGHT_MODE == 1 || LIGHT_MODE == 2 // point light or spot light
+  {
+    float distance = length(light.position - position);
+    float attenuation = 1.f / (light.constant + light.linear * distance + light.quadratic * distance * distance);
+    ambient  *= attenuation;
+    diffuse  *= attenuation;
+    specular *= attenuation;
+  }
+#endif
+#if LIGHT_MODE == 2 // spot light
+  {
+    float cosineTheta = dot(lightDir, normalize(-light.direction));
+    float spot = 0.f;
+    if (cosineTheta > light.cosineCutOff) {
+      spot = pow(max(cosineTheta, 0.f), light.spotExponential);
+    }
+    ambient  *= spot;
+    diffuse  *= spot;
+    specular *= spot;
+  }
+#endif
+  return ambient + diffuse * shadow + specular * shadow;
+}
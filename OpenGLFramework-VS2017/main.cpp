@@ -1,7 +1,12 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <cstring>
 #include <vector>
+#include <map>
+#include <algorithm>
+#include <chrono>
+#include <functional>
 #define _USE_MATH_DEFINES
 #include <math.h>
 #include <glad/glad.h>
@@ -11,6 +16,21 @@
 #include <STB/stb_image.h>
 #include "Vectors.h"
 #include "Matrices.h"
+#include "Frustum.h"
+#include "RenderQueue.h"
+#include "OcclusionCuller.h"
+#include "LightClusters.h"
+#include "GBuffer.h"
+#include "ProgramCache.h"
+#include "FileWatcher.h"
+#include "ShadowMaps.h"
+#include "NormalGenerator.h"
+#include "Transform.h"
+#include "BatchMath.h"
+#include "Offscreen.h"
+#include "HeadlessContext.h"
+#include "FrameProfiler.h"
+#include "BenchmarkScript.h"
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "tiny_obj_loader.h"
 
@@ -21,6 +41,22 @@
 
 #define degToRad(theta) (theta / 180.f * M_PI)
 
+#ifndef GL_COMPLETION_STATUS_KHR
+# define GL_COMPLETION_STATUS_KHR 0x91B1 // KHR_parallel_shader_compile
+#endif
+typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+
+#ifndef GL_ANY_SAMPLES_PASSED_CONSERVATIVE
+# define GL_ANY_SAMPLES_PASSED_CONSERVATIVE 0x8D6A // GL 4.3 / ARB_ES3_compatibility
+#endif
+
+// transpose argument of glUniformMatrix4fv for a Matrix4's storage order
+#ifdef MATRIX4_COLUMN_MAJOR
+# define MATRIX4_TRANSPOSE GL_FALSE
+#else
+# define MATRIX4_TRANSPOSE GL_TRUE
+#endif
+
 using namespace std;
 
 // Default window size
@@ -54,7 +90,6 @@ struct Uniform {
   GLint iLocNormalTransform;
   GLint iLocMVP;
   GLint iLocViewPos;
-  GLint iLocLightMode;
   GLint iLocLightPos;
   GLint iLocLightDirection;
   GLint iLocLightAmbient;
@@ -71,13 +106,114 @@ struct Uniform {
   GLint iLocMaterialSpecular;
   GLint iLocEyeOffset;
 };
-Uniform uniform;
+Uniform uniform; // locations of the program in use
+
+struct ClusterUniform {
+  GLint iLocLights;
+  GLint iLocGrid;
+  GLint iLocIndices;
+  GLint iLocViewport;
+  GLint iLocDims;
+  GLint iLocSlice;
+};
+
+struct DeferredUniform {
+  GLint iLocInverseViewProjection;
+  GLint iLocDepthRange;
+};
+
+// shading programs are specialized at compile time, see shaderDefines()
+enum ShaderFamily {
+  GouraudFamily = 0,
+  PhongFamily,
+  ClusteredFamily,  // Phong with the clustered lights on top of the key light
+  GBufferFamily,    // geometry pass of the deferred path
+  DeferredFamily,   // full screen lighting pass of the deferred path
+  GouraudCachedFamily, // Gouraud replaying colors captured by transform feedback
+  ShaderFamilyCount
+};
+const char* shaderFamilyFiles[ShaderFamilyCount][2] = {
+  { "gouraud.vs",  "gouraud.fs"   },
+  { "shader.vs",   "shader.fs"    },
+  { "shader.vs",   "clustered.fs" },
+  { "shader.vs",   "gbuffer.fs"   },
+  { "deferred.vs", "deferred.fs"  },
+  { "gouraud_cached.vs", "gouraud.fs" },
+};
+// vertex output a family's programs record with transform feedback, for
+// updateGouraudCache(); NULL for none
+const char* shaderFamilyFeedbackVarying[ShaderFamilyCount] = {
+  "interpolateColor", NULL, NULL, NULL, NULL, NULL
+};
+const GLenum FEEDBACK_BUFFER_MODE = GL_INTERLEAVED_ATTRIBS;
+// GLSL every specialized fragment shader starts with, see insertDefines()
+const char* SHARED_SHADER_FILENAME = "lighting.glsl";
+const int VARIANT_LIGHT_MODE_MASK = 3; // LightMode
+const int VARIANT_HAS_TEXTURE     = 4;
+const int VARIANT_HAS_EYE_OFFSET  = 8;
+const int VARIANT_HAS_SHADOW      = 16;
+const int VARIANT_HAS_NORMAL_MAP  = 32;
+const int NORMAL_TEXTURE_UNIT = 10;
+struct ShadowUniform {
+  GLint iLocMatrices;
+  GLint iLocSplits;
+  GLint iLocCascades;
+  GLint iLocBias;
+};
+struct ProgramVariant {
+  GLuint program;
+  Uniform uniform;
+  ClusterUniform cluster;
+  DeferredUniform deferred;
+  ShadowUniform shadow;
+};
+map<int, ProgramVariant> g_programVariants; // family << 6 | variant bits, compiled on first use
+int g_currentVariant = -1;                  // key of the program in use, -1 after a pass change
+ProgramCache g_programCache;
+
+// compiled and linked without waiting, see startProgramBuild()
+struct ProgramBuild {
+  GLuint program;
+  GLuint vertexShader;
+  GLuint fragmentShader;
+  uint64_t cacheKey;
+  long long startFrame; // g_frameCount when the compile was issued
+};
+// a program rebuilt from its files when they change
+struct WatchedProgram {
+  GLuint* program;
+  const char* vertexShaderFilename;
+  const char* fragmentShaderFilename;
+  string defines;
+  const char* feedbackVarying;
+  int variant;          // key in g_programVariants, -1 for the fixed programs
+  bool isBuilding;
+  ProgramBuild build;
+};
+vector<WatchedProgram> g_watchedPrograms;
+FileWatcher g_shaderWatcher;
+bool g_hasParallelShaderCompile = false;
+GLADloadproc g_getProcAddress = NULL; // the loader glad was initialized with
+
+// defined with the other program setup below
+bool setShaders(GLuint& p, const char* vertexShaderFilename, const char* fragmentShaderFilename, const string& defines = "", const char* feedbackVarying = NULL);
+void getUniformLocations(GLuint p, Uniform& uniform);
+void getClusterUniformLocations(GLuint p, ClusterUniform& locations);
+void watchProgram(GLuint* p, const char* vertexShaderFilename, const char* fragmentShaderFilename, const string& defines, const char* feedbackVarying, int variant);
+
+struct BoxUniform {
+  GLint iLocMVP;
+  GLint iLocBoxCenter;
+  GLint iLocBoxExtent;
+};
+BoxUniform boxUniform;
 
 struct PhongMaterial {
   Vector3 Ka;
   Vector3 Kd;
   Vector3 Ks;
   GLuint diffuseTexture;
+  GLuint normalTexture;   // tangent space, 0 when the material has none
   vector<pair<GLfloat, GLfloat>> offsets;
 };
 
@@ -92,17 +228,50 @@ typedef struct {
   PhongMaterial material;
   int indexCount;
   GLuint p_texCoord;
+  GLuint p_tangent;       // packed tangent frames, only with normal mapped materials
+  BoundingBox bounds;     // object space
+  BoundingSphere sphere;  // object space
+  GLuint occlusionQuery;  // created on first use
+  GLuint vaoDepth;        // positions only, for the depth pre-pass
+  GLuint litColors;       // Gouraud colors captured by transform feedback
+  GLuint vaoLit;          // positions, captured colors and texture coordinates
+  bool isLitCached;       // litColors match the current lighting inputs
+  bool isPhongShaded;     // adaptive shading's choice for the right half
 } Shape;
 
+// everything gouraud.vs lights a model with; when any of it changes the
+// captured colors are stale
+struct GouraudInputs {
+  Matrix4 modelTransform;
+  Vector3 lightPos;
+  Vector3 viewPos;
+  float lightShininess = 0.f;
+  float lightDiffuse = 0.f;
+  float lightCutOffDegree = 0.f;
+  int lightMode = -1;
+  int programGeneration = -1; // bumped by the hot reload
+
+  bool operator==(const GouraudInputs& rhs) const {
+    return modelTransform == rhs.modelTransform && lightPos == rhs.lightPos && viewPos == rhs.viewPos &&
+           lightShininess == rhs.lightShininess && lightDiffuse == rhs.lightDiffuse &&
+           lightCutOffDegree == rhs.lightCutOffDegree && lightMode == rhs.lightMode &&
+           programGeneration == rhs.programGeneration;
+  }
+};
+
 struct model
 {
   Vector3 position = Vector3(0, 0, 0);
   Vector3 scale = Vector3(1, 1, 1);
-  Vector3 rotation = Vector3(0, 0, 0);  // Euler form
+  Quaternion rotation;                  // unit length, accumulated from mouse drags
+  unsigned version = 1;                 // bumped on every change of position, scale, rotation or layout
   vector<Shape> shapes;
   bool hasEye = false;
   GLint max_eye_offset = 7;
   GLint cur_eye_offset_idx = 0;
+  BoundsBatch bounds; // SoA copy of the shapes' bounds for culling
+  Transform layout;   // placement in scene mode
+  GouraudInputs litInputs; // of the shapes' captured Gouraud colors
 };
 vector<model> models;
 
@@ -111,6 +280,7 @@ struct camera
   Vector3 position;
   Vector3 center;
   Vector3 up_vector;
+  unsigned version = 1;   // bumped on every change, view_matrix follows in updateCameraMatrices()
 };
 camera main_camera;
 
@@ -120,11 +290,10 @@ struct project_setting
   GLfloat fovy; // degree
   GLfloat aspect;
   GLfloat left, right, top, bottom;
+  unsigned version = 1;   // bumped on every change, project_matrix follows in updateCameraMatrices()
 };
 project_setting proj;
 
-GLuint gouraudShading;
-GLuint phongShading;
 TransMode cur_trans_mode = GeoTranslation;
 LightMode g_lightMode = Directional;
 Vector3 g_lightPos(1.f, 1.f, 1.f);
@@ -134,14 +303,124 @@ float g_lightCutOffDegree = 30.f;
 
 Matrix4 view_matrix;
 Matrix4 project_matrix;
+unsigned g_viewVersion = 0;     // main_camera.version view_matrix was built from
+unsigned g_projectVersion = 0;  // proj.version project_matrix was built from
 
+vector<string> model_list{"../TextureModels/Fushigidane.obj", "../TextureModels/Mew.obj","../TextureModels/Nyarth.obj","../TextureModels/Zenigame.obj", "../TextureModels/laurana500.obj", "../TextureModels/Nala.obj", "../TextureModels/Square.obj"};
 int cur_idx = 0; // represent which model should be rendered now
 bool g_isWireframe = false;
 bool g_isMagnificationNearest = true;
 bool g_isMinificationNearest = true;
-Matrix4 g_translation;
-Matrix4 g_rotation;
-Matrix4 g_scaling;
+bool g_isFrustumCulling = true;
+Frustum g_frustum;
+vector<unsigned char> g_shapeVisible; // per shape of the current model, filled every frame
+Vector3Batch g_viewCenters;           // view space bounding sphere centers, same indexing
+
+struct RenderStats {
+  int shapesVisible;
+  int shapesCulled;
+  int draws;
+  int stateChanges;  // program, texture and vertex array binds
+  float sortMs;
+  int hizCulled;
+  int queriesIssued;
+  int queryCulled;   // of the previous frame, read back without waiting
+  float overdrawBefore;  // Phong fragments per pixel without / with the depth pre-pass
+  float overdrawAfter;
+  float clusterMs;   // light assignment and upload
+  float frameMs;     // smoothed over the last frames
+  int litCaptures;   // shapes whose Gouraud colors were captured this frame
+  int litReplays;    // shapes drawn from captured Gouraud colors
+  int adaptivePhong;     // visible shapes adaptive shading keeps on Phong
+  int adaptiveGouraud;   // and those it moves to Gouraud
+  float adaptivePhongPixels;   // estimated screen area of each group
+  float adaptiveGouraudPixels;
+  int transformsRebuilt; // models whose SceneTransform changed this frame
+};
+RenderStats g_stats;
+
+enum ShadingPass {
+  GouraudPass = 0,  // left half
+  DepthPrePass,     // right half, depth only
+  PhongPass,        // right half
+};
+bool g_isDepthPrePass = false;
+GLuint g_depthShading;
+GLint g_depthMVPLoc;
+GLuint g_overdrawQuery[2];      // samples passed in the depth pre-pass and in the Phong pass
+bool g_overdrawQueryIssued[2];
+bool g_isMeasuringOverdraw = false;
+
+enum OcclusionMode {
+  OcclusionOff = 0,
+  OcclusionHiZ,         // cull against the previous frame's depth pyramid
+  OcclusionHiZQueries,  // and confirm borderline shapes with hardware queries
+};
+OcclusionMode g_occlusionMode = OcclusionOff;
+HiZBuffer g_hiz;
+DepthReadback g_depthReadback;
+int g_occlusionSignature = -1; // what the pyramid was rendered from
+int g_occlusionWarmup = 0;     // frames whose readbacks still show the old view
+GLuint g_boundingBoxShading;
+GLuint g_unitCubeVAO;
+GLenum g_occlusionQueryTarget = GL_ANY_SAMPLES_PASSED;
+vector<DrawItem> g_borderlineItems;
+vector<DrawItem> g_pendingQueryItems;
+
+bool g_isClustered = false;
+int g_clusterLightCount = 64;
+const int MAX_DYNAMIC_LIGHTS = 1024;
+vector<ClusterLight> g_clusterLightBase; // at time 0, orbiting the y axis
+vector<ClusterLight> g_clusterLights;
+LightClusters g_lightClusters;
+chrono::steady_clock::time_point g_lastFrame;
+chrono::steady_clock::time_point g_startTime = chrono::steady_clock::now();
+double g_fixedFrameSeconds = 0.0; // > 0: animations advance this much per frame instead of with the clock
+long long g_frameCount = 0;       // frames rendered so far
+
+bool g_isDeferred = false; // the right half goes through the G-buffer
+GBuffer g_gbuffer;
+bool g_isGBufferCleared = false;
+GLuint g_emptyVAO;
+bool g_isLightSweepRequested = false;
+FrameProfiler g_profiler;
+bool g_isProfilerOverlay = false;
+
+NormalSettings g_normalSettings; // for meshes without vn records
+
+// a shape switches to Phong above the first projected area (pixels) and
+// back to Gouraud below the second, so it does not flicker at the border
+bool g_isAdaptiveShading = false;
+const float ADAPTIVE_PHONG_ENTER_PIXELS = 1024.f;
+const float ADAPTIVE_PHONG_LEAVE_PIXELS = 512.f;
+
+bool g_isGouraudCached = false;
+int g_programGeneration = 0;
+
+bool g_isShadowed = false;   // directional and spot lights only
+int g_shadowCascades = 3;
+ShadowMaps g_shadowMaps;
+const int SHADOW_TEXTURE_UNIT = 9;
+const float SHADOW_DISTANCE = 8.f;       // directional shadows end here
+const float SPOT_SHADOW_DISTANCE = 20.f;
+const float SHADOW_BIAS = 0.0005f;
+
+bool g_isSceneMode = false; // render every loaded model instead of models[cur_idx]
+// matrices derived from a model, the camera and the projection, kept until
+// one of them changes; see updateSceneTransform()
+struct SceneTransform {
+  Matrix4 modelTransform;
+  Matrix4 normalTransform;
+  Matrix4 modelView;
+  Matrix4 mvp;
+  unsigned modelVersion = 0;    // versions of the inputs, 0 is never built
+  unsigned viewVersion = 0;
+  unsigned projectVersion = 0;
+  bool isSceneMode = false;
+};
+vector<SceneTransform> g_sceneTransforms;
+vector<DrawItem> g_drawItems;
+vector<DrawItem> g_drawScratch;
 
 static GLvoid Normalize(GLfloat v[3])
 {
@@ -187,89 +466,16 @@ Matrix4 scaling(Vector3 vec)
 }
 
 
-// given a float value then ouput a rotation matrix alone axis-X (rotate alone axis-X)
-Matrix4 rotateX(GLfloat val)
-{
-  Matrix4 mat(
-  1.f, 0.f,      0.f,       0.f,
-  0.f, cos(val), -sin(val), 0.f,
-  0.f, sin(val), cos(val),  0.f,
-  0.f, 0.f,      0.f,       1.f
-  );
-  return mat;
-}
-
-// given a float value then ouput a rotation matrix alone axis-Y (rotate alone axis-Y)
-Matrix4 rotateY(GLfloat val)
-{
-  Matrix4 mat(
-  cos(val),  0.f, sin(val), 0.f,
-  0.f,       1.f, 0.f,      0.f,
-  -sin(val), 0.f, cos(val), 0.f,
-  0.f,       0.f, 0.f,      1.f
-  );
-  return mat;
-}
-
-// given a float value then ouput a rotation matrix alone axis-Z (rotate alone axis-Z)
-Matrix4 rotateZ(GLfloat val)
-{
-  Matrix4 mat(
-  cos(val), -sin(val), 0.f, 0.f,
-  sin(val), cos(val),  0.f, 0.f,
-  0.f,      0.f,       1.f, 0.f,
-  0.f,      0.f,       0.f, 1.f
-  );
-  return mat;
-}
-
-Matrix4 rotate(Vector3 vec)
-{
-  return rotateX(vec.x)*rotateY(vec.y)*rotateZ(vec.z);
-}
-
 // compute viewing matrix accroding to the setting of main_camera
 void setViewingMatrix()
 {
-  Vector3 eyeToCenter = main_camera.center - main_camera.position;
-  Vector3 normalizedEyeToCenter = eyeToCenter; normalizedEyeToCenter.normalize();
-  Vector3 firstRow = normalizedEyeToCenter.cross(main_camera.up_vector).normalize();
-  Vector3 secondRow = firstRow.cross(normalizedEyeToCenter);
-  Vector3 thirdRow = -normalizedEyeToCenter;
-  view_matrix = Matrix4(
-  firstRow.x,  firstRow.y,  firstRow.z,  0.f,
-  secondRow.x, secondRow.y, secondRow.z, 0.f,
-  thirdRow.x,  thirdRow.y,  thirdRow.z,  0.f,
-  0.f,         0.f,         0.f,         1.f
-  );
-  view_matrix *= Matrix4(
-  1.f, 0.f, 0.f, -main_camera.position.x,
-  0.f, 1.f, 0.f, -main_camera.position.y,
-  0.f, 0.f, 1.f, -main_camera.position.z,
-  0.f, 0.f, 0.f, 1.f
-  );
+  view_matrix = lookAtMatrix(main_camera.position, main_camera.center, main_camera.up_vector);
 }
 
 // compute persepective projection matrix
 void setPerspective()
 {
-  float radian = degToRad(proj.fovy);
-  float angle = cos(radian / 2.f) / sin(radian / 2.f);
-  float firstDiag  = proj.aspect >= 1.f ? angle / proj.aspect : angle;
-  float secondDiag = proj.aspect >= 1.f ? angle               : angle * proj.aspect;
-  project_matrix = Matrix4(
-  firstDiag, 0.f,        0.f,                                                             0.f,
-  0.f,       secondDiag, 0.f,                                                             0.f,
-  0.f,       0.f,        (proj.farClip + proj.nearClip) / (proj.nearClip - proj.farClip), 2.f * proj.farClip * proj.nearClip / (proj.nearClip - proj.farClip),
-  0.f,       0.f,        -1.f,                                                            0.f
-  );
-}
-
-void setGLMatrix(GLfloat* glm, Matrix4& m) {
-  glm[0] = m[0];  glm[4] = m[1];  glm[8] = m[2];   glm[12] = m[3];
-  glm[1] = m[4];  glm[5] = m[5];  glm[9] = m[6];   glm[13] = m[7];
-  glm[2] = m[8];  glm[6] = m[9];  glm[10] = m[10]; glm[14] = m[11];
-  glm[3] = m[12]; glm[7] = m[13]; glm[11] = m[14]; glm[15] = m[15];
+  project_matrix = perspectiveMatrix(proj.fovy, proj.aspect, proj.nearClip, proj.farClip);
 }
 
 // Call back function for window reshape
@@ -279,16 +485,31 @@ void ChangeSize(GLFWwindow* window, int width, int height)
   g_windowWidth = width;
   g_windowHeight = height;
   proj.aspect = (float)g_windowWidth / 2.f / (float)g_windowHeight;
-  setPerspective();
+  proj.version++;
 }
 
-void draw(Matrix4& modelTransform, Matrix4& normalTransform, GLfloat mvp[], int x, int y) {
+// rebuild view_matrix and project_matrix if main_camera or proj changed
+void updateCameraMatrices()
+{
+  if (g_viewVersion != main_camera.version) {
+    setViewingMatrix();
+    g_viewVersion = main_camera.version;
+  }
+  if (g_projectVersion != proj.version) {
+    setPerspective();
+    g_projectVersion = proj.version;
+  }
+}
+
+void setTransformUniforms(Matrix4& modelTransform, Matrix4& normalTransform, Matrix4& mvp) {
   // use uniform to send mvp to vertex shader
-  glUniformMatrix4fv(uniform.iLocModelTransform, 1, GL_TRUE, modelTransform.get());
-  glUniformMatrix4fv(uniform.iLocNormalTransform, 1, GL_TRUE, normalTransform.get());
-  glUniformMatrix4fv(uniform.iLocMVP, 1, GL_FALSE, mvp);
+  glUniformMatrix4fv(uniform.iLocModelTransform, 1, MATRIX4_TRANSPOSE, modelTransform.get());
+  glUniformMatrix4fv(uniform.iLocNormalTransform, 1, MATRIX4_TRANSPOSE, normalTransform.get());
+  glUniformMatrix4fv(uniform.iLocMVP, 1, MATRIX4_TRANSPOSE, mvp.get());
+}
+
+void setLightUniforms() {
   glUniform3f(uniform.iLocViewPos, main_camera.position.x, main_camera.position.y, main_camera.position.z);
-  glUniform1i(uniform.iLocLightMode, (int)g_lightMode);
   if (g_lightMode == Directional) {
     glUniform3f(uniform.iLocLightDirection, -g_lightPos.x, -g_lightPos.y, -g_lightPos.z);
   }
@@ -315,59 +536,823 @@ void draw(Matrix4& modelTransform, Matrix4& normalTransform, GLfloat mvp[], int
     glUniform1f(uniform.iLocLightLinear,    0.3f);
     glUniform1f(uniform.iLocLightQuadratic, 0.6f);
   }
+}
+
+void setMaterialUniforms(model& m, Shape& shape) {
+  glUniform3f(uniform.iLocMaterialAmbient,  shape.material.Ka.x, shape.material.Ka.y, shape.material.Ka.z);
+  glUniform3f(uniform.iLocMaterialDiffuse,  shape.material.Kd.x, shape.material.Kd.y, shape.material.Kd.z);
+  glUniform3f(uniform.iLocMaterialSpecular, shape.material.Ks.x, shape.material.Ks.y, shape.material.Ks.z);
+  if (!shape.material.offsets.empty()) { // eye
+    glUniform2f(uniform.iLocEyeOffset,
+                shape.material.offsets[m.cur_eye_offset_idx].first,
+                shape.material.offsets[m.cur_eye_offset_idx].second);
+  }
+  else {
+    glUniform2f(uniform.iLocEyeOffset, 0.f, 0.f);
+  }
+  if (shape.material.normalTexture) {
+    glActiveTexture(GL_TEXTURE0 + NORMAL_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_2D, shape.material.normalTexture);
+    glActiveTexture(GL_TEXTURE0);
+  }
+}
+
+// Bind texture and modify texture filtering & wrapping mode
+void bindDiffuseTexture(GLuint texture) {
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  if (g_isMagnificationNearest) glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  else glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  if (g_isMinificationNearest) glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_LINEAR);
+  else glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+}
+
+void useProgram(GLuint program, const Uniform& locations) {
+  glUseProgram(program);
+  uniform = locations;
+}
+
+void setClusterUniforms(const ClusterUniform& locations) {
+  g_lightClusters.bind(1);
+  glUniform4f(locations.iLocViewport, (float)(g_windowWidth / 2), 0.f, (float)(g_windowWidth / 2), (float)g_windowHeight);
+  glUniform3i(locations.iLocDims, CLUSTER_X, CLUSTER_Y, CLUSTER_Z);
+  glUniform2f(locations.iLocSlice, g_lightClusters.sliceScale(), g_lightClusters.sliceBias());
+}
+
+// the depth pre-pass and the Phong pass both draw into the G-buffer in deferred mode
+void bindGBuffer() {
+  g_gbuffer.bindForWriting();
+  if (!g_isGBufferCleared) {
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    g_isGBufferCleared = true;
+  }
+}
+
+// the left half always, the right half for the shapes adaptive shading deems too small
+bool isGouraudShaded(int pass, const Shape& shape) {
+  if (pass == GouraudPass) return true;
+  return pass == PhongPass && g_isAdaptiveShading && !g_isDeferred && !shape.isPhongShaded;
+}
+
+// the deferred lighting pass has no shadow lookup
+bool isShadowActive() {
+  return g_isShadowed && g_lightMode != Point && !g_isDeferred;
+}
+
+int shaderFamily(int pass) {
+  if (pass == GouraudPass) return GouraudFamily;
+  if (g_isDeferred) return GBufferFamily;
+  return g_isClustered ? ClusteredFamily : PhongFamily;
+}
+
+// the light mode is the same for every draw, the material flags come from the shape
+int variantKey(int family, const Shape* shape) {
+  int bits = 0;
+  if (family != GBufferFamily && family != GouraudCachedFamily) bits |= (int)g_lightMode;
+  if ((family == PhongFamily || family == ClusteredFamily) && isShadowActive()) bits |= VARIANT_HAS_SHADOW;
+  if (shape && family != DeferredFamily) {
+    if (shape->material.diffuseTexture) bits |= VARIANT_HAS_TEXTURE;
+    if (!shape->material.offsets.empty()) bits |= VARIANT_HAS_EYE_OFFSET;
+    if (shape->material.normalTexture && family != GouraudFamily && family != GouraudCachedFamily) bits |= VARIANT_HAS_NORMAL_MAP;
+  }
+  return family << 6 | bits;
+}
+
+void setShadowUniforms(const ShadowUniform& locations) {
+  GLfloat matrices[16 * MAX_SHADOW_CASCADES];
+  GLfloat splits[MAX_SHADOW_CASCADES] = { 0.f, 0.f, 0.f, 0.f };
+  for (int i = 0; i < g_shadowMaps.passCount(); i++) {
+    memcpy(&matrices[16 * i], g_shadowMaps.shadowMatrix(i).get(), sizeof(GLfloat) * 16);
+    splits[i] = g_shadowMaps.splitDepth(i);
+  }
+  glUniformMatrix4fv(locations.iLocMatrices, g_shadowMaps.passCount(), MATRIX4_TRANSPOSE, matrices);
+  glUniform4fv(locations.iLocSplits, 1, splits);
+  glUniform1i(locations.iLocCascades, g_shadowMaps.passCount());
+  glUniform1f(locations.iLocBias, SHADOW_BIAS);
+  g_shadowMaps.bindTexture(SHADOW_TEXTURE_UNIT);
+}
+
+// bits of variantKey() that are part of the draw key's program field
+unsigned materialVariantBits(const Shape& shape) {
+  return (shape.material.diffuseTexture ? 1 : 0) | (shape.material.offsets.empty() ? 0 : 2) | (shape.material.normalTexture ? 4 : 0);
+}
+
+string shaderDefines(int bits) {
+  return "#define LIGHT_MODE " + to_string(bits & VARIANT_LIGHT_MODE_MASK) + "\n" +
+         "#define HAS_TEXTURE " + to_string((bits & VARIANT_HAS_TEXTURE) ? 1 : 0) + "\n" +
+         "#define HAS_EYE_OFFSET " + to_string((bits & VARIANT_HAS_EYE_OFFSET) ? 1 : 0) + "\n" +
+         "#define HAS_SHADOW " + to_string((bits & VARIANT_HAS_SHADOW) ? 1 : 0) + "\n" +
+         "#define HAS_NORMAL_MAP " + to_string((bits & VARIANT_HAS_NORMAL_MAP) ? 1 : 0) + "\n";
+}
+
+// also binds the program to set its sampler units
+void getVariantLocations(int key, ProgramVariant& variant) {
+  getUniformLocations(variant.program, variant.uniform);
+  getClusterUniformLocations(variant.program, variant.cluster);
+  variant.deferred.iLocInverseViewProjection = glGetUniformLocation(variant.program, "inverseViewProjection");
+  variant.deferred.iLocDepthRange = glGetUniformLocation(variant.program, "depthRange");
+  variant.shadow.iLocMatrices = glGetUniformLocation(variant.program, "shadowMatrices");
+  variant.shadow.iLocSplits   = glGetUniformLocation(variant.program, "shadowSplits");
+  variant.shadow.iLocCascades = glGetUniformLocation(variant.program, "shadowCascades");
+  variant.shadow.iLocBias     = glGetUniformLocation(variant.program, "shadowBias");
+  glUniform1i(glGetUniformLocation(variant.program, "shadowMap"), SHADOW_TEXTURE_UNIT);
+  glUniform1i(glGetUniformLocation(variant.program, "normalTexture"), NORMAL_TEXTURE_UNIT);
+  if ((key >> 6) == DeferredFamily) {
+    const char* gbufferSamplers[GBufferTargetCount] = { "gAlbedo", "gDiffuse", "gSpecular", "gNormal", "gDepth" };
+    for (int i = 0; i < GBufferTargetCount; i++) {
+      glUniform1i(glGetUniformLocation(variant.program, gbufferSamplers[i]), 4 + i);
+    }
+  }
+}
+
+// a variant whose files fail to build stands in with another program of its
+// family, until the hot reload of a fixed edit fills in its own
+const ProgramVariant& getProgramVariant(int key) {
+  int family = key >> 6;
+  auto found = g_programVariants.find(key);
+  if (found == g_programVariants.end()) {
+    // map entries stay put, so the hot reload can hold on to the program
+    ProgramVariant& variant = g_programVariants[key];
+    if (setShaders(variant.program, shaderFamilyFiles[family][0], shaderFamilyFiles[family][1], shaderDefines(key & 63), shaderFamilyFeedbackVarying[family])) {
+      getVariantLocations(key, variant);
+    }
+    watchProgram(&variant.program, shaderFamilyFiles[family][0], shaderFamilyFiles[family][1], shaderDefines(key & 63), shaderFamilyFeedbackVarying[family], key);
+    found = g_programVariants.find(key);
+  }
+  if (found->second.program) return found->second;
+  for (auto& other : g_programVariants) {
+    if ((other.first >> 6) == family && other.second.program) return other.second;
+  }
+  return found->second; // nothing of the family built yet, draws nothing
+}
+
+// switch to the pass's program specialized for the shape, true when it changed
+// (transform uniforms then have to be set again)
+bool useShadingVariant(int pass, const Shape& shape) {
+  int family = shaderFamily(pass);
+  if (isGouraudShaded(pass, shape)) family = g_isGouraudCached && shape.isLitCached ? GouraudCachedFamily : GouraudFamily;
+  int key = variantKey(family, &shape);
+  if (key == g_currentVariant) return false;
+  const ProgramVariant& variant = getProgramVariant(key);
+  useProgram(variant.program, variant.uniform);
+  setLightUniforms();
+  if (family == ClusteredFamily) setClusterUniforms(variant.cluster);
+  if (key & VARIANT_HAS_SHADOW) setShadowUniforms(variant.shadow);
+  g_currentVariant = key;
+  g_stats.stateChanges++;
+  return true;
+}
+
+void beginShadingPass(int pass) {
+  g_profiler.begin(pass == GouraudPass ? ProfileGouraud : ProfilePhong);
+  glViewport(pass == GouraudPass ? 0 : g_windowWidth / 2, 0, g_windowWidth / 2, g_windowHeight);
+  g_currentVariant = -1; // picked per shape by useShadingVariant()
+  if (pass == GouraudPass) return;
+  int query = pass == DepthPrePass ? 0 : 1;
+  if (g_isMeasuringOverdraw) {
+    glBeginQuery(GL_SAMPLES_PASSED, g_overdrawQuery[query]);
+    g_overdrawQueryIssued[query] = true;
+  }
+  if (g_isDeferred) bindGBuffer();
+  if (pass == DepthPrePass) {
+    glUseProgram(g_depthShading);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    return;
+  }
+  if (g_isDepthPrePass) {
+    // only the nearest fragment of each pixel is shaded
+    glDepthFunc(GL_EQUAL);
+    glDepthMask(GL_FALSE);
+  }
+}
+
+void endShadingPass(int pass) {
+  g_profiler.end(pass == GouraudPass ? ProfileGouraud : ProfilePhong);
+  if (pass == GouraudPass) return;
+  if (g_isMeasuringOverdraw) glEndQuery(GL_SAMPLES_PASSED);
+  if (g_isDeferred) glBindFramebuffer(GL_FRAMEBUFFER, screenFramebuffer());
+  if (pass == DepthPrePass) {
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+  }
+  else {
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
+  }
+}
+
+// read last frame's overdraw queries, and only measure this frame once they are in
+void collectOverdrawQueries() {
+  GLuint samples[2] = { 0, 0 };
+  for (int i = 0; i < 2; i++) {
+    if (!g_overdrawQueryIssued[i]) continue;
+    GLuint available = 0;
+    glGetQueryObjectuiv(g_overdrawQuery[i], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) {
+      g_isMeasuringOverdraw = false;
+      return;
+    }
+    glGetQueryObjectuiv(g_overdrawQuery[i], GL_QUERY_RESULT, &samples[i]);
+  }
+  float pixels = (float)(g_windowWidth / 2) * g_windowHeight;
+  if (g_overdrawQueryIssued[1]) {
+    // the pre-pass passes depth exactly where Phong would shade without it
+    g_stats.overdrawBefore = (g_overdrawQueryIssued[0] ? samples[0] : samples[1]) / pixels;
+    g_stats.overdrawAfter = samples[1] / pixels;
+  }
+  g_overdrawQueryIssued[0] = g_overdrawQueryIssued[1] = false;
+  g_isMeasuringOverdraw = true;
+}
+
+void drawDepth(int idx) {
+  glUniformMatrix4fv(g_depthMVPLoc, 1, MATRIX4_TRANSPOSE, g_sceneTransforms[idx].mvp.get());
+  for (int i = 0; i < models[idx].shapes.size(); i++) {
+    if (g_shapeVisible[i] != 1) continue;
+    glBindVertexArray(models[idx].shapes[i].vaoDepth);
+    glDrawArrays(GL_TRIANGLES, 0, models[idx].shapes[i].vertex_count);
+    g_stats.draws++;
+    g_stats.stateChanges++;
+  }
+}
+
+// drop the captured Gouraud colors of models[idx] if its lighting changed
+void updateGouraudCache(int idx, const Matrix4& modelTransform) {
+  if (!g_isGouraudCached) return;
+  GouraudInputs inputs;
+  inputs.modelTransform = modelTransform;
+  inputs.lightPos = g_lightPos;
+  inputs.viewPos = main_camera.position;
+  inputs.lightShininess = g_lightShininess;
+  inputs.lightDiffuse = g_lightDiffuse;
+  inputs.lightCutOffDegree = g_lightCutOffDegree;
+  inputs.lightMode = (int)g_lightMode;
+  inputs.programGeneration = g_programGeneration;
+  if (inputs == models[idx].litInputs) return;
+  models[idx].litInputs = inputs;
+  for (auto& shape : models[idx].shapes) shape.isLitCached = false;
+}
+
+// vertex array a shading pass draws the shape from
+GLuint shadingVAO(int pass, const Shape& shape) {
+  if (isGouraudShaded(pass, shape) && g_isGouraudCached && shape.isLitCached) return shape.vaoLit;
+  return shape.vao;
+}
+
+// draw with the program of useShadingVariant(); a Gouraud draw without
+// valid captured colors records them on the way
+void drawShadingShape(int pass, Shape& shape) {
+  bool isGouraud = isGouraudShaded(pass, shape);
+  bool isCapturing = isGouraud && g_isGouraudCached && !shape.isLitCached;
+  if (isCapturing) {
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, shape.litColors);
+    glBeginTransformFeedback(GL_TRIANGLES);
+  }
+  glDrawArrays(GL_TRIANGLES, 0, shape.vertex_count);
+  if (isCapturing) {
+    glEndTransformFeedback();
+    shape.isLitCached = true;
+    g_stats.litCaptures++;
+  }
+  else if (isGouraud && g_isGouraudCached) {
+    g_stats.litReplays++;
+  }
+}
+
+void draw(int pass, Matrix4& modelTransform, Matrix4& normalTransform, Matrix4& mvp, int x, int y) {
   for (int i = 0; i < models[cur_idx].shapes.size(); i++) 
   {
+    if (g_shapeVisible[i] != 1) continue; // culled or left to drawBorderlineShapes()
+    if (useShadingVariant(pass, models[cur_idx].shapes[i])) {
+      setTransformUniforms(modelTransform, normalTransform, mvp);
+    }
     // set glViewport and draw twice ... 
-    glUniform3f(uniform.iLocMaterialAmbient,  models[cur_idx].shapes[i].material.Ka.x, models[cur_idx].shapes[i].material.Ka.y, models[cur_idx].shapes[i].material.Ka.z);
-    glUniform3f(uniform.iLocMaterialDiffuse,  models[cur_idx].shapes[i].material.Kd.x, models[cur_idx].shapes[i].material.Kd.y, models[cur_idx].shapes[i].material.Kd.z);
-    glUniform3f(uniform.iLocMaterialSpecular, models[cur_idx].shapes[i].material.Ks.x, models[cur_idx].shapes[i].material.Ks.y, models[cur_idx].shapes[i].material.Ks.z);
-    if (!models[cur_idx].shapes[i].material.offsets.empty()) { // eye
-      glUniform2f(uniform.iLocEyeOffset,
-                  models[cur_idx].shapes[i].material.offsets[models[cur_idx].cur_eye_offset_idx].first,
-                  models[cur_idx].shapes[i].material.offsets[models[cur_idx].cur_eye_offset_idx].second);
+    setMaterialUniforms(models[cur_idx], models[cur_idx].shapes[i]);
+    bindDiffuseTexture(models[cur_idx].shapes[i].material.diffuseTexture);
+    glBindVertexArray(shadingVAO(pass, models[cur_idx].shapes[i]));
+    glViewport(x, y, g_windowWidth / 2, g_windowHeight);
+    drawShadingShape(pass, models[cur_idx].shapes[i]);
+    g_stats.draws++;
+    g_stats.stateChanges += 2; // texture + vertex array
+  }
+}
+
+// model transform of models[idx], including its slot in the scene layout
+Transform getModelTransform(int idx) {
+  Transform transform(models[idx].position, models[idx].rotation, models[idx].scale);
+  if (g_isSceneMode) return models[idx].layout * transform;
+  return transform;
+}
+
+// bring g_sceneTransforms[idx] up to date, rebuilding only the matrices whose
+// inputs changed: the model matrices when the model or the scene mode did,
+// model view when those or the camera did, and the MVP after any of them or
+// the projection. Needs updateCameraMatrices() first.
+SceneTransform& updateSceneTransform(int idx) {
+  if (g_sceneTransforms.size() != models.size()) g_sceneTransforms.resize(models.size());
+  SceneTransform& st = g_sceneTransforms[idx];
+  bool isModelChanged = st.modelVersion != models[idx].version || st.isSceneMode != g_isSceneMode;
+  bool isViewChanged = isModelChanged || st.viewVersion != main_camera.version;
+  if (!isViewChanged && st.projectVersion == proj.version) return st;
+  if (isModelChanged) {
+    Transform transform = getModelTransform(idx);
+    st.modelTransform = transform.matrix();
+    st.normalTransform = transform.normalMatrix();
+    st.modelVersion = models[idx].version;
+    st.isSceneMode = g_isSceneMode;
+  }
+  if (isViewChanged) {
+    st.modelView = view_matrix.multiplyAffine(st.modelTransform);
+    st.viewVersion = main_camera.version;
+  }
+  st.mvp = project_matrix * st.modelView;
+  st.projectVersion = proj.version;
+  g_stats.transformsRebuilt++;
+  return st;
+}
+
+// place every model on a grid facing the default camera
+void layoutScene() {
+  int cols = (int)ceil(sqrt((float)models.size()));
+  int rows = ((int)models.size() + cols - 1) / cols;
+  float cell = 3.2f / max(cols, rows);
+  for (int i = 0; i < models.size(); i++) {
+    Vector3 offset(((i % cols) - (cols - 1) / 2.f) * cell, ((rows - 1) / 2.f - (i / cols)) * cell, 0.f);
+    models[i].layout = Transform(offset, Quaternion(), Vector3(cell * 0.45f, cell * 0.45f, cell * 0.45f));
+    models[i].version++;
+  }
+}
+
+// bounding sphere centers of every shape of models[idx] in view space, in one
+// batch over the SoA bounds
+void updateViewCenters(int idx, const Matrix4& modelView) {
+  const BoundsBatch& bounds = models[idx].bounds;
+  g_viewCenters.resize(bounds.size());
+  transformPoints(modelView, bounds.cx.data(), bounds.cy.data(), bounds.cz.data(), bounds.size(),
+                  g_viewCenters.x.data(), g_viewCenters.y.data(), g_viewCenters.z.data());
+}
+
+// pick Phong or Gouraud for the right half of every shape of models[idx] by
+// the projected area of its bounding sphere, and count the visible ones.
+// Needs updateViewCenters() for the same model first.
+void updateAdaptiveShading(int idx, const Matrix4& modelTransform) {
+  if (!g_isAdaptiveShading) return;
+  // largest axis scale of the model transform grows the object space radius
+  float scale = 0.f;
+  for (int axis = 0; axis < 3; axis++) {
+    Vector4 column = modelTransform.getColumn(axis);
+    float length = sqrtf(column.x * column.x + column.y * column.y + column.z * column.z);
+    if (length > scale) scale = length;
+  }
+  float pixelsPerUnit = project_matrix[5] * g_windowHeight * 0.5f; // at view depth 1
+  for (int i = 0; i < models[idx].shapes.size(); i++) {
+    Shape& shape = models[idx].shapes[i];
+    float radius = shape.sphere.radius * scale;
+    float depth = -g_viewCenters.z[i];
+    float pixels = 1e30f; // the camera is inside or at the sphere
+    if (depth > radius) {
+      float pixelRadius = radius / depth * pixelsPerUnit;
+      pixels = 3.14159265f * pixelRadius * pixelRadius;
+    }
+    if (pixels > ADAPTIVE_PHONG_ENTER_PIXELS) shape.isPhongShaded = true;
+    else if (pixels < ADAPTIVE_PHONG_LEAVE_PIXELS) shape.isPhongShaded = false;
+
+    if (!g_shapeVisible[i]) continue;
+    float viewportPixels = (float)(g_windowWidth / 2) * g_windowHeight;
+    if (pixels > viewportPixels) pixels = viewportPixels;
+    if (shape.isPhongShaded) {
+      g_stats.adaptivePhong++;
+      g_stats.adaptivePhongPixels += pixels;
     }
     else {
-      glUniform2f(uniform.iLocEyeOffset, 0.f, 0.f);
+      g_stats.adaptiveGouraud++;
+      g_stats.adaptiveGouraudPixels += pixels;
     }
-    // Bind texture and modify texture filtering & wrapping mode
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, models[cur_idx].shapes[i].material.diffuseTexture);
-    if (g_isMagnificationNearest) glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    else glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    if (g_isMinificationNearest) glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_LINEAR);
-    else glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glBindVertexArray(models[cur_idx].shapes[i].vao);
-    glViewport(x, y, g_windowWidth / 2, g_windowHeight);
-    glDrawArrays(GL_TRIANGLES, 0, models[cur_idx].shapes[i].vertex_count);
   }
 }
 
+// test the frustum-visible shapes of models[idx] against the depth pyramid.
+// occluded shapes get 0 in g_shapeVisible, borderline ones 2 (and are queued
+// for drawBorderlineShapes() when queries are enabled, else drawn as usual).
+void cullOccludedShapes(int idx, const Matrix4& MVP) {
+  if (g_occlusionMode == OcclusionOff || !g_hiz.isValid()) return;
+  for (int i = 0; i < models[idx].shapes.size(); i++) {
+    if (!g_shapeVisible[i]) continue;
+    OcclusionResult result = g_hiz.test(models[idx].shapes[i].bounds, MVP, 0, 0, g_windowWidth / 2, g_windowHeight);
+    if (result == OcclusionOccluded) {
+      g_shapeVisible[i] = 0;
+      g_stats.hizCulled++;
+    }
+    else if (result == OcclusionBorderline && g_occlusionMode == OcclusionHiZQueries) {
+      g_shapeVisible[i] = 2;
+      DrawItem item;
+      item.key = 0;
+      item.modelIndex = idx;
+      item.shapeIndex = i;
+      g_borderlineItems.push_back(item);
+    }
+  }
+}
+
+// issue an occlusion query per borderline box against the depth drawn so
+// far, then draw the shapes in both passes under conditional rendering
+void drawBorderlineShapes() {
+  if (g_borderlineItems.empty()) return;
+
+  glUseProgram(g_boundingBoxShading);
+  glViewport(0, 0, g_windowWidth / 2, g_windowHeight);
+  glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+  glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+  glDepthMask(GL_FALSE);
+  glBindVertexArray(g_unitCubeVAO);
+  for (auto& item : g_borderlineItems) {
+    Shape& shape = models[item.modelIndex].shapes[item.shapeIndex];
+    Vector3 center = shape.bounds.center();
+    Vector3 extent = shape.bounds.extent();
+    if (!shape.occlusionQuery) glGenQueries(1, &shape.occlusionQuery);
+    glUniformMatrix4fv(boxUniform.iLocMVP, 1, MATRIX4_TRANSPOSE, g_sceneTransforms[item.modelIndex].mvp.get());
+    glUniform3f(boxUniform.iLocBoxCenter, center.x, center.y, center.z);
+    glUniform3f(boxUniform.iLocBoxExtent, extent.x, extent.y, extent.z);
+    glBeginQuery(g_occlusionQueryTarget, shape.occlusionQuery);
+    glDrawArrays(GL_TRIANGLES, 0, 36);
+    glEndQuery(g_occlusionQueryTarget);
+    g_stats.queriesIssued++;
+  }
+  glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+  glDepthMask(GL_TRUE);
+  if (g_isWireframe) glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+
+  // not part of the overdraw measurement, which covers the main passes only
+  bool isMeasuringOverdraw = g_isMeasuringOverdraw;
+  g_isMeasuringOverdraw = false;
+  for (int pass = GouraudPass; pass <= PhongPass; pass++) {
+    if (pass == DepthPrePass && !g_isDepthPrePass) continue;
+    beginShadingPass(pass);
+    g_stats.stateChanges++;
+    for (auto& item : g_borderlineItems) {
+      model& m = models[item.modelIndex];
+      Shape& shape = m.shapes[item.shapeIndex];
+      SceneTransform& st = g_sceneTransforms[item.modelIndex];
+      if (pass == DepthPrePass) {
+        glUniformMatrix4fv(g_depthMVPLoc, 1, MATRIX4_TRANSPOSE, st.mvp.get());
+        glBindVertexArray(shape.vaoDepth);
+      }
+      else {
+        useShadingVariant(pass, shape);
+        setTransformUniforms(st.modelTransform, st.normalTransform, st.mvp);
+        setMaterialUniforms(m, shape);
+        bindDiffuseTexture(shape.material.diffuseTexture);
+        // no capture here, conditional rendering may discard the feedback
+        glBindVertexArray(shadingVAO(pass, shape));
+      }
+      glBeginConditionalRender(shape.occlusionQuery, GL_QUERY_WAIT);
+      glDrawArrays(GL_TRIANGLES, 0, shape.vertex_count);
+      glEndConditionalRender();
+      g_stats.draws++;
+      g_stats.stateChanges += 2;
+    }
+    endShadingPass(pass);
+  }
+  g_isMeasuringOverdraw = isMeasuringOverdraw;
+  g_pendingQueryItems = g_borderlineItems;
+}
+
+// count the previous frame's queries that found no sample, without stalling
+void collectOcclusionQueries() {
+  g_stats.queryCulled = 0;
+  for (auto& item : g_pendingQueryItems) {
+    GLuint query = models[item.modelIndex].shapes[item.shapeIndex].occlusionQuery;
+    GLuint available = 0, samples = 1;
+    glGetQueryObjectuiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) continue;
+    glGetQueryObjectuiv(query, GL_QUERY_RESULT, &samples);
+    if (!samples) g_stats.queryCulled++;
+  }
+  g_pendingQueryItems.clear();
+}
+
+// pick up the newest depth readback, unless it was rendered from another view
+void updateHiZ() {
+  int signature = ((cur_idx * 2 + (int)g_isSceneMode) * 8192 + g_windowWidth) * 8192 + g_windowHeight;
+  if (signature != g_occlusionSignature) {
+    g_occlusionSignature = signature;
+    g_occlusionWarmup = 2; // both buffered reads predate the change
+    g_hiz.invalidate();
+  }
+  g_hiz.setDepthRange(proj.nearClip, proj.farClip);
+  if (g_depthReadback.fetch(g_hiz) && g_occlusionWarmup > 0) {
+    g_occlusionWarmup--;
+    g_hiz.invalidate();
+  }
+}
+
+// deterministic light set, regenerated when the count changes
+void createClusterLights() {
+  g_clusterLightBase.resize(g_clusterLightCount);
+  srand(1);
+  for (auto& light : g_clusterLightBase) {
+    float u = rand() / (float)RAND_MAX, v = rand() / (float)RAND_MAX, w = rand() / (float)RAND_MAX;
+    light.position = Vector3(u * 3.6f - 1.8f, v * 3.6f - 1.8f, w * 2.f - 1.f);
+    light.range = 0.3f + 0.5f * rand() / (float)RAND_MAX;
+    light.color = Vector3(rand() / (float)RAND_MAX, rand() / (float)RAND_MAX, rand() / (float)RAND_MAX);
+    light.mode = rand() % 4 == 0 ? Spot : Point;
+    light.direction = Vector3(0.f, 0.f, -1.f);
+    light.cosineCutOff = cos(degToRad(35.f));
+  }
+}
+
+// seconds into the animations
+double animationTime() {
+  if (g_fixedFrameSeconds > 0.0) return g_frameCount * g_fixedFrameSeconds;
+  return chrono::duration<double>(chrono::steady_clock::now() - g_startTime).count();
+}
+
+void updateClusterLights() {
+  if (g_clusterLightBase.size() != g_clusterLightCount) createClusterLights();
+  float time = (float)animationTime();
+  // the deferred path always reads the lists, empty when clustered lights are off
+  g_clusterLights.resize(g_isClustered ? g_clusterLightBase.size() : 0);
+  for (int i = 0; i < g_clusterLights.size(); i++) {
+    const ClusterLight& base = g_clusterLightBase[i];
+    float angle = time * (0.2f + 0.05f * (i % 7));
+    float c = cos(angle), s = sin(angle);
+    g_clusterLights[i] = base;
+    g_clusterLights[i].position = Vector3(c * base.position.x + s * base.position.z, base.position.y, -s * base.position.x + c * base.position.z);
+  }
+  auto clusterBegin = chrono::high_resolution_clock::now();
+  g_lightClusters.setProjection(project_matrix[0], project_matrix[5], proj.nearClip, proj.farClip);
+  g_lightClusters.build(g_clusterLights, view_matrix);
+  g_lightClusters.upload();
+  g_stats.clusterMs = chrono::duration<float, milli>(chrono::high_resolution_clock::now() - clusterBegin).count();
+}
+
+// draw every model, sorted by draw key to minimize state changes
+void drawScene() {
+  g_profiler.begin(ProfileTransforms);
+  g_drawItems.clear();
+  for (int m = 0; m < models.size(); m++) {
+    SceneTransform& st = updateSceneTransform(m);
+    updateGouraudCache(m, st.modelTransform);
+
+    g_shapeVisible.assign(models[m].shapes.size(), 1);
+    int visible = (int)models[m].shapes.size();
+    if (g_isFrustumCulling) {
+      g_frustum.setFromMatrix(st.mvp);
+      visible = g_frustum.cull(models[m].bounds, g_shapeVisible.data());
+    }
+    g_stats.shapesVisible += visible;
+    g_stats.shapesCulled += (int)models[m].shapes.size() - visible;
+    cullOccludedShapes(m, st.mvp);
+    updateViewCenters(m, st.modelView);
+    updateAdaptiveShading(m, st.modelTransform);
+
+    for (int i = 0; i < models[m].shapes.size(); i++) {
+      if (g_shapeVisible[i] != 1) continue;
+      Shape& shape = models[m].shapes[i];
+      float depth01 = (-g_viewCenters.z[i] - proj.nearClip) / (proj.farClip - proj.nearClip);
+      for (int p = GouraudPass; p <= PhongPass; p++) {
+        DrawItem item;
+        if (p == DepthPrePass) {
+          if (!g_isDepthPrePass) continue;
+          item.key = makeDrawKey(p << 4, 0, shape.vaoDepth, depth01);
+        }
+        else {
+          // variants of a pass sort next to each other
+          unsigned program = p << 4 | (isGouraudShaded(p, shape) ? 8 : 0) | materialVariantBits(shape);
+          item.key = makeDrawKey(program, shape.material.diffuseTexture, shape.vao, depth01);
+        }
+        item.modelIndex = m;
+        item.shapeIndex = i;
+        g_drawItems.push_back(item);
+      }
+    }
+  }
+
+  auto sortBegin = chrono::high_resolution_clock::now();
+  radixSortDrawItems(g_drawItems, g_drawScratch);
+  g_stats.sortMs = chrono::duration<float, milli>(chrono::high_resolution_clock::now() - sortBegin).count();
+  g_profiler.end(ProfileTransforms);
+
+  // submit, only touching state that differs from the previous draw
+  unsigned curProgram = ~0u;
+  GLuint curTexture = 0, curVAO = 0;
+  int curModel = -1;
+  for (auto& item : g_drawItems) {
+    unsigned pass = drawKeyProgram(item.key) >> 4;
+    model& m = models[item.modelIndex];
+    Shape& shape = m.shapes[item.shapeIndex];
+    if (pass != curProgram) {
+      if (curProgram != ~0u) endShadingPass(curProgram);
+      beginShadingPass(pass);
+      curProgram = pass;
+      curTexture = curVAO = 0;
+      curModel = -1;
+      g_stats.stateChanges++;
+    }
+    if (pass != DepthPrePass && useShadingVariant(pass, shape)) curModel = -1;
+    if (item.modelIndex != curModel) {
+      SceneTransform& st = g_sceneTransforms[item.modelIndex];
+      if (pass == DepthPrePass) glUniformMatrix4fv(g_depthMVPLoc, 1, MATRIX4_TRANSPOSE, st.mvp.get());
+      else setTransformUniforms(st.modelTransform, st.normalTransform, st.mvp);
+      curModel = item.modelIndex;
+    }
+    if (pass != DepthPrePass && shape.material.diffuseTexture != curTexture) {
+      bindDiffuseTexture(shape.material.diffuseTexture);
+      curTexture = shape.material.diffuseTexture;
+      g_stats.stateChanges++;
+    }
+    GLuint vao = pass == DepthPrePass ? shape.vaoDepth : shadingVAO(pass, shape);
+    if (vao != curVAO) {
+      glBindVertexArray(vao);
+      curVAO = vao;
+      g_stats.stateChanges++;
+    }
+    if (pass != DepthPrePass) {
+      setMaterialUniforms(m, shape);
+      drawShadingShape(pass, shape);
+    }
+    else {
+      glDrawArrays(GL_TRIANGLES, 0, shape.vertex_count);
+    }
+    g_stats.draws++;
+  }
+  if (curProgram != ~0u) endShadingPass(curProgram);
+  drawBorderlineShapes();
+}
+
+// draw models[cur_idx] once per shading pass
+void drawModel() {
+  g_profiler.begin(ProfileTransforms);
+  SceneTransform& st = updateSceneTransform(cur_idx);
+  updateGouraudCache(cur_idx, st.modelTransform);
+
+  // frustum culling, planes are in the model's object space
+  g_shapeVisible.assign(models[cur_idx].shapes.size(), 1);
+  g_stats.shapesVisible = (int)models[cur_idx].shapes.size();
+  if (g_isFrustumCulling) {
+    g_frustum.setFromMatrix(st.mvp);
+    g_stats.shapesVisible = g_frustum.cull(models[cur_idx].bounds, g_shapeVisible.data());
+  }
+  g_stats.shapesCulled = (int)models[cur_idx].shapes.size() - g_stats.shapesVisible;
+  cullOccludedShapes(cur_idx, st.mvp);
+  updateViewCenters(cur_idx, st.modelView);
+  updateAdaptiveShading(cur_idx, st.modelTransform);
+  g_profiler.end(ProfileTransforms);
+
+  beginShadingPass(GouraudPass);
+  g_stats.stateChanges++;
+  draw(GouraudPass, st.modelTransform, st.normalTransform, st.mvp, 0, 0);
+  endShadingPass(GouraudPass);
+  if (g_isDepthPrePass) {
+    beginShadingPass(DepthPrePass);
+    g_stats.stateChanges++;
+    drawDepth(cur_idx);
+    endShadingPass(DepthPrePass);
+  }
+  beginShadingPass(PhongPass);
+  g_stats.stateChanges++;
+  draw(PhongPass, st.modelTransform, st.normalTransform, st.mvp, g_windowWidth / 2, 0);
+  endShadingPass(PhongPass);
+  drawBorderlineShapes();
+}
+
+// depth of every visible model from the light, one pass per cascade
+void renderShadowMaps() {
+  if (g_lightMode == Directional) {
+    g_shadowMaps.setupDirectional(-g_lightPos, g_shadowCascades, view_matrix,
+                                  project_matrix[0], project_matrix[5], proj.nearClip, SHADOW_DISTANCE);
+  }
+  else {
+    g_shadowMaps.setupSpot(g_lightPos, Vector3(0.f, 0.f, -1.f), g_lightCutOffDegree, SPOT_SHADOW_DISTANCE);
+  }
+
+  int first = g_isSceneMode ? 0 : cur_idx;
+  int last = g_isSceneMode ? (int)models.size() - 1 : cur_idx;
+  glUseProgram(g_depthShading);
+  glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+  // slope scaled offset against acne on surfaces at grazing angles to the light
+  glEnable(GL_POLYGON_OFFSET_FILL);
+  glPolygonOffset(2.f, 4.f);
+  Frustum lightFrustum;
+  for (int pass = 0; pass < g_shadowMaps.passCount(); pass++) {
+    g_shadowMaps.beginPass(pass);
+    for (int m = first; m <= last; m++) {
+      Matrix4 MVP = g_shadowMaps.lightMatrix(pass) * updateSceneTransform(m).modelTransform;
+      glUniformMatrix4fv(g_depthMVPLoc, 1, MATRIX4_TRANSPOSE, MVP.get());
+      // casters outside this pass's volume are skipped
+      g_shapeVisible.assign(models[m].shapes.size(), 1);
+      lightFrustum.setFromMatrix(MVP);
+      lightFrustum.cull(models[m].bounds, g_shapeVisible.data());
+      for (int i = 0; i < models[m].shapes.size(); i++) {
+        if (!g_shapeVisible[i]) continue;
+        glBindVertexArray(models[m].shapes[i].vaoDepth);
+        glDrawArrays(GL_TRIANGLES, 0, models[m].shapes[i].vertex_count);
+        g_stats.draws++;
+      }
+    }
+    g_shadowMaps.endPass(pass);
+  }
+  glDisable(GL_POLYGON_OFFSET_FILL);
+  g_shadowMaps.finishFrame();
+}
+
+// light the G-buffer once per pixel of the right half, then hand its depth
+// back to the default framebuffer
+void resolveDeferred() {
+  ProfileScope scope(g_profiler, ProfilePhong);
+  int x = g_windowWidth / 2, width = g_windowWidth / 2, height = g_windowHeight;
+  glViewport(x, 0, width, height);
+  const ProgramVariant& variant = getProgramVariant(variantKey(DeferredFamily, NULL));
+  useProgram(variant.program, variant.uniform);
+  setLightUniforms();
+  setClusterUniforms(variant.cluster);
+  Matrix4 inverseViewProjection = project_matrix * view_matrix;
+  inverseViewProjection.invert();
+  glUniformMatrix4fv(variant.deferred.iLocInverseViewProjection, 1, MATRIX4_TRANSPOSE, inverseViewProjection.get());
+  glUniform2f(variant.deferred.iLocDepthRange, proj.nearClip, proj.farClip);
+  g_gbuffer.bindTextures(4);
+  glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+  glDisable(GL_DEPTH_TEST);
+  glBindVertexArray(g_emptyVAO);
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+  glEnable(GL_DEPTH_TEST);
+  g_gbuffer.blitDepth(x, 0, width, height);
+  g_stats.draws++;
+}
+
 // Render function for display rendering
 void RenderScene(void) {  
   // clear canvas
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
-
-  Matrix4 T = translate(models[cur_idx].position);
-  Matrix4 R = rotate(models[cur_idx].rotation);
-  Matrix4 S = scaling(models[cur_idx].scale);
-  // update translation, rotation and scaling
-  g_translation = T; g_rotation = R; g_scaling = S;
-  Matrix4 modelTransform = T * R * S;
-  Matrix4 normalTransform(modelTransform);
-  normalTransform.invert();
-  normalTransform.transpose();
-  Matrix4 MVP = project_matrix * view_matrix * modelTransform;
-  GLfloat mvp[16];
-
-  // row-major ---> column-major
-  setGLMatrix(mvp, MVP);
+  g_profiler.beginFrame();
+
+  g_stats.shapesVisible = g_stats.shapesCulled = 0;
+  g_stats.draws = g_stats.stateChanges = 0;
+  g_stats.sortMs = 0.f;
+  g_stats.clusterMs = 0.f;
+  g_stats.litCaptures = g_stats.litReplays = 0;
+  g_stats.adaptivePhong = g_stats.adaptiveGouraud = 0;
+  g_stats.adaptivePhongPixels = g_stats.adaptiveGouraudPixels = 0.f;
+  g_stats.transformsRebuilt = 0;
+  updateCameraMatrices();
+  auto now = chrono::steady_clock::now();
+  float frameMs = chrono::duration<float, milli>(now - g_lastFrame).count();
+  g_stats.frameMs = g_stats.frameMs > 0.f && frameMs < 1000.f ? g_stats.frameMs * 0.95f + frameMs * 0.05f : frameMs;
+  g_lastFrame = now;
+  g_stats.hizCulled = g_stats.queriesIssued = 0;
+  g_borderlineItems.clear();
+  collectOcclusionQueries();
+  collectOverdrawQueries();
+  if (g_occlusionMode != OcclusionOff) updateHiZ();
+  if (g_isClustered || g_isDeferred) updateClusterLights();
+  if (g_isDeferred) {
+    g_gbuffer.resize(g_windowWidth, g_windowHeight);
+    g_isGBufferCleared = false;
+  }
+  if (isShadowActive()) renderShadowMaps();
 
   if (g_isWireframe) glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
   else glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-  glUseProgram(gouraudShading);
-  draw(modelTransform, normalTransform, mvp, 0, 0);
-  glUseProgram(phongShading);
-  draw(modelTransform, normalTransform, mvp, g_windowWidth / 2, 0);
+
+  if (g_isSceneMode) {
+    drawScene();
+  }
+  else {
+    drawModel();
+  }
+  if (g_isDeferred) resolveDeferred();
+
+  // depth of this frame becomes the occluders of the next one
+  if (g_occlusionMode != OcclusionOff) g_depthReadback.request(g_windowWidth, g_windowHeight);
+  if (g_isProfilerOverlay) g_profiler.drawOverlay(g_windowWidth, g_windowHeight);
+  g_frameCount++;
+}
+
+// frame time of clustered forward and deferred shading as the light count grows
+void runLightSweep() {
+  bool isClustered = g_isClustered, isDeferred = g_isDeferred;
+  int lightCount = g_clusterLightCount;
+  const int SWEEP_FRAMES = 30;
+  printf("Light sweep, %d frames each\n", SWEEP_FRAMES);
+  printf("lights  forward (ms)  deferred (ms)\n");
+  // the first row has the clustered lights off, the deferred pass then reads empty lists
+  for (int count = 0; count <= MAX_DYNAMIC_LIGHTS; count = max(count * 4, 1)) {
+    g_isClustered = count > 0;
+    if (count > 0) g_clusterLightCount = count;
+    float ms[2];
+    for (int deferred = 0; deferred < 2; deferred++) {
+      g_isDeferred = deferred != 0;
+      RenderScene(); // warm up
+      glFinish();
+      auto begin = chrono::high_resolution_clock::now();
+      for (int f = 0; f < SWEEP_FRAMES; f++) RenderScene();
+      glFinish();
+      ms[deferred] = chrono::duration<float, milli>(chrono::high_resolution_clock::now() - begin).count() / SWEEP_FRAMES;
+    }
+    if (count > 0) printf("%6d  %12.3f  %13.3f\n", count, ms[0], ms[1]);
+    else printf("%6s  %12.3f  %13.3f\n", "off", ms[0], ms[1]);
+  }
+  g_isClustered = isClustered;
+  g_isDeferred = isDeferred;
+  g_clusterLightCount = lightCount;
 }
 
 
@@ -375,6 +1360,7 @@ void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
 {
   // Call back function for keyboard
   if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS) {
+    g_profiler.finish();
     exit(0);
   }
   if (key == GLFW_KEY_W && action == GLFW_PRESS) {
@@ -418,11 +1404,30 @@ void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
     printf("Projection Matrix:\n");
     cout << project_matrix << endl;
     printf("Translation Matrix:\n");
-    cout << g_translation << endl;
+    cout << translate(models[cur_idx].position) << endl;
     printf("Rotation Matrix:\n");
-    cout << g_rotation << endl;
+    cout << toMatrix4(models[cur_idx].rotation) << endl;
     printf("Scaling Matrix:\n");
-    cout << g_scaling << endl;
+    cout << scaling(models[cur_idx].scale) << endl;
+    printf("Stats:\n");
+    printf("Frustum culling: %s, visible shapes: %d, culled shapes: %d\n", g_isFrustumCulling ? "on" : "off", g_stats.shapesVisible, g_stats.shapesCulled);
+    printf("Scene mode: %s, draws: %d, state changes: %d, sort time: %.3f ms\n", g_isSceneMode ? "on" : "off", g_stats.draws, g_stats.stateChanges, g_stats.sortMs);
+    printf("Transforms rebuilt: %d of %d models\n", g_stats.transformsRebuilt, (int)models.size());
+    const char* occlusionModeNames[] = { "off", "hi-z", "hi-z + queries" };
+    printf("Depth pre-pass: %s, shaded fragments per pixel before: %.2f, after: %.2f\n", g_isDepthPrePass ? "on" : "off", g_stats.overdrawBefore, g_stats.overdrawAfter);
+    printf("Clustered lights: %s, lights: %d, light references: %d, dropped: %d, cluster time: %.3f ms\n", g_isClustered ? "on" : "off", g_clusterLightCount, g_lightClusters.indexCount(), g_lightClusters.overflow(), g_stats.clusterMs);
+    printf("Deferred shading: %s, frame time: %.3f ms\n", g_isDeferred ? "on" : "off", g_stats.frameMs);
+    float adaptivePixels = g_stats.adaptivePhongPixels + g_stats.adaptiveGouraudPixels;
+    printf("Adaptive shading: %s, Phong shapes: %d, Gouraud shapes: %d, Phong fragments saved: ~%.0f (%.1f%%)\n",
+           g_isAdaptiveShading ? "on" : "off", g_stats.adaptivePhong, g_stats.adaptiveGouraud, g_stats.adaptiveGouraudPixels,
+           adaptivePixels > 0.f ? 100.f * g_stats.adaptiveGouraudPixels / adaptivePixels : 0.f);
+    printf("Gouraud color cache: %s, captured shapes: %d, replayed shapes: %d\n", g_isGouraudCached ? "on" : "off", g_stats.litCaptures, g_stats.litReplays);
+    printf("Shadows: %s, resolution: %d, passes: %d, GPU time:", isShadowActive() ? "on" : "off", g_shadowMaps.resolution(), g_shadowMaps.passCount());
+    for (int i = 0; i < g_shadowMaps.passCount(); i++) printf(" %.3f ms", g_shadowMaps.passMs(i));
+    printf("\n");
+    printf("Occlusion culling: %s, hi-z culled shapes: %d, queries issued: %d, query culled shapes: %d\n", occlusionModeNames[g_occlusionMode], g_stats.hizCulled, g_stats.queriesIssued, g_stats.queryCulled);
+    printf("Program cache: %s, hits: %d, misses: %d\n", g_programCache.isEnabled() ? "on" : "off", g_programCache.hits(), g_programCache.misses());
+    g_profiler.print();
     return;
   }
   if (key == GLFW_KEY_L && action == GLFW_PRESS) {
@@ -448,6 +1453,78 @@ void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
     cur_trans_mode = ShininessEdit;
     return;
   }
+  if (key == GLFW_KEY_M && action == GLFW_PRESS) {
+    g_isSceneMode ^= 1;
+    return;
+  }
+  if (key == GLFW_KEY_U && action == GLFW_PRESS) {
+    g_isClustered ^= 1;
+    return;
+  }
+  if ((key == GLFW_KEY_EQUAL || key == GLFW_KEY_KP_ADD) && action == GLFW_PRESS) {
+    g_clusterLightCount = min(g_clusterLightCount * 2, MAX_DYNAMIC_LIGHTS);
+    printf("Clustered lights: %d\n", g_clusterLightCount);
+    return;
+  }
+  if ((key == GLFW_KEY_MINUS || key == GLFW_KEY_KP_SUBTRACT) && action == GLFW_PRESS) {
+    g_clusterLightCount = max(g_clusterLightCount / 2, 1);
+    printf("Clustered lights: %d\n", g_clusterLightCount);
+    return;
+  }
+  if (key == GLFW_KEY_D && action == GLFW_PRESS) {
+    g_isDeferred ^= 1;
+    return;
+  }
+  if (key == GLFW_KEY_F && action == GLFW_PRESS) {
+    g_isLightSweepRequested = true;
+    return;
+  }
+  if (key == GLFW_KEY_Q && action == GLFW_PRESS) {
+    g_isProfilerOverlay ^= 1;
+    return;
+  }
+  if (key == GLFW_KEY_A && action == GLFW_PRESS) {
+    g_isAdaptiveShading ^= 1;
+    return;
+  }
+  if (key == GLFW_KEY_V && action == GLFW_PRESS) {
+    g_isGouraudCached ^= 1;
+    // colors captured before the cache was last switched off may be stale
+    for (auto& m : models) m.litInputs = GouraudInputs();
+    return;
+  }
+  if (key == GLFW_KEY_H && action == GLFW_PRESS) {
+    g_isShadowed ^= 1;
+    return;
+  }
+  if (key == GLFW_KEY_N && action == GLFW_PRESS) {
+    g_shadowCascades = g_shadowCascades % MAX_SHADOW_CASCADES + 1;
+    printf("Shadow cascades: %d\n", g_shadowCascades);
+    return;
+  }
+  if (key == GLFW_KEY_LEFT_BRACKET && action == GLFW_PRESS) {
+    g_shadowMaps.setResolution(max(g_shadowMaps.resolution() / 2, 256));
+    printf("Shadow map resolution: %d\n", g_shadowMaps.resolution());
+    return;
+  }
+  if (key == GLFW_KEY_RIGHT_BRACKET && action == GLFW_PRESS) {
+    g_shadowMaps.setResolution(min(g_shadowMaps.resolution() * 2, 4096));
+    printf("Shadow map resolution: %d\n", g_shadowMaps.resolution());
+    return;
+  }
+  if (key == GLFW_KEY_P && action == GLFW_PRESS) {
+    g_isDepthPrePass ^= 1;
+    return;
+  }
+  if (key == GLFW_KEY_O && action == GLFW_PRESS) {
+    g_occlusionMode = (OcclusionMode)((g_occlusionMode + 1) % 3);
+    g_hiz.invalidate();
+    return;
+  }
+  if (key == GLFW_KEY_C && action == GLFW_PRESS) {
+    g_isFrustumCulling ^= 1;
+    return;
+  }
   if (key == GLFW_KEY_G && action == GLFW_PRESS) {
     g_isMagnificationNearest ^= 1;
     return;
@@ -475,14 +1552,20 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
   // scroll up positive, otherwise it would be negtive
   if (cur_trans_mode == GeoTranslation) {
     models[cur_idx].position.z += yoffset;
+    models[cur_idx].version++;
     return;
   }
   if (cur_trans_mode == GeoScaling) {
     models[cur_idx].scale.z += yoffset / 10.f;
+    models[cur_idx].version++;
     return;
   }
   if (cur_trans_mode == GeoRotation) {
-    models[cur_idx].rotation.z += yoffset / 5.f;
+    // about the world Z axis, applied after the current orientation
+    Quaternion& rotation = models[cur_idx].rotation;
+    rotation = Quaternion(Vector3(0, 0, 1), yoffset / 5.f) * rotation;
+    rotation.normalize();
+    models[cur_idx].version++;
     return;
   }
   if (cur_trans_mode == LightEdit) {
@@ -534,14 +1617,20 @@ static void cursor_pos_callback(GLFWwindow* window, double xpos, double ypos)
   if (cur_trans_mode == GeoTranslation) {
     models[cur_idx].position.x += xoffset / 200.f;
     models[cur_idx].position.y += yoffset / 200.f;
+    models[cur_idx].version++;
   }
   else if (cur_trans_mode == GeoScaling) {
     models[cur_idx].scale.x += xoffset / 200.f;
     models[cur_idx].scale.y += yoffset / 200.f;
+    models[cur_idx].version++;
   }
   else if (cur_trans_mode == GeoRotation) {
-    models[cur_idx].rotation.x += yoffset / 200.f;
-    models[cur_idx].rotation.y -= xoffset / 200.f;
+    // vertical drags turn about the world X axis, horizontal ones about Y,
+    // so the model never gimbal-locks however it is already turned
+    Quaternion& rotation = models[cur_idx].rotation;
+    rotation = Quaternion(Vector3(1, 0, 0), yoffset / 200.f) * Quaternion(Vector3(0, 1, 0), -xoffset / 200.f) * rotation;
+    rotation.normalize();
+    models[cur_idx].version++;
   }
   else if (cur_trans_mode == LightEdit) {
     g_lightPos.x += xoffset / 200.f;
@@ -554,70 +1643,218 @@ static void cursor_pos_callback(GLFWwindow* window, double xpos, double ypos)
   starting_press_y = y;
 }
 
-void setShaders(GLuint& p, const char* vertexShaderFilename, const char* fragmentShaderFilename)
+// defines, then the shared chunk, go right after the #version line, which has to come first
+string insertDefines(const char* source, const string& defines, const string& shared = "")
+{
+  string text = source ? source : "";
+  if (defines.empty()) return text;
+  size_t lineEnd = text.find('\n', text.find("#version"));
+  if (lineEnd == string::npos) return text;
+  // keep the line numbers of compile errors pointing into the file; errors in
+  // the shared chunk are reported as source string 1
+  if (shared.empty()) return text.insert(lineEnd + 1, defines + "#line 2\n");
+  return text.insert(lineEnd + 1, defines + "#line 1 1\n" + shared + "\n#line 2 0\n");
+}
+
+void readProgramSources(const char* vertexShaderFilename, const char* fragmentShaderFilename, const string& defines,
+                        string& vertexSource, string& fragmentSource)
 {
-  GLuint v, f;
   char *vs = NULL;
   char *fs = NULL;
 
-  v = glCreateShader(GL_VERTEX_SHADER);
-  f = glCreateShader(GL_FRAGMENT_SHADER);
-
   vs = textFileRead(vertexShaderFilename);
   fs = textFileRead(fragmentShaderFilename);
 
-  glShaderSource(v, 1, (const GLchar**)&vs, NULL);
-  glShaderSource(f, 1, (const GLchar**)&fs, NULL);
+  char *shared = textFileRead(SHARED_SHADER_FILENAME);
+
+  vertexSource = insertDefines(vs, defines);
+  fragmentSource = insertDefines(fs, defines, shared ? shared : "");
 
   free(vs);
   free(fs);
+  free(shared);
+}
+
+// issue the compile and link without asking for their status, which would
+// wait for the driver to finish. feedbackVarying, unless NULL, is the vertex
+// output recorded by transform feedback.
+ProgramBuild startProgramBuild(const string& vertexSource, const string& fragmentSource, const char* feedbackVarying)
+{
+  ProgramBuild build;
+  build.cacheKey = g_programCache.key(vertexSource, fragmentSource, feedbackVarying, FEEDBACK_BUFFER_MODE);
+  build.startFrame = g_frameCount;
+  build.vertexShader = glCreateShader(GL_VERTEX_SHADER);
+  build.fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+
+  const GLchar* vertexText = vertexSource.c_str();
+  const GLchar* fragmentText = fragmentSource.c_str();
+  glShaderSource(build.vertexShader, 1, &vertexText, NULL);
+  glShaderSource(build.fragmentShader, 1, &fragmentText, NULL);
+  glCompileShader(build.vertexShader);
+  glCompileShader(build.fragmentShader);
+
+  // create program object
+  build.program = glCreateProgram();
+
+  // attach shaders to program object
+  glAttachShader(build.program, build.fragmentShader);
+  glAttachShader(build.program, build.vertexShader);
+
+  if (feedbackVarying) glTransformFeedbackVaryings(build.program, 1, &feedbackVarying, FEEDBACK_BUFFER_MODE);
+
+  // link program
+  if (g_programCache.isEnabled()) glProgramParameteri(build.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+  glLinkProgram(build.program);
+  return build;
+}
 
+// never in the frame that started the build. Later, without
+// KHR_parallel_shader_compile, the status query of finishProgramBuild() may
+// still wait, but the driver has had a whole frame to compile.
+bool isProgramBuildDone(const ProgramBuild& build)
+{
+  if (build.startFrame == g_frameCount) return false;
+  if (!g_hasParallelShaderCompile) return true;
+  GLint done = GL_FALSE;
+  glGetProgramiv(build.program, GL_COMPLETION_STATUS_KHR, &done);
+  return done == GL_TRUE;
+}
+
+// print the logs; on failure the program is deleted and false returned
+bool finishProgramBuild(ProgramBuild& build, const char* vertexShaderFilename, const char* fragmentShaderFilename)
+{
   GLint success;
   char infoLog[1000];
-  // compile vertex shader
-  glCompileShader(v);
   // check for shader compile errors
-  glGetShaderiv(v, GL_COMPILE_STATUS, &success);
+  glGetShaderiv(build.vertexShader, GL_COMPILE_STATUS, &success);
   if (!success)
   {
-    glGetShaderInfoLog(v, 1000, NULL, infoLog);
-    std::cout << "ERROR: VERTEX SHADER COMPILATION FAILED\n" << infoLog << std::endl;
+    glGetShaderInfoLog(build.vertexShader, 1000, NULL, infoLog);
+    std::cout << "ERROR: VERTEX SHADER COMPILATION FAILED (" << vertexShaderFilename << ")\n" << infoLog << std::endl;
   }
-
-  // compile fragment shader
-  glCompileShader(f);
-  // check for shader compile errors
-  glGetShaderiv(f, GL_COMPILE_STATUS, &success);
+  glGetShaderiv(build.fragmentShader, GL_COMPILE_STATUS, &success);
   if (!success)
   {
-    glGetShaderInfoLog(f, 1000, NULL, infoLog);
-    std::cout << "ERROR: FRAGMENT SHADER COMPILATION FAILED\n" << infoLog << std::endl;
+    glGetShaderInfoLog(build.fragmentShader, 1000, NULL, infoLog);
+    std::cout << "ERROR: FRAGMENT SHADER COMPILATION FAILED (" << fragmentShaderFilename << ")\n" << infoLog << std::endl;
   }
-
-  // create program object
-  p = glCreateProgram();
-
-  // attach shaders to program object
-  glAttachShader(p,f);
-  glAttachShader(p,v);
-
-  // link program
-  glLinkProgram(p);
   // check for linking errors
-  glGetProgramiv(p, GL_LINK_STATUS, &success);
+  glGetProgramiv(build.program, GL_LINK_STATUS, &success);
   if (!success) {
-    glGetProgramInfoLog(p, 1000, NULL, infoLog);
+    glGetProgramInfoLog(build.program, 1000, NULL, infoLog);
     std::cout << "ERROR: SHADER PROGRAM LINKING FAILED\n" << infoLog << std::endl;
   }
 
-  glDeleteShader(v);
-  glDeleteShader(f);
+  glDeleteShader(build.vertexShader);
+  glDeleteShader(build.fragmentShader);
+
+  if (!success) {
+    glDeleteProgram(build.program);
+    build.program = 0;
+    return false;
+  }
+  g_programCache.store(build.cacheKey, build.program);
+  return true;
+}
+
+// false, with the logs printed and p left 0, when the program fails to build
+bool setShaders(GLuint& p, const char* vertexShaderFilename, const char* fragmentShaderFilename, const string& defines, const char* feedbackVarying)
+{
+  string vertexSource, fragmentSource;
+  readProgramSources(vertexShaderFilename, fragmentShaderFilename, defines, vertexSource, fragmentSource);
+
+  // a binary linked by an earlier run skips compiling altogether
+  auto begin = chrono::high_resolution_clock::now();
+  p = g_programCache.load(g_programCache.key(vertexSource, fragmentSource, feedbackVarying, FEEDBACK_BUFFER_MODE));
+  if (p) {
+    printf("Program cache hit: %s + %s, %.2f ms\n", vertexShaderFilename, fragmentShaderFilename,
+           chrono::duration<float, milli>(chrono::high_resolution_clock::now() - begin).count());
+    return true;
+  }
+
+  ProgramBuild build = startProgramBuild(vertexSource, fragmentSource, feedbackVarying);
+  if (!finishProgramBuild(build, vertexShaderFilename, fragmentShaderFilename)) {
+    printf("Program build failed: %s + %s, waiting for the files to change\n", vertexShaderFilename, fragmentShaderFilename);
+    return false;
+  }
+  p = build.program;
+  printf("Program cache miss: %s + %s, compiled in %.2f ms\n", vertexShaderFilename, fragmentShaderFilename,
+         chrono::duration<float, milli>(chrono::high_resolution_clock::now() - begin).count());
+  return true;
+}
+
+void watchProgram(GLuint* p, const char* vertexShaderFilename, const char* fragmentShaderFilename, const string& defines, const char* feedbackVarying, int variant)
+{
+  WatchedProgram watched;
+  watched.program = p;
+  watched.vertexShaderFilename = vertexShaderFilename;
+  watched.fragmentShaderFilename = fragmentShaderFilename;
+  watched.defines = defines;
+  watched.feedbackVarying = feedbackVarying;
+  watched.variant = variant;
+  watched.isBuilding = false;
+  g_watchedPrograms.push_back(watched);
+  g_shaderWatcher.watch(vertexShaderFilename);
+  g_shaderWatcher.watch(fragmentShaderFilename);
+  if (!defines.empty()) g_shaderWatcher.watch(SHARED_SHADER_FILENAME);
+}
+
+void getFixedProgramLocations()
+{
+  boxUniform.iLocMVP       = glGetUniformLocation(g_boundingBoxShading, "mvp");
+  boxUniform.iLocBoxCenter = glGetUniformLocation(g_boundingBoxShading, "boxCenter");
+  boxUniform.iLocBoxExtent = glGetUniformLocation(g_boundingBoxShading, "boxExtent");
+  g_depthMVPLoc = glGetUniformLocation(g_depthShading, "mvp");
+}
+
+// called once per frame: start rebuilding the programs of edited files, and
+// swap in the ones whose link has finished. A failed build keeps the old
+// program running.
+void reloadChangedShaders()
+{
+  vector<string> changed = g_shaderWatcher.poll();
+  for (auto& watched : g_watchedPrograms) {
+    bool isAffected = false;
+    for (auto& file : changed) {
+      if (file == watched.vertexShaderFilename || file == watched.fragmentShaderFilename) isAffected = true;
+      if (file == SHARED_SHADER_FILENAME && !watched.defines.empty()) isAffected = true;
+    }
+    if (!isAffected) continue;
+    if (watched.isBuilding) {
+      // superseded by the newer edit
+      glDeleteShader(watched.build.vertexShader);
+      glDeleteShader(watched.build.fragmentShader);
+      glDeleteProgram(watched.build.program);
+    }
+    string vertexSource, fragmentSource;
+    readProgramSources(watched.vertexShaderFilename, watched.fragmentShaderFilename, watched.defines, vertexSource, fragmentSource);
+    watched.build = startProgramBuild(vertexSource, fragmentSource, watched.feedbackVarying);
+    watched.isBuilding = true;
+  }
+
+  for (auto& watched : g_watchedPrograms) {
+    if (!watched.isBuilding || !isProgramBuildDone(watched.build)) continue;
+    watched.isBuilding = false;
+    if (!finishProgramBuild(watched.build, watched.vertexShaderFilename, watched.fragmentShaderFilename)) {
+      printf("Shader reload failed: %s + %s, keeping the previous program\n", watched.vertexShaderFilename, watched.fragmentShaderFilename);
+      continue;
+    }
+    glDeleteProgram(*watched.program);
+    *watched.program = watched.build.program;
+    if (watched.variant >= 0) getVariantLocations(watched.variant, g_programVariants[watched.variant]);
+    else getFixedProgramLocations();
+    g_currentVariant = -1;
+    g_programGeneration++;
+    printf("Shader reloaded: %s + %s\n", watched.vertexShaderFilename, watched.fragmentShaderFilename);
+  }
+}
 
+void getUniformLocations(GLuint p, Uniform& uniform)
+{
   uniform.iLocModelTransform = glGetUniformLocation(p, "modelTransform");
   uniform.iLocNormalTransform = glGetUniformLocation(p, "normalTransform");
   uniform.iLocMVP = glGetUniformLocation(p, "mvp");
   uniform.iLocViewPos = glGetUniformLocation(p, "viewPos");
-  uniform.iLocLightMode            = glGetUniformLocation(p, "light.mode");
   uniform.iLocLightPos             = glGetUniformLocation(p, "light.position");
   uniform.iLocLightDirection       = glGetUniformLocation(p, "light.direction");
   uniform.iLocLightAmbient         = glGetUniformLocation(p, "light.ambient");
@@ -633,14 +1870,58 @@ void setShaders(GLuint& p, const char* vertexShaderFilename, const char* fragmen
   uniform.iLocMaterialDiffuse  = glGetUniformLocation(p, "material.diffuse");
   uniform.iLocMaterialSpecular = glGetUniformLocation(p, "material.specular");
   uniform.iLocEyeOffset = glGetUniformLocation(p, "eyeOffset");
+}
 
-  if (!success) {
-    system("pause");
-    exit(123);
+// cluster buffers go to texture units 1 to 3, leaves the program in use
+void getClusterUniformLocations(GLuint p, ClusterUniform& locations)
+{
+  locations.iLocLights   = glGetUniformLocation(p, "clusterLights");
+  locations.iLocGrid     = glGetUniformLocation(p, "clusterGrid");
+  locations.iLocIndices  = glGetUniformLocation(p, "clusterIndices");
+  locations.iLocViewport = glGetUniformLocation(p, "clusterViewport");
+  locations.iLocDims     = glGetUniformLocation(p, "clusterDims");
+  locations.iLocSlice    = glGetUniformLocation(p, "clusterSlice");
+  glUseProgram(p);
+  glUniform1i(locations.iLocLights,  1);
+  glUniform1i(locations.iLocGrid,    2);
+  glUniform1i(locations.iLocIndices, 3);
+}
+
+// 36 vertices of the [-1, 1] cube, scaled to a bounding box in bbox.vs
+void createUnitCube()
+{
+  const GLfloat corners[8][3] = {
+    {-1, -1, -1}, {1, -1, -1}, {1, 1, -1}, {-1, 1, -1},
+    {-1, -1,  1}, {1, -1,  1}, {1, 1,  1}, {-1, 1,  1}
+  };
+  const int faces[6][4] = { {0, 3, 2, 1}, {4, 5, 6, 7}, {0, 1, 5, 4}, {3, 7, 6, 2}, {0, 4, 7, 3}, {1, 2, 6, 5} };
+  vector<GLfloat> vertices;
+  for (auto& face : faces) {
+    const int triangles[6] = { face[0], face[1], face[2], face[0], face[2], face[3] };
+    for (int corner : triangles) vertices.insert(vertices.end(), corners[corner], corners[corner] + 3);
+  }
+  GLuint vbo;
+  glGenVertexArrays(1, &g_unitCubeVAO);
+  glBindVertexArray(g_unitCubeVAO);
+  glGenBuffers(1, &vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GLfloat), vertices.data(), GL_STATIC_DRAW);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+  glEnableVertexAttribArray(0);
+}
+
+bool hasExtension(const char* name)
+{
+  GLint numExt;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &numExt);
+  for (GLint i = 0; i < numExt; i++)
+  {
+    if (strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), name) == 0) return true;
   }
+  return false;
 }
 
-void normalization(tinyobj::attrib_t* attrib, vector<GLfloat>& vertices, vector<GLfloat>& colors, vector<GLfloat>& normals, vector<GLfloat>& textureCoords, vector<int>& material_id, tinyobj::shape_t* shape)
+void normalization(tinyobj::attrib_t* attrib, vector<GLfloat>& vertices, vector<GLfloat>& colors, vector<GLfloat>& normals, vector<GLfloat>& textureCoords, vector<int>& material_id, vector<int>& cornerVertex, tinyobj::shape_t* shape)
 {
   vector<float> xVector, yVector, zVector;
   float minX = 10000, maxX = -10000, minY = 10000, maxY = -10000, minZ = 10000, maxZ = -10000;
@@ -736,6 +2017,8 @@ void normalization(tinyobj::attrib_t* attrib, vector<GLfloat>& vertices, vector<
     attrib->vertices.at(i) = attrib->vertices.at(i) / scale;
   }
   size_t index_offset = 0;
+  size_t firstVertex = vertices.size(), firstNormal = normals.size();
+  bool hasNormals = true;
   for (size_t f = 0; f < shape->mesh.num_face_vertices.size(); f++) {
     int fv = shape->mesh.num_face_vertices[f];
 
@@ -750,20 +2033,45 @@ void normalization(tinyobj::attrib_t* attrib, vector<GLfloat>& vertices, vector<
       colors.push_back(attrib->colors[3 * idx.vertex_index + 0]);
       colors.push_back(attrib->colors[3 * idx.vertex_index + 1]);
       colors.push_back(attrib->colors[3 * idx.vertex_index + 2]);
-      // Optional: vertex normals
+      // shared position of the corner, for generated normals and tangents
+      cornerVertex.push_back(idx.vertex_index);
+      // Optional: vertex normals, generated below when any is missing
       if (idx.normal_index >= 0) {
         normals.push_back(attrib->normals[3 * idx.normal_index + 0]);
         normals.push_back(attrib->normals[3 * idx.normal_index + 1]);
         normals.push_back(attrib->normals[3 * idx.normal_index + 2]);
       }
+      else {
+        hasNormals = false;
+      }
       // Optional: texture coordinate
-      textureCoords.push_back(attrib->texcoords[2 * idx.texcoord_index + 0]);
-      textureCoords.push_back(attrib->texcoords[2 * idx.texcoord_index + 1]);
+      if (idx.texcoord_index >= 0) {
+        textureCoords.push_back(attrib->texcoords[2 * idx.texcoord_index + 0]);
+        textureCoords.push_back(attrib->texcoords[2 * idx.texcoord_index + 1]);
+      }
+      else {
+        textureCoords.push_back(0.f);
+        textureCoords.push_back(0.f);
+      }
       // The material of this vertex
       material_id.push_back(shape->mesh.material_ids[f]);
     }
     index_offset += fv;
   }
+
+  // every corner must have a normal, SplitShapeByMaterial() indexes them like the vertices
+  if (!hasNormals) {
+    auto begin = chrono::high_resolution_clock::now();
+    vector<GLfloat> shapeVertices(vertices.begin() + firstVertex, vertices.end());
+    vector<int> shapeCorners(cornerVertex.begin() + firstVertex / 3, cornerVertex.end());
+    vector<GLfloat> generated;
+    generateSmoothNormals(shapeVertices, shapeCorners, (int)attrib->vertices.size() / 3,
+                          shape->mesh.smoothing_group_ids, g_normalSettings, generated);
+    normals.resize(firstNormal);
+    normals.insert(normals.end(), generated.begin(), generated.end());
+    printf("Generated normals for %d triangles in %.2f ms\n", (int)shapeCorners.size() / 3,
+           chrono::duration<float, milli>(chrono::high_resolution_clock::now() - begin).count());
+  }
 }
 
 string GetBaseDir(const string& filepath) {
@@ -798,12 +2106,13 @@ GLuint LoadTextureImage(string image_path)
   }
 }
 
-vector<Shape> SplitShapeByMaterial(vector<GLfloat>& vertices, vector<GLfloat>& colors, vector<GLfloat>& normals, vector<GLfloat>& textureCoords, vector<int>& material_id, vector<PhongMaterial>& materials)
+vector<Shape> SplitShapeByMaterial(vector<GLfloat>& vertices, vector<GLfloat>& colors, vector<GLfloat>& normals, vector<GLfloat>& textureCoords, vector<GLuint>& tangents, vector<int>& material_id, vector<PhongMaterial>& materials)
 {
   vector<Shape> res;
   for (int m = 0; m < materials.size(); m++)
   {
     vector<GLfloat> m_vertices, m_colors, m_normals, m_textureCoords;
+    vector<GLuint> m_tangents;
     for (int v = 0; v < material_id.size(); v++) 
     {
       // extract all vertices with same material id and create a new shape for it.
@@ -823,6 +2132,8 @@ vector<Shape> SplitShapeByMaterial(vector<GLfloat>& vertices, vector<GLfloat>& c
 
         m_textureCoords.push_back(textureCoords[v * 2 + 0]);
         m_textureCoords.push_back(textureCoords[v * 2 + 1]);
+
+        if (!tangents.empty()) m_tangents.push_back(tangents[v]);
       }
     }
 
@@ -858,7 +2169,44 @@ vector<Shape> SplitShapeByMaterial(vector<GLfloat>& vertices, vector<GLfloat>& c
       glEnableVertexAttribArray(2);
       glEnableVertexAttribArray(3);
 
+      // 4 bytes per vertex, see generateTangents()
+      tmp_shape.p_tangent = 0;
+      if (!m_tangents.empty()) {
+        glGenBuffers(1, &tmp_shape.p_tangent);
+        glBindBuffer(GL_ARRAY_BUFFER, tmp_shape.p_tangent);
+        glBufferData(GL_ARRAY_BUFFER, m_tangents.size() * sizeof(GLuint), &m_tangents.at(0), GL_STATIC_DRAW);
+        glVertexAttribPointer(4, 4, GL_INT_2_10_10_10_REV, GL_TRUE, 0, 0);
+        glEnableVertexAttribArray(4);
+      }
+
+      // the depth pre-pass only fetches positions
+      glGenVertexArrays(1, &tmp_shape.vaoDepth);
+      glBindVertexArray(tmp_shape.vaoDepth);
+      glBindBuffer(GL_ARRAY_BUFFER, tmp_shape.vbo);
+      glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+      glEnableVertexAttribArray(0);
+
+      // Gouraud colors are captured here while the cache is on
+      glGenBuffers(1, &tmp_shape.litColors);
+      glBindBuffer(GL_ARRAY_BUFFER, tmp_shape.litColors);
+      glBufferData(GL_ARRAY_BUFFER, m_vertices.size() * sizeof(GL_FLOAT), NULL, GL_DYNAMIC_COPY);
+      glGenVertexArrays(1, &tmp_shape.vaoLit);
+      glBindVertexArray(tmp_shape.vaoLit);
+      glBindBuffer(GL_ARRAY_BUFFER, tmp_shape.vbo);
+      glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+      glBindBuffer(GL_ARRAY_BUFFER, tmp_shape.litColors);
+      glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
+      glBindBuffer(GL_ARRAY_BUFFER, tmp_shape.p_texCoord);
+      glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, 0, 0);
+      glEnableVertexAttribArray(0);
+      glEnableVertexAttribArray(1);
+      glEnableVertexAttribArray(3);
+      tmp_shape.isLitCached = false;
+      tmp_shape.isPhongShaded = true;
+
+      tmp_shape.occlusionQuery = 0;
       tmp_shape.material = materials[m];
+      computeBounds(&m_vertices.at(0), tmp_shape.vertex_count, tmp_shape.bounds, tmp_shape.sphere);
       res.push_back(tmp_shape);
     }
   }
@@ -875,7 +2223,9 @@ void LoadTexturedModels(string model_path)
   vector<GLfloat> colors;
   vector<GLfloat> normals;
   vector<GLfloat> textureCoords;
+  vector<GLuint> tangents;
   vector<int> material_id;
+  vector<int> cornerVertex;
 
   string err;
   string warn;
@@ -906,6 +2256,7 @@ void LoadTexturedModels(string model_path)
   model tmp_model;
 
   vector<PhongMaterial> allMaterial;
+  bool hasNormalMaps = false;
   for (int i = 0; i < materials.size(); i++)
   {
     PhongMaterial material;
@@ -924,6 +2275,14 @@ void LoadTexturedModels(string model_path)
       tmp_model.hasEye = true;
       material.offsets = {{0.f, 0.f}, {0.f, -0.25f}, {0.f, -0.5f}, {0.f, -0.75f}, {0.5f, 0.f}, {0.5f, -0.25f}, {0.5f, -0.5f}};
     }
+    // norm, else bump: most exporters write their tangent space normal map as map_Bump
+    string normalTexname = !materials[i].normal_texname.empty() ? materials[i].normal_texname : materials[i].bump_texname;
+    material.normalTexture = 0;
+    if (!normalTexname.empty()) {
+      material.normalTexture = LoadTextureImage(base_dir + normalTexname);
+      if (material.normalTexture == -1) material.normalTexture = 0; // falls back to the vertex normals
+      else hasNormalMaps = true;
+    }
     allMaterial.push_back(material);
   }
 
@@ -934,17 +2293,23 @@ void LoadTexturedModels(string model_path)
     colors.clear();
     normals.clear();
     textureCoords.clear();
+    tangents.clear();
     material_id.clear();
+    cornerVertex.clear();
 
-    normalization(&attrib, vertices, colors, normals, textureCoords, material_id, &shapes[i]);
+    normalization(&attrib, vertices, colors, normals, textureCoords, material_id, cornerVertex, &shapes[i]);
     // printf("Vertices size: %d", vertices.size() / 3);
+    if (hasNormalMaps) {
+      generateTangents(vertices, normals, textureCoords, cornerVertex, (int)attrib.vertices.size() / 3, g_normalSettings, tangents);
+    }
 
     // split current shape into multiple shapes base on material_id.
-    vector<Shape> splitedShapeByMaterial = SplitShapeByMaterial(vertices, colors, normals, textureCoords, material_id, allMaterial);
+    vector<Shape> splitedShapeByMaterial = SplitShapeByMaterial(vertices, colors, normals, textureCoords, tangents, material_id, allMaterial);
 
     // concatenate splited shape to model's shape list
     tmp_model.shapes.insert(tmp_model.shapes.end(), splitedShapeByMaterial.begin(), splitedShapeByMaterial.end());
   }
+  for (auto& shape : tmp_model.shapes) tmp_model.bounds.add(shape.bounds, shape.sphere);
   shapes.clear();
   materials.clear();
   models.push_back(tmp_model);
@@ -965,23 +2330,47 @@ void initParameter()
   main_camera.position = Vector3(0.0f, 0.0f, 2.0f);
   main_camera.center = Vector3(0.0f, 0.0f, 0.0f);
   main_camera.up_vector = Vector3(0.0f, 1.0f, 0.0f);
+  main_camera.version++;
+  proj.version++;
 
-  setViewingMatrix();
-  setPerspective(); //set default projection matrix as perspective matrix
+  updateCameraMatrices(); // viewing matrix and the default perspective projection
 }
 
 void setupRC()
 {
+  g_programCache.open("shader_cache");
   // setup shaders
-  setShaders(gouraudShading, "gouraud.vs", "gouraud.fs");
-  setShaders(phongShading,   "shader.vs",  "shader.fs" );
+  // shading programs are compiled on first use, see getProgramVariant()
+  glGenVertexArrays(1, &g_emptyVAO);
+  bool hasKhrParallelCompile = hasExtension("GL_KHR_parallel_shader_compile");
+  g_hasParallelShaderCompile = hasKhrParallelCompile || hasExtension("GL_ARB_parallel_shader_compile");
+  if (g_hasParallelShaderCompile) {
+    // compiles only run on driver threads once some are allowed;
+    // 0xFFFFFFFF lets the driver pick how many
+    PFNGLMAXSHADERCOMPILERTHREADSKHRPROC maxShaderCompilerThreads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)
+      g_getProcAddress(hasKhrParallelCompile ? "glMaxShaderCompilerThreadsKHR" : "glMaxShaderCompilerThreadsARB");
+    if (maxShaderCompilerThreads) maxShaderCompilerThreads(0xFFFFFFFF);
+  }
+  setShaders(g_boundingBoxShading, "bbox.vs", "bbox.fs");
+  watchProgram(&g_boundingBoxShading, "bbox.vs", "bbox.fs", "", NULL, -1);
+  createUnitCube();
+  setShaders(g_depthShading, "depth.vs", "depth.fs");
+  watchProgram(&g_depthShading, "depth.vs", "depth.fs", "", NULL, -1);
+  getFixedProgramLocations();
+  glGenQueries(2, g_overdrawQuery);
+  GLint major, minor;
+  glGetIntegerv(GL_MAJOR_VERSION, &major);
+  glGetIntegerv(GL_MINOR_VERSION, &minor);
+  if (major * 10 + minor >= 43 || hasExtension("GL_ARB_ES3_compatibility")) {
+    g_occlusionQueryTarget = GL_ANY_SAMPLES_PASSED_CONSERVATIVE;
+  }
   initParameter();
 
   // OpenGL States and Values
   glClearColor(0.2, 0.2, 0.2, 1.0);
-  vector<string> model_list{"../TextureModels/Fushigidane.obj", "../TextureModels/Mew.obj","../TextureModels/Nyarth.obj","../TextureModels/Zenigame.obj", "../TextureModels/laurana500.obj", "../TextureModels/Nala.obj", "../TextureModels/Square.obj"};
   // Load five model at here
   for (auto& modelFilePath : model_list) LoadTexturedModels(modelFilePath);
+  layoutScene();
 }
 
 void glPrintContextInfo(bool printExtension)
@@ -1003,8 +2392,227 @@ void glPrintContextInfo(bool printExtension)
 }
 
 
+struct LaunchOptions
+{
+  bool isHeadless = false;
+  int width = WINDOW_WIDTH, height = WINDOW_HEIGHT;
+  int frames = 1;
+  string outputPrefix;   // frames go to <prefix>0000.ppm ...; kept in memory only when empty
+  string profileCsv;
+  bool isProfilerOverlay = false;
+  string benchmarkScript;
+  string benchmarkOutput = "benchmark.json";
+};
+
+void printUsage(const char* program)
+{
+  printf("usage: %s [--model file.obj ...] [--profile-csv file] [--profile-overlay]\n", program);
+  printf("          [--benchmark script [--benchmark-output file]]\n");
+  printf("          [--headless [--size WxH] [--frames N] [--output prefix]]\n");
+  printf("  --model             load this model instead of the default list, repeatable\n");
+  printf("  --profile-csv       write the time of every frame phase to a CSV file\n");
+  printf("  --profile-overlay   start with the profiler bars shown (Q toggles them)\n");
+  printf("  --benchmark         play a keyframe script on every model, vsync off, then exit\n");
+  printf("  --benchmark-output  JSON results of --benchmark, default benchmark.json\n");
+  printf("  --headless          render offscreen through EGL, without a window\n");
+  printf("  --size              offscreen frame size, default %dx%d\n", WINDOW_WIDTH, WINDOW_HEIGHT);
+  printf("  --frames            frames to render, default 1\n");
+  printf("  --output            write every frame as <prefix>NNNN.ppm; otherwise frames stay in memory\n");
+}
+
+// false on an unknown or incomplete option
+bool parseArguments(int argc, char** argv, LaunchOptions& options)
+{
+  vector<string> models;
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (arg == "--headless") options.isHeadless = true;
+    else if (arg == "--model" && hasValue) models.push_back(argv[++i]);
+    else if (arg == "--frames" && hasValue) {
+      options.frames = atoi(argv[++i]);
+      if (options.frames <= 0) return false;
+    }
+    else if (arg == "--output" && hasValue) options.outputPrefix = argv[++i];
+    else if (arg == "--profile-csv" && hasValue) options.profileCsv = argv[++i];
+    else if (arg == "--profile-overlay") options.isProfilerOverlay = true;
+    else if (arg == "--benchmark" && hasValue) options.benchmarkScript = argv[++i];
+    else if (arg == "--benchmark-output" && hasValue) options.benchmarkOutput = argv[++i];
+    else if (arg == "--size" && hasValue) {
+      if (sscanf(argv[++i], "%dx%d", &options.width, &options.height) != 2 || options.width <= 0 || options.height <= 0) return false;
+    }
+    else return false;
+  }
+  if (!models.empty()) model_list = models;
+  return true;
+}
+
+// JSON string of s
+string jsonString(const string& s) {
+  string out = "\"";
+  for (char c : s) {
+    if (c == '"' || c == '\\') out += '\\';
+    out += c;
+  }
+  return out + "\"";
+}
+
+// nearest rank, of ascending values
+float percentile(const vector<float>& sorted, float p) {
+  return sorted[min((size_t)(p * sorted.size()), sorted.size() - 1)];
+}
+
+// camera, model transform and light of the script at t in [0, 1]
+void applyBenchmarkKeyframes(const BenchmarkScript& script, float t) {
+  if (script.hasCamera()) {
+    script.cameraAt(t, main_camera.position, main_camera.center);
+    main_camera.version++;
+  }
+  if (script.hasModel()) {
+    Transform transform = script.modelAt(t);
+    models[cur_idx].position = transform.translation;
+    models[cur_idx].rotation = transform.rotation;
+    models[cur_idx].scale = transform.scale;
+    models[cur_idx].version++;
+  }
+  if (script.hasLight()) g_lightPos = script.lightAt(t);
+}
+
+// plays the script on every model of model_list in turn and writes frame
+// time percentiles and triangle throughput per model to
+// options.benchmarkOutput. endFrame() completes a frame: a buffer swap, or
+// glFinish() without a window.
+bool runBenchmark(const BenchmarkScript& script, const LaunchOptions& options, const char* mode, const function<void()>& endFrame) {
+  ofstream json(options.benchmarkOutput, ios::trunc);
+  if (!json) {
+    cout << "Cannot write " << options.benchmarkOutput << endl;
+    return false;
+  }
+  // the same animation on every model and every run
+  g_fixedFrameSeconds = 1.0 / 60.0;
+  g_isSceneMode = false;
+  char line[512];
+  json << "{\n";
+  json << "  \"renderer\": " << jsonString((const char*)glGetString(GL_RENDERER)) << ",\n";
+  json << "  \"gl_version\": " << jsonString((const char*)glGetString(GL_VERSION)) << ",\n";
+  json << "  \"mode\": \"" << mode << "\",\n";
+  json << "  \"width\": " << g_windowWidth << ",\n";
+  json << "  \"height\": " << g_windowHeight << ",\n";
+  json << "  \"script\": " << jsonString(options.benchmarkScript) << ",\n";
+  json << "  \"frames\": " << script.frames << ",\n";
+  json << "  \"warmup\": " << script.warmup << ",\n";
+  json << "  \"models\": [\n";
+  printf("Benchmark, %s, %dx%d, %d frames per model\n", mode, g_windowWidth, g_windowHeight, script.frames);
+  printf("%-40s %10s %8s %8s %8s %8s %14s\n", "model", "triangles", "avg ms", "p50 ms", "p95 ms", "p99 ms", "triangles/s");
+  vector<float> frameMs(script.frames);
+  for (int m = 0; m < models.size(); m++) {
+    cur_idx = m;
+    g_frameCount = 0;
+    long long triangles = 0;
+    for (auto& shape : models[m].shapes) triangles += shape.vertex_count / 3;
+    for (int frame = -script.warmup; frame < script.frames; frame++) {
+      int f = max(frame, 0);
+      applyBenchmarkKeyframes(script, script.frames > 1 ? f / (float)(script.frames - 1) : 0.f);
+      auto begin = chrono::steady_clock::now();
+      RenderScene();
+      endFrame();
+      if (frame >= 0) frameMs[frame] = chrono::duration<float, milli>(chrono::steady_clock::now() - begin).count();
+    }
+    vector<float> sorted(frameMs);
+    sort(sorted.begin(), sorted.end());
+    double sum = 0.0;
+    for (float ms : sorted) sum += ms;
+    float average = (float)(sum / sorted.size());
+    double trianglesPerSecond = triangles * 1000.0 / average;
+    printf("%-40s %10lld %8.3f %8.3f %8.3f %8.3f %14.0f\n", model_list[m].c_str(), triangles, average,
+           percentile(sorted, 0.50f), percentile(sorted, 0.95f), percentile(sorted, 0.99f), trianglesPerSecond);
+    snprintf(line, sizeof(line),
+             "\"triangles\": %lld, \"avg_ms\": %.4f, \"p50_ms\": %.4f, \"p95_ms\": %.4f, \"p99_ms\": %.4f, "
+             "\"min_ms\": %.4f, \"max_ms\": %.4f, \"triangles_per_second\": %.0f",
+             triangles, average, percentile(sorted, 0.50f), percentile(sorted, 0.95f), percentile(sorted, 0.99f),
+             sorted.front(), sorted.back(), trianglesPerSecond);
+    json << "    {\"model\": " << jsonString(model_list[m]) << ", " << line << "}" << (m + 1 < models.size() ? "," : "") << "\n";
+  }
+  json << "  ],\n";
+  // programs are built on first use, so the warm-up frames account for most lookups
+  json << "  \"program_cache\": {\"enabled\": " << (g_programCache.isEnabled() ? "true" : "false")
+       << ", \"hits\": " << g_programCache.hits() << ", \"misses\": " << g_programCache.misses() << "}\n";
+  json << "}\n";
+  printf("Program cache: %d hits, %d misses\n", g_programCache.hits(), g_programCache.misses());
+  printf("Results written to %s\n", options.benchmarkOutput.c_str());
+  return (bool)json;
+}
+
+// renders options.frames frames into an OffscreenTarget, reading each one
+// back and writing it out when an output prefix is given, or runs the
+// benchmark script when there is one
+int runHeadless(const LaunchOptions& options, const BenchmarkScript& script)
+{
+#if defined(CG_HAS_EGL)
+  HeadlessContext context;
+  if (!context.create(3, 3)) return -1;
+  g_getProcAddress = (GLADloadproc)HeadlessContext::getProcAddress;
+  if (!gladLoadGLLoader(g_getProcAddress))
+  {
+    std::cout << "Failed to initialize GLAD" << std::endl;
+    return -1;
+  }
+  glPrintContextInfo(false);
+
+  OffscreenTarget target;
+  if (!target.resize(options.width, options.height)) return -1;
+  setScreenFramebuffer(target.framebuffer());
+  glBindFramebuffer(GL_FRAMEBUFFER, target.framebuffer());
+  ChangeSize(NULL, options.width, options.height);
+  // the same animation for every run, whatever the frame rate
+  g_fixedFrameSeconds = 1.0 / 60.0;
+  glEnable(GL_DEPTH_TEST);
+  setupRC();
+  if (!options.benchmarkScript.empty()) {
+    bool isWritten = runBenchmark(script, options, "headless", []() { glFinish(); });
+    g_profiler.finish();
+    return isWritten ? 0 : -1;
+  }
+
+  vector<unsigned char> pixels;
+  auto begin = chrono::steady_clock::now();
+  for (int frame = 0; frame < options.frames; frame++) {
+    RenderScene();
+    target.readPixels(pixels);
+    if (!options.outputPrefix.empty()) {
+      char path[1024];
+      snprintf(path, sizeof(path), "%s%04d.ppm", options.outputPrefix.c_str(), frame);
+      if (!target.writePPM(path, pixels)) return -1;
+    }
+  }
+  float ms = chrono::duration<float, milli>(chrono::steady_clock::now() - begin).count();
+  g_profiler.finish();
+  printf("Rendered %d frames of %dx%d offscreen, %.3f ms per frame\n", options.frames, options.width, options.height, ms / options.frames);
+  g_profiler.print();
+  return 0;
+#else
+  std::cout << "Built without EGL, --headless is not available" << std::endl;
+  return -1;
+#endif
+}
+
 int main(int argc, char **argv)
 {
+  LaunchOptions options;
+  if (!parseArguments(argc, argv, options)) {
+    printUsage(argv[0]);
+    return -1;
+  }
+  if (!options.profileCsv.empty() && !g_profiler.openCsv(options.profileCsv.c_str())) return -1;
+  g_isProfilerOverlay = options.isProfilerOverlay;
+  BenchmarkScript script;
+  if (!options.benchmarkScript.empty() && !script.load(options.benchmarkScript.c_str())) return -1;
+  if (options.isHeadless) return runHeadless(options, script);
+
+#if defined(CG_NO_GLFW)
+  std::cout << "Built without GLFW, only --headless is available" << std::endl;
+  return -1;
+#else
     // initial glfw
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
@@ -1028,7 +2636,8 @@ int main(int argc, char **argv)
     
     
     // load OpenGL function pointer
-    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+    g_getProcAddress = (GLADloadproc)glfwGetProcAddress;
+    if (!gladLoadGLLoader(g_getProcAddress))
     {
         std::cout << "Failed to initialize GLAD" << std::endl;
         return -1;
@@ -1044,20 +2653,42 @@ int main(int argc, char **argv)
   glEnable(GL_DEPTH_TEST);
   // Setup render context
   setupRC();
+  if (!options.benchmarkScript.empty()) {
+    glfwSwapInterval(0); // frame times of the renderer, not of the display
+    bool isWritten = runBenchmark(script, options, "window", [window]() {
+      glfwSwapBuffers(window);
+      glfwPollEvents();
+    });
+    g_profiler.finish();
+    glfwTerminate();
+    return isWritten ? 0 : -1;
+  }
 
   // main loop
     while (!glfwWindowShouldClose(window))
     {
+        reloadChangedShaders();
+        if (g_isLightSweepRequested) {
+          runLightSweep();
+          g_isLightSweepRequested = false;
+        }
+
         // render
         RenderScene();
         
         // swap buffer from back to front
+        g_profiler.begin(ProfileSwap);
         glfwSwapBuffers(window);
+        g_profiler.end(ProfileSwap);
         
         // Poll input event
+        g_profiler.begin(ProfilePoll);
         glfwPollEvents();
+        g_profiler.end(ProfilePoll);
     }
+  g_profiler.finish();
   
   // just for compatibiliy purposes
   return 0;
+#endif
 }
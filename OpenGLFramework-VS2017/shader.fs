@@ -1,31 +1,16 @@
 #version 330 core
 
-struct Light {
-  int mode;
-  vec3 position;
-  vec3 direction;
-  float ambient;
-  float diffuse;
-  float specular;
-  float shininess;
-  float constant;
-  float linear;
-  float quadratic;
-  float cosineCutOff;
-  float spotExponential;
-};
-
-struct Material {
-  vec3 ambient;
-  vec3 diffuse;
-  vec3 specular;
-};
+// LIGHT_MODE, HAS_TEXTURE, HAS_EYE_OFFSET, HAS_SHADOW and HAS_NORMAL_MAP are defined by setShaders()
 
 uniform vec3 viewPos;
 uniform Light light;
 uniform Material material;
+#if HAS_EYE_OFFSET
 uniform vec2 eyeOffset;
+#endif
+#if HAS_TEXTURE
 uniform sampler2D sampleTexture;
+#endif
 
 in vec3 interpolatePos;
 in vec3 interpolateColor;
@@ -34,38 +19,33 @@ in vec2 interpolateTexCoord;
 
 out vec4 FragColor;
 
+#if HAS_NORMAL_MAP
+uniform sampler2D normalTexture;
+in vec4 interpolateTangent;
+#endif
+
 void main() {
-  // TODO light color
-  // ambient
-  vec3 ambient = light.ambient * material.ambient;
-  // diffuse
+#if HAS_NORMAL_MAP
+  vec3 norm = mappedNormal(normalTexture, interpolateTexCoord, interpolateNormal, interpolateTangent);
+#else
   vec3 norm = normalize(interpolateNormal); // TODO interpolation may de-normalize pixel's normal vector?!
-  vec3 lightDir = light.mode == 0 ? normalize(-light.direction) : normalize(light.position - interpolatePos);
-  vec3 diffuse = max(dot(norm, lightDir), 0.f) * light.diffuse * material.diffuse;
-  // specular
+#endif
   vec3 viewDir = normalize(viewPos - interpolatePos);
-  vec3 reflectDir = reflect(-lightDir, norm);
-  vec3 specular = pow(max(dot(viewDir, reflectDir), 0.f), light.shininess) * light.specular * material.specular;
-  // attenuation
-  if (light.mode == 1 || light.mode == 2) { // point light or spot light
-    float distance = length(light.position - interpolatePos);
-    float attenuation = 1.f / (light.constant + light.linear * distance + light.quadratic * distance * distance);
-    ambient  *= attenuation;
-    diffuse  *= attenuation;
-    specular *= attenuation;
-  }
-  // spot
-  if (light.mode == 2) { // spot light
-    float cosineTheta = dot(lightDir, normalize(-light.direction));
-    float spot = 0.f;
-    if (cosineTheta > light.cosineCutOff) {
-      spot = pow(max(cosineTheta, 0.f), light.spotExponential);
-    }
-    ambient  *= spot;
-    diffuse  *= spot;
-    specular *= spot;
-  }
+#if HAS_SHADOW
+  float shadow = shadowFactor(interpolatePos);
+#else
+  float shadow = 1.f;
+#endif
   // light
-  vec3 result = (ambient + diffuse + specular) * interpolateColor; // component-wise multiplication
-  FragColor = texture(sampleTexture, interpolateTexCoord + eyeOffset) * vec4(result, 1.f); // component-wise multiplication
+  vec3 result = keyLight(light, material, interpolatePos, norm, viewDir, shadow) * interpolateColor; // component-wise multiplication
+#if HAS_EYE_OFFSET
+  vec2 texCoord = interpolateTexCoord + eyeOffset;
+#else
+  vec2 texCoord = interpolateTexCoord;
+#endif
+#if HAS_TEXTURE
+  FragColor = texture(sampleTexture, texCoord) * vec4(result, 1.f); // component-wise multiplication
+#else
+  FragColor = vec4(result, 1.f);
+#endif
 }
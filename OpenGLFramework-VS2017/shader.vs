@@ -1,5 +1,7 @@
 #version 330 core
 
+// HAS_NORMAL_MAP is defined by setShaders()
+
 uniform mat4 modelTransform;
 uniform mat4 normalTransform;
 uniform mat4 mvp;
@@ -8,11 +10,27 @@ layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aColor;
 layout (location = 2) in vec3 aNormal;
 layout (location = 3) in vec2 aTexCoord;
+#if HAS_NORMAL_MAP
+layout (location = 4) in vec4 aTangent; // octahedral tangent in xy, bitangent sign in w
+#endif
 
 out vec3 interpolatePos;
 out vec3 interpolateColor;
 out vec3 interpolateNormal;
 out vec2 interpolateTexCoord;
+#if HAS_NORMAL_MAP
+out vec4 interpolateTangent;
+
+// [-1, 1] square -> unit vector, inverse of the packing in NormalGenerator.cpp
+vec3 octDecode(vec2 e) {
+  vec3 v = vec3(e, 1.f - abs(e.x) - abs(e.y));
+  if (v.z < 0.f) v.xy = (1.f - abs(v.yx)) * vec2(v.x >= 0.f ? 1.f : -1.f, v.y >= 0.f ? 1.f : -1.f);
+  return normalize(v);
+}
+#endif
+
+// same depth as depth.vs, so the pre-pass depth passes GL_EQUAL
+invariant gl_Position;
 
 void main()
 {
@@ -22,5 +40,8 @@ void main()
   interpolateColor = aColor;
   interpolateNormal = mat3(normalTransform) * aNormal;
   interpolateTexCoord = aTexCoord;
+#if HAS_NORMAL_MAP
+  interpolateTangent = vec4(mat3(modelTransform) * octDecode(aTangent.xy), aTangent.w);
+#endif
 }
 
@@ -2,6 +2,17 @@
 #include <stdlib.h>
 #include <string.h>
 
+// fopen_s where the CRT has it, so the MSVC security checks stay quiet
+static FILE *openFile(const char *fn, const char *mode) {
+#ifdef _MSC_VER
+	FILE *fp = NULL;
+	if (fopen_s(&fp, fn, mode) != 0) return NULL;
+	return fp;
+#else
+	return fopen(fn, mode);
+#endif
+}
+
 char *textFileRead(const char *fn) {
 
 
@@ -11,7 +22,7 @@ char *textFileRead(const char *fn) {
 	int count = 0;
 
 	if (fn != NULL) {
-        auto err = fopen_s(&fp, fn, "rt");
+        fp = openFile(fn, "rt");
 
 		if (fp != NULL) {
 			fseek(fp, 0, SEEK_END);
@@ -38,7 +49,7 @@ int textFileWrite(char *fn, char *s) {
 	int status = 0;
 
 	if (fn != NULL) {
-		auto err = fopen_s(&fp, fn, "rt");
+		fp = openFile(fn, "w");
         
 		if (fp != NULL) {
 			if (fwrite(s, sizeof(char), strlen(s), fp) == strlen(s))